@@ -0,0 +1,412 @@
+/*
+  TouchKeys: multi-touch musical keyboard control software
+  Copyright (c) 2013 Andrew McPherson
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  =====================================================================
+
+  CentroidDecoderBenchmark.cpp: unpacks a stream of centroid frames key by
+  key, once with the per-colour, per-version loops TouchkeyDevice used to
+  have and once through the decoders in TouchkeyCentroidDecoder.h chosen the
+  way centroidLayoutInit() chooses them. Checks that both give the same
+  touches, then prints how many octave frames per second each manages.
+
+  The stream is either captured from the device or synthesized. A capture is
+  the raw bytes read from the serial port while the device is scanning (any
+  frames other than centroid frames in it are skipped); it is assumed to come
+  from firmware version 1 or later, so each frame starts with the octave and
+  a 4-byte frame number.
+
+  Not part of the TouchKeys program (Benchmarks/ is excluded from every build
+  configuration). Build it on its own from the project directory:
+
+    g++ -std=c++11 -O2 -I. -o CentroidDecoderBenchmark \
+        Benchmarks/CentroidDecoderBenchmark.cpp TouchKeys/TouchkeyFrameDecoder.cpp
+
+  Usage: CentroidDecoderBenchmark [capture-file [hardware-version]]
+  (a capture file of - synthesizes the stream for the given hardware version)
+*/
+
+#include "../TouchKeys/TouchkeyDevice.h"
+#include "../Utility/Time.h"
+
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+const int kSynthesizedFrames = 20000;			// Frames per octave when no capture is given
+const int kSynthesizedOctaves = 4;
+const int kBenchmarkMinimumOctaveFrames = 2000000;	// Octave frames decoded per timed run
+const int kValuesPerKey = 7;					// 3 positions, 3 sizes and the horizontal position
+
+typedef std::vector<unsigned char> CentroidFrame;
+
+// Sensor ranges and data lengths for one hardware version, as checkIfDevicePresent()
+// sets them from the status frame
+class CentroidBenchmarkHardware {
+public:
+	CentroidBenchmarkHardware(int hardwareVersion) : version(hardwareVersion) {
+		if (version >= 2) {
+			lengthWhite = kTransmissionLengthWhiteNewHardware;
+			lengthBlack = kTransmissionLengthBlackNewHardware;
+			whiteMaxX = kWhiteMaxXValueNewHardware;
+			whiteMaxY = kWhiteMaxYValueNewHardware;
+			blackMaxY = kBlackMaxYValueNewHardware;
+		} else {
+			lengthWhite = kTransmissionLengthWhiteOldHardware;
+			lengthBlack = kTransmissionLengthBlackOldHardware;
+			whiteMaxX = kWhiteMaxXValueOldHardware;
+			whiteMaxY = kWhiteMaxYValueOldHardware;
+			blackMaxY = kBlackMaxYValueOldHardware;
+		}
+
+		// Decoders for each key, as in TouchkeyDevice::centroidLayoutInit()
+		for (int key = 0; key < 13; key++) {
+			if (kKeyColor[key] == kKeyColorWhite) {
+				decode[key] = &decodeKeyCentroid<true, 6>;
+				scaleY[key] = 1.0 / whiteMaxY;
+				length[key] = lengthWhite;
+			} else {
+				if (version >= 2)
+					decode[key] = &decodeKeyCentroid<true, 6>;
+				else
+					decode[key] = &decodeKeyCentroid<false, 5>;
+				scaleY[key] = 1.0 / blackMaxY;
+				length[key] = lengthBlack;
+			}
+		}
+		scaleH = 1.0 / whiteMaxX;
+	}
+
+	int version;
+	int lengthWhite, lengthBlack;
+	float whiteMaxX, whiteMaxY, blackMaxY;
+
+	CentroidDecoder decode[13];
+	float scaleY[13];
+	int length[13];
+	float scaleH;
+};
+
+// Unpack one key the way processKeyCentroid() did before the decoders were
+// specialized by layout. Returns the number of touches.
+static int referenceDecodeKey(const CentroidBenchmarkHardware& hardware, bool white,
+		const unsigned char *buffer, float *sliderPosition, float *sliderSize,
+		float *sliderPositionH)
+{
+	int rawSliderPosition[3];
+	int rawSliderPositionH;
+	int touchCount = 0;
+
+	rawSliderPosition[0] = (((buffer[0] & 0xF0) << 4) + buffer[1]);
+	rawSliderPosition[1] = (((buffer[0] & 0x0F) << 8) + buffer[2]);
+	rawSliderPosition[2] = (((buffer[3] & 0xF0) << 4) + buffer[4]);
+
+	if (hardware.version >= 2) {
+		// Always an H value with version 2 sensor hardware
+		rawSliderPositionH = (((buffer[3] & 0x0F) << 8) + buffer[5]);
+
+		if (white) {
+			for (int i = 0; i < 3; i++) {
+				if (rawSliderPosition[i] != 0x0FFF) {// 0x0FFF means no touch
+					sliderPosition[i] = (float) rawSliderPosition[i]
+							/ hardware.whiteMaxY;
+					sliderSize[i] = (float) buffer[i + 6] / kSizeMaxValue;
+					touchCount++;
+				} else {
+					sliderPosition[i] = -1.0;
+					sliderSize[i] = 0.0;
+				}
+			}
+		} else {
+			for (int i = 0; i < 3; i++) {
+				if (rawSliderPosition[i] != 0x0FFF) {// 0x0FFF means no touch
+					sliderPosition[i] = (float) rawSliderPosition[i]
+							/ hardware.blackMaxY;
+					sliderSize[i] = (float) buffer[i + 6] / kSizeMaxValue;
+					touchCount++;
+				} else {
+					sliderPosition[i] = -1.0;
+					sliderSize[i] = 0.0;
+				}
+			}
+		}
+	} else {
+		// H value only on white keys with version 0-1 sensor hardware
+
+		if (white) {
+			rawSliderPositionH = (((buffer[3] & 0x0F) << 8) + buffer[5]);
+
+			for (int i = 0; i < 3; i++) {
+				if (rawSliderPosition[i] != 0x0FFF) {// 0x0FFF means no touch
+					sliderPosition[i] = (float) rawSliderPosition[i]
+							/ hardware.whiteMaxY;
+					sliderSize[i] = (float) buffer[i + 6] / kSizeMaxValue;
+					touchCount++;
+				} else {
+					sliderPosition[i] = -1.0;
+					sliderSize[i] = 0.0;
+				}
+			}
+		} else {
+			rawSliderPositionH = 0x0FFF;
+
+			for (int i = 0; i < 3; i++) {
+				if (rawSliderPosition[i] != 0x0FFF) {// 0x0FFF means no touch
+					sliderPosition[i] = (float) rawSliderPosition[i]
+							/ hardware.blackMaxY;
+					sliderSize[i] = (float) buffer[i + 5] / kSizeMaxValue;
+					touchCount++;
+				} else {
+					sliderPosition[i] = -1.0;
+					sliderSize[i] = 0.0;
+				}
+			}
+		}
+	}
+
+	if (rawSliderPositionH != 0x0FFF) {
+		*sliderPositionH = (float) rawSliderPositionH / hardware.whiteMaxX;
+	} else
+		*sliderPositionH = -1.0;
+
+	return touchCount;
+}
+
+// Walk the keys of one centroid frame as processCentroidFrame() and processKeyCentroid()
+// do, writing kValuesPerKey values per key to output. Returns the number of touches.
+template<bool useReference>
+static int decodeFrame(const CentroidBenchmarkHardware& hardware, const CentroidFrame& frame,
+		float *output)
+{
+	const unsigned char *buffer = &frame[0];
+	const int bufferLength = (int) frame.size();
+	int bufferIndex = 5;	// Octave and 4-byte frame number
+	int touchCount = 0;
+
+	while (bufferIndex < bufferLength) {
+		int key = (int) buffer[bufferIndex++];
+
+		if (key < 0 || key > 12 || bufferIndex + hardware.length[key] > bufferLength)
+			break;
+		if (buffer[bufferIndex] != 0x88) {	// Data not ready
+			float *values = &output[key * kValuesPerKey];
+
+			if (useReference)
+				touchCount += referenceDecodeKey(hardware, kKeyColor[key] == kKeyColorWhite,
+						&buffer[bufferIndex], &values[0], &values[3], &values[6]);
+			else
+				touchCount += hardware.decode[key](&buffer[bufferIndex], hardware.scaleY[key],
+						hardware.scaleH, &values[0], &values[3], &values[6]);
+		}
+		bufferIndex += hardware.length[key];
+	}
+
+	return touchCount;
+}
+
+// Keeps the centroid frames found in a captured byte stream
+class CentroidFrameCollector {
+public:
+	CentroidFrameCollector(std::vector<CentroidFrame>& frames) : frames_(frames) {}
+
+	void frameReceived(unsigned char * const frame, int length) {
+		if (length > 6 && frame[0] == kFrameTypeCentroid)
+			frames_.push_back(CentroidFrame(frame + 1, frame + length));
+	}
+
+private:
+	std::vector<CentroidFrame>& frames_;
+};
+
+static bool loadCapture(const char *filename, std::vector<CentroidFrame>& frames)
+{
+	std::ifstream file(filename, std::ios::in | std::ios::binary);
+
+	if (!file.is_open())
+		return false;
+
+	std::vector<unsigned char> stream((std::istreambuf_iterator<char>(file)),
+			std::istreambuf_iterator<char>());
+	CentroidFrameCollector collector(frames);
+	TouchkeyFrameDecoder decoder(boost::bind(&CentroidFrameCollector::frameReceived,
+			&collector, _1, _2), 0);
+
+	if (!stream.empty())
+		decoder.decode(&stream[0], (int) stream.size());
+	return true;
+}
+
+// Pack a 12-bit value into the shared nibble layout used by the device
+static void packPosition(unsigned char *data, int touch, int value)
+{
+	if (touch == 0) {
+		data[0] = (data[0] & 0x0F) | ((value >> 4) & 0xF0);
+		data[1] = value & 0xFF;
+	} else if (touch == 1) {
+		data[0] = (data[0] & 0xF0) | ((value >> 8) & 0x0F);
+		data[2] = value & 0xFF;
+	} else if (touch == 2) {
+		data[3] = (data[3] & 0x0F) | ((value >> 4) & 0xF0);
+		data[4] = value & 0xFF;
+	} else {	// Horizontal position
+		data[3] = (data[3] & 0xF0) | ((value >> 8) & 0x0F);
+		data[5] = value & 0xFF;
+	}
+}
+
+// Synthesize frames for a few octaves being played: most keys untouched, a couple
+// per octave with one or two touches moving slowly along them
+static void synthesizeFrames(const CentroidBenchmarkHardware& hardware,
+		std::vector<CentroidFrame>& frames)
+{
+	srand(1);
+	for (int f = 0; f < kSynthesizedFrames; f++) {
+		for (int octave = 0; octave < kSynthesizedOctaves; octave++) {
+			CentroidFrame frame;
+
+			frame.push_back(octave);
+			for (int i = 0; i < 4; i++)
+				frame.push_back((f >> (8 * i)) & 0xFF);
+
+			for (int key = 0; key < 13; key++) {
+				bool white = (kKeyColor[key] == kKeyColorWhite);
+				int length = hardware.length[key];
+				unsigned char data[16];
+				int touches = 0;
+
+				for (int i = 0; i < length; i++)
+					data[i] = 0xFF;
+				if ((key * 5 + octave * 3 + f / 500) % 13 < 2)
+					touches = 1 + (rand() % 4 == 0);
+
+				float maxY = white ? hardware.whiteMaxY : hardware.blackMaxY;
+				for (int t = 0; t < 3; t++)
+					packPosition(data, t, t < touches ? (int) (maxY * ((f % 500) + t * 100) / 800.0) : 0x0FFF);
+				if (white || hardware.version >= 2)
+					packPosition(data, 3, touches ? (int) (hardware.whiteMaxX * (rand() % 100) / 100.0) : 0x0FFF);
+				for (int t = 0; t < touches; t++)
+					data[t + (white || hardware.version >= 2 ? 6 : 5)] = 20 + rand() % 200;
+
+				frame.push_back(key);
+				frame.insert(frame.end(), data, data + length);
+			}
+			frames.push_back(frame);
+		}
+	}
+}
+
+// Decode every frame repeatedly; returns octave frames per second. The touch
+// counts and first positions are summed so the work can't be optimized away.
+template<bool useReference>
+static double timeDecoder(const CentroidBenchmarkHardware& hardware,
+		const std::vector<CentroidFrame>& frames, double& checksum)
+{
+	float output[13 * kValuesPerKey];
+	int passes = kBenchmarkMinimumOctaveFrames / (int) frames.size() + 1;
+
+	for (int j = 0; j < 13 * kValuesPerKey; j++)
+		output[j] = 0;
+
+	long long start = Time::getMicrosecondCounter();
+	for (int pass = 0; pass < passes; pass++) {
+		for (size_t i = 0; i < frames.size(); i++) {
+			checksum += decodeFrame<useReference>(hardware, frames[i], output);
+			for (int key = 0; key < 13; key++)
+				checksum += output[key * kValuesPerKey];
+		}
+	}
+	long long elapsed = Time::getMicrosecondCounter() - start;
+
+	if (elapsed <= 0)
+		elapsed = 1;
+	return (double) passes * frames.size() * 1.0e6 / (double) elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<CentroidFrame> frames;
+	int hardwareVersion = 2;
+
+	if (argc > 2)
+		hardwareVersion = atoi(argv[2]);
+	CentroidBenchmarkHardware hardware(hardwareVersion);
+
+	bool captured = (argc > 1 && strcmp(argv[1], "-") != 0);
+
+	if (captured) {
+		if (!loadCapture(argv[1], frames)) {
+			std::cerr << "Couldn't open capture " << argv[1] << std::endl;
+			return 1;
+		}
+	} else
+		synthesizeFrames(hardware, frames);
+
+	if (frames.empty()) {
+		std::cerr << "No centroid frames to decode\n";
+		return 1;
+	}
+
+	// Check that both give the same touches, to within rounding of the scale factors
+	unsigned long touches = 0, mismatches = 0;
+
+	for (size_t i = 0; i < frames.size(); i++) {
+		float reference[13 * kValuesPerKey], decoded[13 * kValuesPerKey];
+
+		for (int j = 0; j < 13 * kValuesPerKey; j++)
+			reference[j] = decoded[j] = 0;
+		int referenceTouches = decodeFrame<true>(hardware, frames[i], reference);
+		int decodedTouches = decodeFrame<false>(hardware, frames[i], decoded);
+
+		touches += referenceTouches;
+		if (referenceTouches != decodedTouches) {
+			mismatches++;
+			continue;
+		}
+		for (int j = 0; j < 13 * kValuesPerKey; j++) {
+			if (fabsf(reference[j] - decoded[j]) > 1.0e-6f * std::max(1.0f, fabsf(reference[j]))) {
+				mismatches++;
+				break;
+			}
+		}
+	}
+
+	if (mismatches != 0) {
+		std::cerr << mismatches << " of " << frames.size() << " frames decoded differently\n";
+		return 1;
+	}
+
+	double referenceChecksum = 0, decodedChecksum = 0;
+	double referenceRate = timeDecoder<true>(hardware, frames, referenceChecksum);
+	double decodedRate = timeDecoder<false>(hardware, frames, decodedChecksum);
+
+	std::cout << frames.size() << " octave frames (" << touches << " touches), hardware version "
+			<< hardwareVersion << (captured ? ", captured" : ", synthesized") << std::endl;
+	std::cout << "per-colour loops: " << referenceRate << " octave frames/s ("
+			<< 1.0e9 / referenceRate << " ns each)\n";
+	std::cout << "layout decoders:  " << decodedRate << " octave frames/s ("
+			<< 1.0e9 / decodedRate << " ns each)\n";
+	if (fabs(referenceChecksum - decodedChecksum) > 1.0e-6 * fabs(referenceChecksum)) {
+		std::cerr << "Checksums differ\n";
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,220 @@
+/*
+  TouchKeys: multi-touch musical keyboard control software
+  Copyright (c) 2013 Andrew McPherson
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  =====================================================================
+
+  FrameDecoderBenchmark.cpp: feeds a synthetic escaped byte stream through
+  the byte-at-a-time state machine that TouchkeyDevice used to carry in its
+  run loops, and through TouchkeyFrameDecoder, in 1024-byte chunks. Checks
+  that both produce the same frames, then prints the throughput of each.
+
+  Not part of the TouchKeys program (Benchmarks/ is excluded from every build
+  configuration). Build it on its own from the project directory:
+
+    g++ -std=c++11 -O2 -I. -o FrameDecoderBenchmark \
+        Benchmarks/FrameDecoderBenchmark.cpp TouchKeys/TouchkeyFrameDecoder.cpp
+
+  Usage: FrameDecoderBenchmark [frames] [frame-length]
+*/
+
+#include "../TouchKeys/TouchkeyFrameDecoder.h"
+#include "../Utility/Time.h"
+
+#include <boost/bind.hpp>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+const int kDefaultBenchmarkFrames = 200000;	// Frames in the stream
+const int kDefaultFrameLength = 77;			// Payload bytes per frame, as for a full octave
+const int kBenchmarkChunkLength = 1024;		// Bytes per read, as in the run loops
+const int kBenchmarkRepeats = 10;			// Passes over the stream for timing
+
+// The frame state machine formerly in TouchkeyDevice::runLoopFunction(), with the
+// same interface as TouchkeyFrameDecoder. Warnings are left out; the stream below
+// doesn't trigger them.
+class ReferenceFrameDecoder {
+public:
+	ReferenceFrameDecoder(TouchkeyFrameDecoder::FrameHandler handler)
+	: handler_(handler), frameLength_(0), inFrame_(false), controlSeq_(false) {}
+
+	void decode(const unsigned char * buffer, int count) {
+		for (int i = 0; i < count; i++) {
+			unsigned char ch = buffer[i];
+
+			if (inFrame_) {
+				// Receiving a frame
+				if (controlSeq_) {
+					controlSeq_ = false;
+					if (ch == kControlCharacterFrameEnd) {	// frame finished?
+						inFrame_ = false;
+						handler_(frame_, frameLength_);
+					} else if (ch == ESCAPE_CHARACTER) { // double-escape means a literal escape character
+						frame_[frameLength_++] = ch;
+						if (frameLength_ >= TOUCHKEY_MAX_FRAME_LENGTH)
+							inFrame_ = false;
+					}
+				} else {
+					if (ch == ESCAPE_CHARACTER)
+						controlSeq_ = true;
+					else {
+						frame_[frameLength_++] = ch;
+						if (frameLength_ >= TOUCHKEY_MAX_FRAME_LENGTH)
+							inFrame_ = false;
+					}
+				}
+			} else {
+				// Waiting for a frame beginning control sequence
+				if (controlSeq_) {
+					controlSeq_ = false;
+					if (ch == kControlCharacterFrameBegin) {
+						inFrame_ = true;
+						frameLength_ = 0;
+					}
+				} else {
+					if (ch == ESCAPE_CHARACTER)
+						controlSeq_ = true;
+				}
+			}
+		}
+	}
+
+private:
+	TouchkeyFrameDecoder::FrameHandler handler_;
+	unsigned char frame_[TOUCHKEY_MAX_FRAME_LENGTH];
+	int frameLength_;
+	bool inFrame_;
+	bool controlSeq_;
+};
+
+// Receives frames from either decoder. When recording, keeps a copy of every
+// frame; otherwise just folds them into a checksum.
+class FrameDecoderBenchmarkSink {
+public:
+	FrameDecoderBenchmarkSink(bool recording) : recording_(recording), frames_(0), checksum_(0) {}
+
+	void frameReceived(unsigned char * const frame, int length) {
+		frames_++;
+		if (recording_)
+			data_.push_back(std::vector<unsigned char>(frame, frame + length));
+		else
+			checksum_ = checksum_ * 31 + frame[0] + frame[length - 1] + length;
+	}
+
+	bool recording_;
+	unsigned long frames_;
+	unsigned long checksum_;
+	std::vector<std::vector<unsigned char> > data_;
+};
+
+// Build an escaped stream of frames with random payloads. Payload bytes are biased
+// so that escape characters turn up now and then, and some idle bytes sit between
+// frames as they would on the wire.
+static void buildStream(std::vector<unsigned char>& stream, int frames, int frameLength)
+{
+	srand(1);
+	for (int i = 0; i < frames; i++) {
+		if (rand() % 8 == 0)
+			stream.push_back((unsigned char) (rand() % ESCAPE_CHARACTER));
+		stream.push_back(ESCAPE_CHARACTER);
+		stream.push_back(kControlCharacterFrameBegin);
+		for (int j = 0; j < frameLength; j++) {
+			unsigned char ch = (rand() % 64 == 0) ? ESCAPE_CHARACTER : (unsigned char) rand();
+			stream.push_back(ch);
+			if (ch == ESCAPE_CHARACTER)
+				stream.push_back(ESCAPE_CHARACTER);
+		}
+		stream.push_back(ESCAPE_CHARACTER);
+		stream.push_back(kControlCharacterFrameEnd);
+	}
+}
+
+// Feed the stream to a decoder in fixed-size chunks
+template<class Decoder>
+static void decodeStream(Decoder& decoder, const std::vector<unsigned char>& stream)
+{
+	for (size_t i = 0; i < stream.size(); i += kBenchmarkChunkLength) {
+		size_t length = stream.size() - i;
+		if (length > kBenchmarkChunkLength)
+			length = kBenchmarkChunkLength;
+		decoder.decode(&stream[i], (int) length);
+	}
+}
+
+// Time repeated passes over the stream; returns megabytes per second
+template<class Decoder>
+static double timeDecoder(Decoder& decoder, const std::vector<unsigned char>& stream)
+{
+	long long start = Time::getMicrosecondCounter();
+	for (int i = 0; i < kBenchmarkRepeats; i++)
+		decodeStream(decoder, stream);
+	long long elapsed = Time::getMicrosecondCounter() - start;
+
+	if (elapsed <= 0)
+		elapsed = 1;
+	return (double) stream.size() * kBenchmarkRepeats / (double) elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+	int frames = kDefaultBenchmarkFrames, frameLength = kDefaultFrameLength;
+
+	if (argc > 1)
+		frames = atoi(argv[1]);
+	if (argc > 2)
+		frameLength = atoi(argv[2]);
+	if (frames <= 0 || frameLength <= 0 || frameLength >= TOUCHKEY_MAX_FRAME_LENGTH / 2) {
+		std::cerr << "Usage: " << argv[0] << " [frames] [frame-length]\n";
+		return 1;
+	}
+
+	std::vector<unsigned char> stream;
+	buildStream(stream, frames, frameLength);
+
+	// Check that both decoders produce the same frames
+	FrameDecoderBenchmarkSink referenceFrames(true), decoderFrames(true);
+	ReferenceFrameDecoder referenceCheck(boost::bind(&FrameDecoderBenchmarkSink::frameReceived, &referenceFrames, _1, _2));
+	TouchkeyFrameDecoder decoderCheck(boost::bind(&FrameDecoderBenchmarkSink::frameReceived, &decoderFrames, _1, _2), 0);
+
+	decodeStream(referenceCheck, stream);
+	decodeStream(decoderCheck, stream);
+
+	if (referenceFrames.frames_ != (unsigned long) frames || referenceFrames.data_ != decoderFrames.data_) {
+		std::cerr << "Decoders differ: " << referenceFrames.frames_ << " reference frames, "
+				<< decoderFrames.frames_ << " decoder frames (expected " << frames << ")\n";
+		return 1;
+	}
+
+	// Then time them
+	FrameDecoderBenchmarkSink referenceSink(false), decoderSink(false);
+	ReferenceFrameDecoder reference(boost::bind(&FrameDecoderBenchmarkSink::frameReceived, &referenceSink, _1, _2));
+	TouchkeyFrameDecoder decoder(boost::bind(&FrameDecoderBenchmarkSink::frameReceived, &decoderSink, _1, _2), 0);
+
+	double referenceRate = timeDecoder(reference, stream);
+	double decoderRate = timeDecoder(decoder, stream);
+
+	if (referenceSink.checksum_ != decoderSink.checksum_) {
+		std::cerr << "Checksums differ\n";
+		return 1;
+	}
+
+	std::cout << frames << " frames of " << frameLength << " bytes, " << stream.size()
+			<< " bytes in " << kBenchmarkChunkLength << "-byte chunks\n";
+	std::cout << "byte-at-a-time:       " << referenceRate << " MB/s\n";
+	std::cout << "TouchkeyFrameDecoder: " << decoderRate << " MB/s\n";
+	return 0;
+}
@@ -0,0 +1,142 @@
+/*
+  TouchKeys: multi-touch musical keyboard control software
+  Copyright (c) 2013 Andrew McPherson
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  =====================================================================
+
+  KeyPipelineBenchmark.cpp: runs synthetic key position data through the
+  idle detector and position tracker, once wired through triggers and once
+  through KeyPositionPipeline, and prints the number of samples per second
+  each manages on one core.
+
+  Not part of the TouchKeys program (Benchmarks/ is excluded from every build
+  configuration). Build it on its own from the project directory:
+
+    g++ -std=c++11 -O2 -pthread -I. -o KeyPipelineBenchmark \
+        Benchmarks/KeyPipelineBenchmark.cpp TouchKeys/KeyIdleDetector.cpp \
+        TouchKeys/KeyPositionTracker.cpp Utility/Trigger.cpp
+
+  Usage: KeyPipelineBenchmark [samples-per-configuration]
+*/
+
+#include "../TouchKeys/KeyPipeline.h"
+#include "../TouchKeys/PianoKeyboard.h"
+#include "../Utility/Time.h"
+
+#include <cstdlib>
+#include <iostream>
+
+const int kDefaultBenchmarkSamples = 10000000; // Samples per configuration
+
+// Stands in for PianoKey: engages the position tracker while the idle detector
+// reports activity, the same way PianoKey::triggerReceived() does
+class KeyPipelineBenchmarkListener : public TriggerDestination {
+public:
+	KeyPipelineBenchmarkListener(KeyIdleDetector& idleDetector, KeyPositionTracker& positionTracker)
+	: idleDetector_(idleDetector), positionTracker_(positionTracker), activations_(0) {
+		registerForTrigger(&idleDetector_);
+	}
+
+	void triggerReceived(TriggerSource* who, timestamp_type) {
+		if(who != &idleDetector_)
+			return;
+		if(idleDetector_.latest() == kIdleDetectorActive) {
+			positionTracker_.reset();
+			positionTracker_.engage();
+			activations_++;
+		}
+		else if(idleDetector_.latest() == kIdleDetectorIdle)
+			positionTracker_.disengage();
+	}
+
+	int activations() { return activations_; }
+
+private:
+	KeyIdleDetector& idleDetector_;
+	KeyPositionTracker& positionTracker_;
+	int activations_;
+};
+
+// Synthetic key position: long stretches at rest with a little noise, broken up by
+// a press (ramp down, hold, ramp back up) every few thousand samples
+static key_position benchmarkPosition(int sample)
+{
+	const int kCycleLength = 3000;
+	int phase = sample % kCycleLength;
+	float noise = (float)((sample * 7919) % 17 - 8) * 0.0005f;
+	float position;
+
+	if(phase < 2400)
+		position = 0;
+	else if(phase < 2500)
+		position = (float)(phase - 2400) / 100.0f;
+	else if(phase < 2800)
+		position = 1.0f;
+	else if(phase < 2900)
+		position = 1.0f - (float)(phase - 2800) / 100.0f;
+	else
+		position = 0;
+	return scale_key_position(position + noise);
+}
+
+// Run one configuration and return samples per second
+static double benchmarkKeyPipelineRun(int numSamples, bool useStaticPipeline, int& activations)
+{
+	SingleWriterNode<key_position> positionBuffer(kDefaultKeyHistoryLength);
+	KeyIdleDetector idleDetector(kPianoKeyIdleBufferLength, positionBuffer, kPianoKeyDefaultIdlePositionThreshold,
+								 kPianoKeyDefaultIdleActivityThreshold, kPianoKeyDefaultIdleCounter);
+	KeyPositionTracker positionTracker(kPianoKeyPositionTrackerBufferLength, positionBuffer);
+	KeyPipelineBenchmarkListener listener(idleDetector, positionTracker);
+	KeyPositionPipeline pipeline(idleDetector, positionTracker);
+
+	if(useStaticPipeline) {
+		idleDetector.setTriggeredByInput(false);
+		positionTracker.setTriggeredByInput(false);
+	}
+
+	long long start = Time::getMicrosecondCounter();
+	for(int i = 0; i < numSamples; i++) {
+		timestamp_type timestamp = milliseconds_to_timestamp(i);
+		positionBuffer.insert(benchmarkPosition(i), timestamp);
+		if(useStaticPipeline)
+			pipeline.process(timestamp);
+	}
+	long long elapsed = Time::getMicrosecondCounter() - start;
+
+	activations = listener.activations();
+	return elapsed > 0 ? (double)numSamples * 1000000.0 / (double)elapsed : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int numSamples = kDefaultBenchmarkSamples;
+	int dynamicActivations, staticActivations;
+
+	if(argc > 1)
+		numSamples = atoi(argv[1]);
+	if(numSamples <= 0) {
+		std::cerr << "Usage: " << argv[0] << " [samples-per-configuration]\n";
+		return 1;
+	}
+
+	double dynamicRate = benchmarkKeyPipelineRun(numSamples, false, dynamicActivations);
+	double staticRate = benchmarkKeyPipelineRun(numSamples, true, staticActivations);
+
+	std::cout << "Key pipeline benchmark, " << numSamples << " samples on one key:\n";
+	std::cout << "  trigger graph:   " << (long long)dynamicRate << " samples/sec (" << dynamicActivations << " presses)\n";
+	std::cout << "  static pipeline: " << (long long)staticRate << " samples/sec (" << staticActivations << " presses)\n";
+	return 0;
+}
@@ -0,0 +1,196 @@
+/*
+  TouchKeys: multi-touch musical keyboard control software
+  Copyright (c) 2013 Andrew McPherson
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  =====================================================================
+
+  NodeLookupBenchmark.cpp: times indexNearestBefore(), indexNearestAfter()
+  and indexNearestTo() on a Node filled to several levels, against the
+  linear search over a circular buffer of timestamps they used to do. The
+  results of every lookup are checked against the linear search first.
+
+  Not part of the TouchKeys program (Benchmarks/ is excluded from every build
+  configuration). Build it on its own from the project directory:
+
+    g++ -std=c++11 -O2 -pthread -I. -o NodeLookupBenchmark \
+        Benchmarks/NodeLookupBenchmark.cpp Utility/Trigger.cpp
+
+  Usage: NodeLookupBenchmark [lookups-per-measurement]
+*/
+
+#include "../Utility/Node.h"
+#include "../Utility/Time.h"
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+const int kBenchmarkCapacity = 8192;			// As for the key position history
+const int kDefaultBenchmarkLookups = 200000;	// Lookups per method and fill level
+
+// Buffer fills to measure; the last one has wrapped around the buffer
+const int kBenchmarkFillLevels[] = { 64, 512, 1024, 4096, 8192, 12288 };
+const int kBenchmarkFillLevelCount = sizeof(kBenchmarkFillLevels) / sizeof(int);
+
+typedef boost::circular_buffer<timestamp_type> TimestampBuffer;
+
+// The lookups as NodeNonInterpolating did them before timestampUpperBound(): a linear
+// search for the first timestamp later than t. Indices are offset by firstSampleIndex
+// to match the Node's.
+class LinearLookup {
+public:
+	LinearLookup(TimestampBuffer& timestamps, Node<float>::size_type firstSampleIndex)
+	: timestamps_(timestamps), firstSampleIndex_(firstSampleIndex) {}
+
+	Node<float>::size_type indexNearestBefore(timestamp_type t) {
+		TimestampBuffer::iterator it = upperBound(t);
+		if(it == timestamps_.end())
+			return timestamps_.size()-1+firstSampleIndex_;
+		if(it - timestamps_.begin() == 0)
+			return firstSampleIndex_;
+		return (Node<float>::size_type)((--it) - timestamps_.begin()) + firstSampleIndex_;
+	}
+	Node<float>::size_type indexNearestAfter(timestamp_type t) {
+		TimestampBuffer::iterator it = upperBound(t);
+		return std::min<Node<float>::size_type>((it - timestamps_.begin()), timestamps_.size()-1) + firstSampleIndex_;
+	}
+	Node<float>::size_type indexNearestTo(timestamp_type t) {
+		TimestampBuffer::iterator it = upperBound(t);
+		if(it == timestamps_.end())
+			return timestamps_.size()-1+firstSampleIndex_;
+		if(it - timestamps_.begin() == 0)
+			return firstSampleIndex_;
+		timestamp_diff_type after = *it - t;
+		timestamp_diff_type before = t - *(it-1);
+		if(after < before)
+			return (Node<float>::size_type)(it - timestamps_.begin()) + firstSampleIndex_;
+		return (Node<float>::size_type)((--it) - timestamps_.begin()) + firstSampleIndex_;
+	}
+
+private:
+	TimestampBuffer::iterator upperBound(timestamp_type t) {
+		TimestampBuffer::iterator it = timestamps_.begin();
+		while(it != timestamps_.end() && !(t < *it))
+			++it;
+		return it;
+	}
+
+	TimestampBuffer& timestamps_;
+	Node<float>::size_type firstSampleIndex_;
+};
+
+// Which lookup to run
+enum {
+	kLookupBefore = 0,
+	kLookupAfter,
+	kLookupTo,
+	kLookupCount
+};
+
+const char* kLookupNames[kLookupCount] = { "indexNearestBefore", "indexNearestAfter", "indexNearestTo" };
+
+template<class Lookup>
+static Node<float>::size_type lookup(Lookup& lookup, int which, timestamp_type t)
+{
+	if(which == kLookupBefore)
+		return lookup.indexNearestBefore(t);
+	if(which == kLookupAfter)
+		return lookup.indexNearestAfter(t);
+	return lookup.indexNearestTo(t);
+}
+
+// Time a method over the targets; returns nanoseconds per lookup
+template<class Lookup>
+static double timeLookups(Lookup& lookups, int which, const std::vector<timestamp_type>& targets,
+		unsigned long& checksum)
+{
+	long long start = Time::getMicrosecondCounter();
+	for(size_t i = 0; i < targets.size(); i++)
+		checksum += lookup(lookups, which, targets[i]);
+	long long elapsed = Time::getMicrosecondCounter() - start;
+
+	return (double)elapsed * 1000.0 / (double)targets.size();
+}
+
+int main(int argc, char *argv[])
+{
+	int lookups = kDefaultBenchmarkLookups;
+
+	if(argc > 1)
+		lookups = atoi(argv[1]);
+	if(lookups <= 0) {
+		std::cerr << "Usage: " << argv[0] << " [lookups-per-measurement]\n";
+		return 1;
+	}
+
+	srand(1);
+	std::cout << "ns per lookup, linear search -> binary search (capacity " << kBenchmarkCapacity << ")\n";
+	std::cout << "   fill";
+	for(int which = 0; which < kLookupCount; which++)
+		std::cout << std::setw(28) << kLookupNames[which];
+	std::cout << std::endl;
+
+	for(int level = 0; level < kBenchmarkFillLevelCount; level++) {
+		int fill = kBenchmarkFillLevels[level];
+		Node<float> node(kBenchmarkCapacity);
+		TimestampBuffer timestamps(kBenchmarkCapacity);
+		timestamp_type timestamp = 0;
+
+		// Samples about a millisecond apart, with some jitter, as from the sensors
+		for(int i = 0; i < fill; i++) {
+			timestamp += 0.0009 + 0.0002 * (double)rand() / (double)RAND_MAX;
+			node.insert((float)i, timestamp);
+			timestamps.push_back(timestamp);
+		}
+
+		LinearLookup linear(timestamps, node.beginIndex());
+
+		// Targets spread over the buffer and a little beyond each end
+		std::vector<timestamp_type> targets(lookups);
+		timestamp_type earliest = node.earliestTimestamp(), latest = node.latestTimestamp();
+		for(int i = 0; i < lookups; i++)
+			targets[i] = earliest - 0.01 + (latest - earliest + 0.02) * (double)rand() / (double)RAND_MAX;
+
+		// Check every lookup first
+		for(int which = 0; which < kLookupCount; which++) {
+			for(int i = 0; i < lookups; i++) {
+				if(lookup(linear, which, targets[i]) != lookup(node, which, targets[i])) {
+					std::cerr << kLookupNames[which] << " differs from the linear search at fill "
+							<< fill << ", target " << targets[i] << std::endl;
+					return 1;
+				}
+			}
+		}
+
+		std::cout << std::setw(7) << fill;
+		for(int which = 0; which < kLookupCount; which++) {
+			unsigned long linearChecksum = 0, nodeChecksum = 0;
+			double linearTime = timeLookups(linear, which, targets, linearChecksum);
+			double nodeTime = timeLookups(node, which, targets, nodeChecksum);
+
+			if(linearChecksum != nodeChecksum) {
+				std::cerr << "Checksums differ\n";
+				return 1;
+			}
+			std::cout << std::setw(16) << std::fixed << std::setprecision(1) << linearTime
+					<< " -> " << std::setw(6) << nodeTime;
+		}
+		std::cout << std::endl;
+	}
+
+	return 0;
+}
@@ -21,6 +21,7 @@
 */
 
 #include "MainApplicationController.h"
+#include "TouchKeys/CalibrationFile.h"
 
 #include <getopt.h>
 #include <libgen.h>
@@ -36,6 +37,8 @@ unsigned int gAuxiliaryTaskStackSize = 1 << 17; // required by libbelaextra
 const int kCalibrationTimeSeconds = 20;
 const int kVerboseLevel = 0;
 const bool kShouldCalibrate = true;
+const bool kShouldLoadLastCalibration = true; // Start from the last good calibration when there is one
+const string kLastCalibrationFile = "calibration_last.tkcal";
 const string kMidiOutputName = "hw:0:0:0"; // Legacy MIDI
 //const string kOscHost = "127.0.0.1"; // OSC to localhost
 const string kOscHost = "192.168.9.3"; // Bela over eth0
@@ -56,6 +59,11 @@ static struct option long_options[] = {
     {"midi-output", required_argument, NULL, 'o'},
     {"virtual-midi-output", no_argument, NULL, 'V'},
     {"osc-input-port", required_argument, NULL, 'P'},
+    {"convert-calibration", required_argument, NULL, 'c'},
+    {"calibrate", no_argument, NULL, 'C'},
+    {"history", required_argument, NULL, 'H'},
+    {"memory-report", no_argument, NULL, 'M'},
+    {"predict-onset", no_argument, NULL, 'p'},
 	{0,0,0,0}
 };
 
@@ -65,7 +73,8 @@ void sigint_handler(int s){
 
 void usage(const char * processName)	// Print usage information and exit
 {
-	cerr << "Usage: " << processName << " [-h] [-l] [-t touchkeys] [-i MIDI-in] [-o MIDI-out]\n";
+	cerr << "Usage: " << processName << " [-h] [-l] [-C] [-M] [-p] [-H position:touch:aftertouch] [-t touchkeys] [-i MIDI-in] [-o MIDI-out]\n";
+	cerr << "       " << processName << " -c calibration-in calibration-out\n";
 	cerr << "  -h:   Print this menu\n";
 	cerr << "  -l:   List available TouchKeys and MIDI devices\n";
 	cerr << "  -t:   Specify TouchKeys device path and autostart\n";
@@ -73,6 +82,12 @@ void usage(const char * processName)	// Print usage information and exit
     cerr << "  -o:   Specify MIDI output device\n";
     cerr << "  -V:   Open virtual MIDI output\n";
     cerr << "  -P:   Specify OSC input port (default: " << kDefaultOscReceivePort << ")\n";
+    cerr << "  -c:   Convert a calibration file between XML and binary, then exit\n";
+    cerr << "  -C:   Calibrate at startup even if a saved calibration exists\n";
+    cerr << "  -H:   Samples of position, touch and aftertouch history per key (default: "
+         << kDefaultKeyHistoryLength << ":" << kDefaultKeyTouchHistoryLength << ":" << kDefaultKeyAftertouchHistoryLength << ")\n";
+    cerr << "  -M:   Print the memory used by key history once started\n";
+    cerr << "  -p:   Predict key press onsets and send notes before the press completes; print how they went at exit\n";
 }
 
 void list_devices(MainApplicationController& controller)
@@ -123,6 +138,9 @@ int main (int argc, char* argv[])
     bool shouldStart = true;
     bool autostartTouchkeys = false;
     bool autoopenMidiOut = false, autoopenMidiIn = false;
+    bool forceCalibration = false;
+    bool printMemoryReport = false;
+    bool predictOnset = false;
     int oscInputPort = kDefaultOscReceivePort;
     string touchkeysDevicePath;
 
@@ -156,7 +174,7 @@ int main (int argc, char* argv[])
     controller.oscTransmitSetEnabled(true);
 
 
-	while((ch = getopt_long(argc, argv, "hli:o:t:VP:", long_options, &option_index)) != -1)
+	while((ch = getopt_long(argc, argv, "hli:o:t:VP:c:CH:Mp", long_options, &option_index)) != -1)
 	{
         if(ch == 'l') { // List devices
             list_devices(controller);
@@ -182,6 +200,38 @@ int main (int argc, char* argv[])
         else if(ch == 'P') { // OSC port
             oscInputPort = atoi(optarg);
         }
+        else if(ch == 'C') { // Calibrate even if a saved calibration exists
+            forceCalibration = true;
+        }
+        else if(ch == 'H') { // History lengths
+            int positionLength, touchLength, aftertouchLength;
+            if(sscanf(optarg, "%d:%d:%d", &positionLength, &touchLength, &aftertouchLength) != 3 ||
+               positionLength <= 0 || touchLength <= 0 || aftertouchLength <= 0) {
+                usage(basename(argv[0]));
+                shouldStart = false;
+                break;
+            }
+            controller.keyboardSetHistoryLengths(positionLength, touchLength, aftertouchLength);
+        }
+        else if(ch == 'M') { // Memory report
+            printMemoryReport = true;
+        }
+        else if(ch == 'p') { // Predictive note onsets
+            controller.keyboardSetPredictsOnset(true);
+            predictOnset = true;
+        }
+        else if(ch == 'c') { // Convert calibration file; output name follows the input
+            shouldStart = false;
+            if(optind >= argc) {
+                usage(basename(argv[0]));
+                break;
+            }
+            if(CalibrationFile::convert(optarg, argv[optind]))
+                cout << "Converted calibration " << optarg << " to " << argv[optind] << endl;
+            else
+                cerr << "Unable to convert calibration " << optarg << endl;
+            break;
+        }
         else {
             usage(basename(argv[0]));
             shouldStart = false;
@@ -239,7 +289,20 @@ int main (int argc, char* argv[])
             sigIntHandler.sa_flags = 0;
             sigaction(SIGINT, &sigIntHandler, NULL);
 
-            if (kShouldCalibrate) {
+            // Load the last good calibration if there is one, so scanning can start
+            // straight away; otherwise calibrate now
+            bool calibrationLoaded = false;
+            if (kShouldLoadLastCalibration && !forceCalibration) {
+				if (controller.loadCalibration(kLastCalibrationFile)) {
+					std::cout << "Loaded calibration from " << kLastCalibrationFile << std::endl;
+					calibrationLoaded = true;
+				}
+				else {
+					std::cout << "No saved calibration in " << kLastCalibrationFile << std::endl;
+				}
+            }
+
+            if (kShouldCalibrate && !calibrationLoaded) {
 				usleep(1e+6); // Wait for some status frames
 				printf("Calibrating for %d seconds\n", kCalibrationTimeSeconds);
 				controller.startCalibration(kCalibrationTimeSeconds);
@@ -248,9 +311,18 @@ int main (int argc, char* argv[])
 				if (controller.saveCalibration(filename)) {
 					std::cout << "Calibration saved successfully to: " + filename << std::endl;
 				}
+				// Binary copy of the same calibration, for fast loading at startup
+				if (controller.saveCalibrationBinary(kLastCalibrationFile)) {
+					std::cout << "Calibration saved successfully to: " + kLastCalibrationFile << std::endl;
+				}
             }
 
-//            controller.loadCalibration("calibration_1551996860873.000000.xml");
+            // Follow slow drift in the resting key positions from here on
+            if (controller.touchkeyDeviceIsCalibrated())
+            	controller.setCalibrationDriftCheckEnabled(true);
+
+            if (printMemoryReport)
+            	controller.keyboardPrintMemoryReport();
 
             // Wait until interrupt signal is received
             while(!programShouldStop_) {
@@ -261,9 +333,17 @@ int main (int argc, char* argv[])
 
         }
 
+        // Keep the drift-corrected calibration for next time
+        if(controller.touchkeyDeviceIsCalibrated())
+            controller.saveCalibrationBinary(kLastCalibrationFile);
+
         // Stop TouchKeys if still running
         if(controller.touchkeyDeviceIsRunning())
             controller.stopTouchkeyDevice();
+
+        // Summary of how the predicted onsets went
+        if(predictOnset)
+            controller.keyboardPrintPredictionReport();
     }
 
     return 0;
@@ -391,11 +391,26 @@ bool MainApplicationController::saveCalibration(std::string const& filename)
 	return touchkeyController_.calibrationSaveToFile(filename);
 }
 
+bool MainApplicationController::saveCalibrationBinary(std::string const& filename)
+{
+	return touchkeyController_.calibrationSaveToBinaryFile(filename);
+}
+
 bool MainApplicationController::loadCalibration(std::string const& filename)
 {
 	return touchkeyController_.calibrationLoadFromFile(filename);
 }
 
+bool MainApplicationController::touchkeyDeviceIsCalibrated()
+{
+	return touchkeyController_.isCalibrated();
+}
+
+void MainApplicationController::setCalibrationDriftCheckEnabled(bool enable)
+{
+	touchkeyController_.calibrationDriftCheckSetEnabled(enable);
+}
+
 // Start/stop the TouchKeys data collection
 bool MainApplicationController::startTouchkeyDevice() {
     return touchkeyController_.startAutoGathering();
@@ -109,7 +109,10 @@ public:
     void finishCalibration();
     void updateQuiescent();
     bool saveCalibration(std::string const& filename);
+    bool saveCalibrationBinary(std::string const& filename);
     bool loadCalibration(std::string const& filename);
+    bool touchkeyDeviceIsCalibrated();
+    void setCalibrationDriftCheckEnabled(bool enable);
 
     // Start/stop the TouchKeys data collection
     bool startTouchkeyDevice();
@@ -143,6 +146,20 @@ public:
     bool touchkeyDeviceIsAutodetecting();
     
     void touchkeyDeviceSetVerbosity(int verbose);
+    
+    // How many samples of history keys with sensors keep for position, touch and aftertouch
+    void keyboardSetHistoryLengths(int positionLength, int touchLength, int aftertouchLength) {
+        keyboardController_.setKeyHistoryLengths(positionLength, touchLength, aftertouchLength);
+    }
+    
+    // Print the memory taken by the keys' history buffers
+    void keyboardPrintMemoryReport() { keyboardController_.printMemoryReport(); }
+    
+    // Send provisional note onsets predicted from key position before the press completes
+    void keyboardSetPredictsOnset(bool predicts) { keyboardController_.setKeysPredictOnset(predicts); }
+    
+    // Print how the predicted onsets have turned out
+    void keyboardPrintPredictionReport() { keyboardController_.printPredictionReport(); }
 
     // *** MIDI device methods ***
     
@@ -25,6 +25,8 @@
 
 #include "../TouchKeys/MidiOutputController.h"
 
+#undef DEBUG_ONSET_PREDICTION
+
 // Class constants
 const int MIDIKeyPositionMapping::kDefaultMIDIChannel = 0;
 const float MIDIKeyPositionMapping::kDefaultAftertouchScaler = 127.0 / 0.03;   // Default aftertouch sensitivity: MIDI 127 = 0.03
@@ -42,14 +44,14 @@ const key_velocity MIDIKeyPositionMapping::kPianoKeyReleaseVelocityForMaxMIDI =
 MIDIKeyPositionMapping::MIDIKeyPositionMapping(PianoKeyboard &keyboard, MappingFactory *factory, int noteNumber, Node<KeyTouchFrame>* touchBuffer,
                        Node<key_position>* positionBuffer, KeyPositionTracker* positionTracker)
 : Mapping(keyboard, factory, noteNumber, touchBuffer, positionBuffer, positionTracker), noteIsOn_(false),
-  midiChannel_(kDefaultMIDIChannel), lastAftertouchValue_(0), midiPercussivenessChannel_(-1)
+  noteIsProvisional_(false), midiChannel_(kDefaultMIDIChannel), lastAftertouchValue_(0), midiPercussivenessChannel_(-1)
 {
     setAftertouchSensitivity(1.0);
 }
 
 // Copy constructor
 MIDIKeyPositionMapping::MIDIKeyPositionMapping(MIDIKeyPositionMapping const& obj)
-: Mapping(obj), noteIsOn_(obj.noteIsOn_), aftertouchScaler_(obj.aftertouchScaler_), 
+: Mapping(obj), noteIsOn_(obj.noteIsOn_), noteIsProvisional_(obj.noteIsProvisional_), aftertouchScaler_(obj.aftertouchScaler_), 
   midiChannel_(obj.midiChannel_), lastAftertouchValue_(obj.lastAftertouchValue_),
   midiPercussivenessChannel_(obj.midiPercussivenessChannel_)
 {
@@ -71,13 +73,13 @@ void MIDIKeyPositionMapping::disengage() {
     if(noteIsOn_) {
         generateMidiNoteOff();
     }
-    noteIsOn_ = false;
+    noteIsOn_ = noteIsProvisional_ = false;
 }
 
 // Reset state back to defaults
 void MIDIKeyPositionMapping::reset() {
     Mapping::reset();
-    noteIsOn_ = false;
+    noteIsOn_ = noteIsProvisional_ = false;
 }
 
 // Set the aftertouch sensitivity on continuous key position
@@ -104,9 +106,30 @@ void MIDIKeyPositionMapping::triggerReceived(TriggerSource* who, timestamp_type
             // New message from the key position tracker. Might be time to start or end MIDI note.
             if(notification.type == KeyPositionTrackerNotification::kNotificationTypeFeatureAvailableVelocity && !noteIsOn_) {
                 cout << "Key " << noteNumber_ << " velocity available\n";
-                generateMidiNoteOn();
+                generateMidiNoteOn(positionTracker_->pressVelocity().second);
                 noteIsOn_ = true;
             }
+            else if(notification.type == KeyPositionTrackerNotification::kNotificationTypeFeatureAvailableVelocity && noteIsProvisional_) {
+                // The predicted press went through. The note keeps the velocity it was sent with.
+#ifdef DEBUG_ONSET_PREDICTION
+                cout << "Key " << noteNumber_ << " velocity available, confirming predicted note\n";
+#endif
+                noteIsProvisional_ = false;
+            }
+            else if(notification.type == KeyPositionTrackerNotification::kNotificationTypeFeatureAvailablePredictedVelocity && !noteIsOn_) {
+#ifdef DEBUG_ONSET_PREDICTION
+                cout << "Key " << noteNumber_ << " predicted velocity available\n";
+#endif
+                generateMidiNoteOn(positionTracker_->predictedPressVelocity());
+                noteIsOn_ = noteIsProvisional_ = true;
+            }
+            else if(notification.type == KeyPositionTrackerNotification::kNotificationTypePredictionCancelled && noteIsProvisional_) {
+#ifdef DEBUG_ONSET_PREDICTION
+                cout << "Key " << noteNumber_ << " predicted press cancelled\n";
+#endif
+                generateMidiNoteOff();
+                noteIsOn_ = noteIsProvisional_ = false;
+            }
             else if(notification.type == KeyPositionTrackerNotification::kNotificationTypeFeatureAvailableReleaseVelocity && noteIsOn_) {
                 cout << "Key " << noteNumber_ << " release velocity available\n";
                 generateMidiNoteOff();
@@ -130,19 +153,20 @@ timestamp_type MIDIKeyPositionMapping::performMapping() {
         return 0;
     
     timestamp_type currentTimestamp = keyboard_.schedulerCurrentTimestamp();
+    key_position latestPosition;
+    timestamp_type latestPositionTimestamp;
 
     // Calculate the output features as a function of input sensor data
     if(positionBuffer_ == 0) {
         // No buffer -> all 0
     }
-    else if(positionBuffer_->empty()) {
+    else if(!positionBuffer_->latestSample(latestPosition, latestPositionTimestamp)) {
         // No samples -> all 0
     }
     else if(noteIsOn_) {
         // Generate aftertouch messages based on key position, if the note is on and
         // if the position exceeds the aftertouch threshold. Note on and note off are
         // handled directly by the trigger thread.
-        key_position latestPosition = positionBuffer_->latest();
         int aftertouchValue;
         
         if(latestPosition < kMinimumAftertouchPosition)
@@ -169,18 +193,16 @@ timestamp_type MIDIKeyPositionMapping::performMapping() {
     return nextScheduledTimestamp_;
 }
 
-// Generate a MIDI Note On from continuous key data
-void MIDIKeyPositionMapping::generateMidiNoteOn() {
+// Generate a MIDI Note On from continuous key data, given the press velocity (measured or predicted)
+void MIDIKeyPositionMapping::generateMidiNoteOn(key_velocity velocity) {
     if(positionTracker_ == 0)
         return;
     
-    std::pair<timestamp_type, key_velocity> velocityInfo = positionTracker_->pressVelocity();
-    
     // MIDI Velocity now available. Send a MIDI message if relevant.
     if(keyboard_.midiOutputController() != 0) {
         float midiVelocity = 0.5;
-        if(!missing_value<key_velocity>::isMissing(velocityInfo.second))
-            midiVelocity = (float)velocityInfo.second / (float)kPianoKeyVelocityForMaxMIDI;
+        if(!missing_value<key_velocity>::isMissing(velocity))
+            midiVelocity = (float)velocity / (float)kPianoKeyVelocityForMaxMIDI;
         if(midiVelocity < 0.0)
             midiVelocity = 0.0;
         if(midiVelocity > 1.0)
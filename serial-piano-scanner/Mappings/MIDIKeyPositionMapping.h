@@ -108,13 +108,14 @@ public:
 private:
     // ***** Private Methods *****
 
-    void generateMidiNoteOn();
+    void generateMidiNoteOn(key_velocity velocity);
     void generateMidiNoteOff();
     void generateMidiPercussivenessNoteOn();
     
 	// ***** Member Variables *****
     
     bool noteIsOn_;                             // Whether the MIDI note is active or not
+    bool noteIsProvisional_;                    // Whether it was sent on a predicted onset not yet confirmed
     float aftertouchScaler_;                    // Scaler which affects aftertouch sensitivity
     int midiChannel_;                           // Channel on which to transmit MIDI messages
     int lastAftertouchValue_;                   // Value of the last aftertouch message
@@ -161,17 +161,18 @@ timestamp_type MRPMapping::performMapping() {
     float brightness = 0;
     float pitch = 0;
     float harmonic = 0;
+    key_position latestPosition;
+    timestamp_type latestPositionTimestamp;
 
     // Calculate the output features as a function of input sensor data
     if(positionBuffer_ == 0) {
         // No buffer -> all 0
     }
-    else if(positionBuffer_->empty()) {
+    else if(!positionBuffer_->latestSample(latestPosition, latestPositionTimestamp)) {
         // No samples -> all 0
     }
     else {
         // TODO: IIR filter on the position data before mapping it
-        key_position latestPosition = positionBuffer_->latest();
         int trackerState = kPositionTrackerStateUnknown;
         if(positionTracker_ != 0)
             trackerState = positionTracker_->currentState();
@@ -191,7 +192,7 @@ timestamp_type MRPMapping::performMapping() {
                 // this one reached PartialPress state.
                 for(int neighborNote = noteNumber_ - 2; neighborNote < noteNumber_; neighborNote++) {
                     // If one of the lower keys is in the Down state, then this note should bend it up
-                    MRPMapping *neighborMapper = dynamic_cast<MRPMapping*>(keyboard_.mapping(neighborNote));
+                    MRPMapping *neighborMapper = keyboard_.mrpMapping(neighborNote);
                     if(neighborMapper == 0)
                         continue;
                     if(neighborMapper->positionTracker_ != 0) {
@@ -223,7 +224,7 @@ timestamp_type MRPMapping::performMapping() {
                 }
                 for(int neighborNote = noteNumber_ + 1; neighborNote < noteNumber_ + 3; neighborNote++) {
                     // If one of the upper keys is in the Down state, then this note should bend it down
-                    MRPMapping *neighborMapper = dynamic_cast<MRPMapping*>(keyboard_.mapping(neighborNote));
+                    MRPMapping *neighborMapper = keyboard_.mrpMapping(neighborNote);
                     if(neighborMapper == 0)
                         continue;
                     if(neighborMapper->positionTracker_ != 0) {
@@ -351,12 +352,13 @@ timestamp_type MRPMapping::performMapping() {
                         }
                         
                         // This is the case where the other note is controlling our pitch
-                        if(bend.positionBuffer->empty()) {
+                        key_position latestBenderPosition;
+                        timestamp_type latestBenderTimestamp;
+                        if(!bend.positionBuffer->latestSample(latestBenderPosition, latestBenderTimestamp)) {
                             continue;
                         }
                         
                         float noteDifference = (float)(bend.note - noteNumber_);
-                        key_position latestBenderPosition = bend.positionBuffer->latest();
                         
                         // Key position at 0 = 0 pitch bend; key position at max = most pitch bend
                         float bendAmount = key_position_to_float(latestBenderPosition - kPianoKeyDefaultIdlePositionThreshold*2) /
@@ -507,7 +509,10 @@ timestamp_type MRPMapping::performMapping() {
 // efficient to run that many triggers all the time. Instead, it's brought up to
 // date on an as-needed basis during performMapping().
 key_velocity MRPMapping::updateVelocityMeasurements() {
+    // The position buffer is written without the mutex (see SingleWriterNode), so
+    // samples may still arrive while this runs; only go as far as the end seen here.
     positionBuffer_->lock_mutex();
+    Node<key_position>::size_type endIndex = positionBuffer_->endIndex();
     
     // Need at least 2 samples to calculate velocity (first difference)
     if(positionBuffer_->size() < 2) {
@@ -522,8 +527,10 @@ key_velocity MRPMapping::updateVelocityMeasurements() {
         lastCalculatedVelocityIndex_ = positionBuffer_->beginIndex() + 1;
     }
     
-    while(lastCalculatedVelocityIndex_ < positionBuffer_->endIndex()) {
-        // Calculate the velocity and add to buffer
+    velocityBlock_.clear();
+    velocityTimestampBlock_.clear();
+    while(lastCalculatedVelocityIndex_ < endIndex) {
+        // Calculate the velocity and add to the block
         key_position diffPosition = (*positionBuffer_)[lastCalculatedVelocityIndex_] - (*positionBuffer_)[lastCalculatedVelocityIndex_ - 1];
         timestamp_diff_type diffTimestamp = positionBuffer_->timestampAt(lastCalculatedVelocityIndex_) - positionBuffer_->timestampAt(lastCalculatedVelocityIndex_ - 1);
         key_velocity vel;
@@ -533,13 +540,16 @@ key_velocity MRPMapping::updateVelocityMeasurements() {
         else
             vel = 0; // Bad measurement: replace with 0 so as not to mess up IIR calculations
         
-        // Add the raw velocity to the buffer
-        rawVelocity_.insert(vel, positionBuffer_->timestampAt(lastCalculatedVelocityIndex_));
+        velocityBlock_.push_back(vel);
+        velocityTimestampBlock_.push_back(positionBuffer_->timestampAt(lastCalculatedVelocityIndex_));
         lastCalculatedVelocityIndex_++;
     }
     
     positionBuffer_->unlock_mutex();
     
+    // Add the raw velocities to the buffer in one go
+    rawVelocity_.insertBlock(velocityBlock_.data(), velocityTimestampBlock_.data(), velocityBlock_.size());
+    
     // Bring the filtered velocity up to date
     key_velocity filteredVel = filteredVelocity_.calculate();
     //std::cout << "Key " << noteNumber_ << " velocity " << filteredVel << std::endl;
@@ -141,8 +141,10 @@ private:
     std::vector<PitchBend> activePitchBends_;   // Which keys are involved in a pitch bend
     
     Node<key_velocity> rawVelocity_;            // History of key velocity measurements
-    IIRFilterNode<key_velocity> filteredVelocity_;  // Filtered key velocity information
+    IIRFilterNode<key_velocity, 2> filteredVelocity_; // Filtered key velocity information
     Node<key_position>::size_type lastCalculatedVelocityIndex_; // Keep track of how many velocity samples we've calculated
+    std::vector<key_velocity> velocityBlock_;           // New velocity samples, before they go into rawVelocity_
+    std::vector<timestamp_type> velocityTimestampBlock_;
     
     bool vibratoActive_;                        // Whether a vibrato gesture is currently detected
     int vibratoVelocityPeakCount_;              // Counter for tracking velocity oscillations
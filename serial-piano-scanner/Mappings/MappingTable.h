@@ -0,0 +1,105 @@
+/*
+  TouchKeys: multi-touch musical keyboard control software
+  Copyright (c) 2013 Andrew McPherson
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  =====================================================================
+
+  MappingTable.h: fixed table of mappings indexed by MIDI note number.
+*/
+
+#ifndef __TouchKeys__MappingTable__
+#define __TouchKeys__MappingTable__
+
+#include <vector>
+
+/*
+ * MappingTable
+ *
+ * One slot per MIDI note, each holding at most one mapping, so looking up a note is a
+ * single array access and scanning neighbouring notes never allocates. Note numbers
+ * outside 0-127 simply have no mapping.
+ *
+ * The table does not own its mappings: release() hands the pointer back to the caller
+ * to disengage and delete as it sees fit.
+ */
+
+template <class MappingType>
+class MappingTable {
+public:
+    static const int kNumNotes = 128;
+
+    // ***** Constructor *****
+
+    MappingTable() : size_(0) {
+        for(int i = 0; i < kNumNotes; i++)
+            mappings_[i] = 0;
+    }
+
+    // ***** Accessors *****
+
+    // Mapping on the given note, or 0 if there is none
+    MappingType* get(int noteNumber) const {
+        if(noteNumber < 0 || noteNumber >= kNumNotes)
+            return 0;
+        return mappings_[noteNumber];
+    }
+    bool contains(int noteNumber) const { return get(noteNumber) != 0; }
+
+    // Number of notes with mappings, and the list of those notes in ascending order
+    int size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    std::vector<int> notes() const {
+        std::vector<int> notes;
+        notes.reserve(size_);
+        for(int i = 0; i < kNumNotes; i++) {
+            if(mappings_[i] != 0)
+                notes.push_back(i);
+        }
+        return notes;
+    }
+
+    // ***** Modifiers *****
+
+    // Store a mapping on an empty note; returns false if the note is outside the table
+    // or already has a mapping, which should be released first
+    bool insert(int noteNumber, MappingType* mapping) {
+        if(noteNumber < 0 || noteNumber >= kNumNotes || mapping == 0)
+            return false;
+        if(mappings_[noteNumber] != 0)
+            return false;
+        mappings_[noteNumber] = mapping;
+        size_++;
+        return true;
+    }
+
+    // Empty the slot for the given note, returning the mapping it held (or 0)
+    MappingType* release(int noteNumber) {
+        if(noteNumber < 0 || noteNumber >= kNumNotes)
+            return 0;
+        MappingType* mapping = mappings_[noteNumber];
+        if(mapping != 0) {
+            mappings_[noteNumber] = 0;
+            size_--;
+        }
+        return mapping;
+    }
+
+private:
+    MappingType* mappings_[kNumNotes];
+    int size_;
+};
+
+#endif /* defined(__TouchKeys__MappingTable__) */
@@ -120,11 +120,11 @@ void TouchkeyOnsetAngleMapping::processOnset(timestamp_type timestamp) {
         Node<KeyTouchFrame>::size_type mostRecentTouchPresentIndex = pastSamples_.endIndex() - 1;
         while(index >= pastSamples_.beginIndex()) {
 #ifdef DEBUG_NOTE_ONSET_MAPPING
-            std::cout << "examining sample " << index << " with " << pastSamples_[index].count << " touches and time diff " << timestamp - pastSamples_.timestampAt(index) << "\n";
+            std::cout << "examining sample " << index << " with " << pastSamples_.stored(index).count() << " touches and time diff " << timestamp - pastSamples_.timestampAt(index) << "\n";
 #endif
             if(timestamp - pastSamples_.timestampAt(index) >= maxLookbackTime_)
                 break;
-            if(pastSamples_[index].count == 0) {
+            if(pastSamples_.stored(index).count() == 0) {
                 if(touchWasOn) {
                     // We found a break in the touch; stop here. But don't stop
                     // if the first frames we consider have no touches.
@@ -154,8 +154,8 @@ void TouchkeyOnsetAngleMapping::processOnset(timestamp_type timestamp) {
         timestamp_type endingTimestamp = pastSamples_.timestampAt(mostRecentTouchPresentIndex);
         timestamp_type startingTimestamp = pastSamples_.timestampAt(index);
         if(endingTimestamp - startingTimestamp > 0) {
-            float endingPosition = pastSamples_[mostRecentTouchPresentIndex].locs[0];
-            float startingPosition = pastSamples_[index].locs[0];
+            float endingPosition = pastSamples_.stored(mostRecentTouchPresentIndex).loc(0);
+            float startingPosition = pastSamples_.stored(index).loc(0);
             calculatedVelocity = (endingPosition - startingPosition) / (endingTimestamp - startingTimestamp);
         }
         else { // DEBUG
@@ -71,7 +71,7 @@ void TouchkeyOnsetAngleMappingFactory::midiNoteOn(int noteNumber, bool touchIsOn
     // Call base class method
     TouchkeyBaseMappingFactory<TouchkeyOnsetAngleMapping>::midiNoteOn(noteNumber, touchIsOn, keyMotionActive, touchBuffer, positionBuffer, positionTracker);
 
-    if(mappings_.count(noteNumber) != 0) {
-        mappings_[noteNumber]->processOnset(keyboard_.schedulerCurrentTimestamp());
+    if(mappings_.contains(noteNumber)) {
+        mappings_.get(noteNumber)->processOnset(keyboard_.schedulerCurrentTimestamp());
     }
 }
@@ -265,8 +265,8 @@ bool TouchkeyReleaseAngleMappingFactory::loadPreset(XmlElement const* preset) {
                                                      Node<KeyTouchFrame>* touchBuffer,
                                                      Node<key_position>* positionBuffer,
                                                      KeyPositionTracker* positionTracker) {
-    if(mappings_.count(noteNumber) != 0) {
-        mappings_[noteNumber]->processRelease(keyboard_.schedulerCurrentTimestamp());
+    if(mappings_.contains(noteNumber)) {
+        mappings_.get(noteNumber)->processRelease(keyboard_.schedulerCurrentTimestamp());
     }
     
     // Call base class method
@@ -36,6 +36,7 @@
 #include "../TouchKeys/MidiKeyboardSegment.h"
 #include "../TouchKeys/OscMidiConverter.h"
 #include "MappingScheduler.h"
+#include "MappingTable.h"
 
 #undef DEBUG_TOUCHKEY_BASE_MAPPING_FACTORY
 
@@ -78,24 +79,15 @@ public:
     // Look up a mapping with the given note number
     virtual MappingType* mapping(int noteNumber) {
         pthread_mutex_lock(&mappingsMutex_);
-        if(mappings_.count(noteNumber) == 0) {
-        	pthread_mutex_unlock(&mappingsMutex_);
-        	return 0;
-        }
+        MappingType *mapping = mappings_.get(noteNumber);
         pthread_mutex_unlock(&mappingsMutex_);
-        return mappings_[noteNumber];
+        return mapping;
     }
     
     // Return a list of all active notes
     virtual std::vector<int> activeMappings()  {
         pthread_mutex_lock(&mappingsMutex_);
-        std::vector<int> keys;
-        typename std::map<int, MappingType*>::iterator it = mappings_.begin();
-        while(it != mappings_.end()) {
-            int nextKey = (it++)->first;
-            keys.push_back(nextKey);
-        }
-
+        std::vector<int> keys = mappings_.notes();
         pthread_mutex_unlock(&mappingsMutex_);
         return keys;
     }
@@ -103,23 +95,9 @@ public:
     // Remove all active mappings
     virtual void removeAllMappings() {
         pthread_mutex_lock(&mappingsMutex_);
-        typename std::map<int, MappingType*>::iterator it = mappings_.begin();
-        
-        while(it != mappings_.end()) {
-            // Delete everybody in the container
-            MappingType *mapping = it->second;
-#ifdef NEW_MAPPING_SCHEDULER
-            mapping->disengage(true);
-            //keyboard_.mappingScheduler().unscheduleAndDelete(mapping);
-#else
-            mapping->disengage();
-            delete mapping;
-#endif
-            it++;
-        }
-        
-        // Now clear the container
-        mappings_.clear();
+        // Delete everybody in the container
+        for(int note = 0; note < MappingTable<MappingType>::kNumNotes && !mappings_.empty(); note++)
+            removeMapping(note);
         pthread_mutex_unlock(&mappingsMutex_);
     }
     
@@ -133,21 +111,24 @@ public:
     // Suspend messages from a particular note
     virtual void suspendMapping(int noteNumber) {
         pthread_mutex_lock(&mappingsMutex_);
-        if(mappings_.count(noteNumber) == 0)
+        MappingType *mapping = mappings_.get(noteNumber);
+        if(mapping == 0) {
+        	pthread_mutex_unlock(&mappingsMutex_);
             return;
-        mappings_[noteNumber]->suspend();
+        }
+        mapping->suspend();
         pthread_mutex_unlock(&mappingsMutex_);
     }
     
     // Suspend messages from all notes
     virtual void suspendAllMappings() {
         pthread_mutex_lock(&mappingsMutex_);
-        typename std::map<int, MappingType*>::iterator it = mappings_.begin();
-        
-        while(it != mappings_.end()) {
-            //std::cout << "suspending mapping on note " << it->first << std::endl;
-            it->second->suspend();
-            it++;
+        for(int note = 0; note < MappingTable<MappingType>::kNumNotes; note++) {
+            MappingType *mapping = mappings_.get(note);
+            if(mapping != 0) {
+                //std::cout << "suspending mapping on note " << note << std::endl;
+                mapping->suspend();
+            }
         }
         pthread_mutex_unlock(&mappingsMutex_);
     }
@@ -155,23 +136,23 @@ public:
     // Resume messages from a particular note
     virtual void resumeMapping(int noteNumber, bool resend) {
         pthread_mutex_lock(&mappingsMutex_);
-        if(mappings_.count(noteNumber) == 0) {
+        MappingType *mapping = mappings_.get(noteNumber);
+        if(mapping == 0) {
         	pthread_mutex_unlock(&mappingsMutex_);
             return;
         }
         //std::cout << "resuming mapping on note " << noteNumber << std::endl;
-        mappings_[noteNumber]->resume(resend);
+        mapping->resume(resend);
         pthread_mutex_unlock(&mappingsMutex_);
     }
     
     // Resume messages on all notes
     virtual void resumeAllMappings(bool resend) {
         pthread_mutex_lock(&mappingsMutex_);
-        typename std::map<int, MappingType*>::iterator it = mappings_.begin();
-        
-        while(it != mappings_.end()) {
-            it->second->resume(resend);
-            it++;
+        for(int note = 0; note < MappingTable<MappingType>::kNumNotes; note++) {
+            MappingType *mapping = mappings_.get(note);
+            if(mapping != 0)
+                mapping->resume(resend);
         }
         pthread_mutex_unlock(&mappingsMutex_);
     }
@@ -284,7 +265,7 @@ public:
                     KeyPositionTracker* positionTracker)  {
         pthread_mutex_lock(&mappingsMutex_);
         // Add a new mapping if one doesn't exist already
-        if(mappings_.count(noteNumber) == 0) {
+        if(!mappings_.contains(noteNumber)) {
 #ifdef DEBUG_TOUCHKEY_BASE_MAPPING_FACTORY
             std::cout << "Note " << noteNumber << ": adding mapping (touch)\n";
 #endif
@@ -301,11 +282,12 @@ public:
                     KeyPositionTracker* positionTracker) {
         pthread_mutex_lock(&mappingsMutex_);
         // If a mapping exists but the MIDI note is off, remove the mapping
-        if(mappings_.count(noteNumber) != 0 && !midiNoteIsOn) {
+        MappingType *mapping = mappings_.get(noteNumber);
+        if(mapping != 0 && !midiNoteIsOn) {
 #ifdef DEBUG_TOUCHKEY_BASE_MAPPING_FACTORY
             std::cout << "Note " << noteNumber << ": removing mapping (touch)\n";
 #endif
-            if(mappings_[noteNumber]->requestFinish())
+            if(mapping->requestFinish())
                 removeMapping(noteNumber);
         }
         pthread_mutex_unlock(&mappingsMutex_);
@@ -318,7 +300,7 @@ public:
                     KeyPositionTracker* positionTracker)  {
         pthread_mutex_lock(&mappingsMutex_);
         // Add a new mapping if one doesn't exist already
-        if(mappings_.count(noteNumber) == 0) {
+        if(!mappings_.contains(noteNumber)) {
 #ifdef DEBUG_TOUCHKEY_BASE_MAPPING_FACTORY
             std::cout << "Note " << noteNumber << ": adding mapping (MIDI)\n";
 #endif
@@ -336,11 +318,12 @@ public:
                      KeyPositionTracker* positionTracker)  {
         pthread_mutex_lock(&mappingsMutex_);
         // If a mapping exists but the touch is off, remove the mapping
-        if(mappings_.count(noteNumber) != 0 && !touchIsOn) {
+        MappingType *mapping = mappings_.get(noteNumber);
+        if(mapping != 0 && !touchIsOn) {
 #ifdef DEBUG_TOUCHKEY_BASE_MAPPING_FACTORY
             std::cout << "Note " << noteNumber << ": removing mapping (MIDI)\n";
 #endif
-            if(mappings_[noteNumber]->requestFinish())
+            if(mapping->requestFinish())
                 removeMapping(noteNumber);
         }
 
@@ -470,7 +453,16 @@ private:
         initializeMappingParameters(noteNumber, mapping);
         
         // Save the mapping
-        mappings_[noteNumber] = mapping;
+        if(!mappings_.insert(noteNumber, mapping)) {
+            std::cerr << "TouchkeyBaseMappingFactory: can't add a mapping on note " << noteNumber << std::endl;
+#ifdef NEW_MAPPING_SCHEDULER
+            mapping->disengage(true);
+#else
+            mapping->disengage();
+            delete mapping;
+#endif
+            return;
+        }
 
         // Finally, engage the new mapping
         mapping->engage();
@@ -478,9 +470,9 @@ private:
     
     void removeMapping(int noteNumber)  {
         // TODO: mutex
-        if(mappings_.count(noteNumber) == 0)
+        MappingType* mapping = mappings_.release(noteNumber);
+        if(mapping == 0)
             return;
-        MappingType* mapping = mappings_[noteNumber];
 #ifdef NEW_MAPPING_SCHEDULER
         mapping->disengage(true);
         //keyboard_.mappingScheduler().unscheduleAndDelete(mapping);
@@ -488,14 +480,13 @@ private:
         mapping->disengage();
         delete mapping;
 #endif
-        mappings_.erase(noteNumber);
     }
 
 protected:
     // State variables
     MidiKeyboardSegment& keyboardSegment_;         // Segment of the keyboard that this mapping addresses
     OscMidiConverter *midiConverter_;              // Object to convert OSC messages to MIDI
-    std::map<int, MappingType*> mappings_;         // Collection of active mappings
+    MappingTable<MappingType> mappings_;           // Collection of active mappings, by note
     pthread_mutex_t mappingsMutex_ = PTHREAD_MUTEX_INITIALIZER;                // Mutex protecting mappings from changes
     
     std::string controlName_;                           // Name of the mapping in long..
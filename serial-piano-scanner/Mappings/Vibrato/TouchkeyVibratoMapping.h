@@ -177,7 +177,7 @@ private:
     float lastPitchBendSemitones_;              // The last pitch bend value we sent out
     
     Node<float> rawDistance_;                   // Distance from onset location
-    IIRFilterNode<float> filteredDistance_;     // Bandpass filtered finger motion
+    IIRFilterNode<float, 2> filteredDistance_;    // Bandpass filtered finger motion
     pthread_mutex_t distanceAccessMutex_ = PTHREAD_MUTEX_INITIALIZER;       // Mutex that protects the access buffer from changes
 };
 
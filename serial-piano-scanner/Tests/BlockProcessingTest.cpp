@@ -0,0 +1,208 @@
+/*
+  TouchKeys: multi-touch musical keyboard control software
+  Copyright (c) 2013 Andrew McPherson
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  =====================================================================
+
+  BlockProcessingTest.cpp: checks that Accumulator and IIRFilterNode give
+  the same output when fed blocks of samples (processBlock(), and calculate()
+  for the filter) as when fed one sample at a time through triggers. Blocks
+  are of random length and wrap around the end of the buffers. Exits non-zero
+  if any output differs.
+
+  Not part of the TouchKeys program (Tests/ is excluded from every build
+  configuration). Build and run it on its own from the project directory:
+
+    g++ -std=c++11 -O2 -pthread -I. -o BlockProcessingTest \
+        Tests/BlockProcessingTest.cpp Utility/IIRFilter.cpp Utility/Trigger.cpp \
+        && ./BlockProcessingTest
+
+  Usage: BlockProcessingTest [samples]
+*/
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "../Utility/Accumulator.h"
+#include "../Utility/IIRFilter.h"
+
+const int kDefaultTestSamples = 50000;
+const int kTestCapacity = 1000;				// Small enough that blocks wrap around the buffers
+const int kTestMaximumBlockLength = 40;
+const int kTestAccumulatorLength = 16;
+const float kTestTolerance = 1.0e-5f;		// Relative, allowing for fused multiply-adds
+
+// A step, a slow sine and some noise
+static float testInput(int sample)
+{
+	float step = ((sample / 700) % 2 == 0) ? 1.0f : 0.0f;
+	float sine = 0.5f * sinf(0.013f * (float)sample);
+	float noise = 0.1f * ((float)rand() / (float)RAND_MAX - 0.5f);
+
+	return step + sine + noise;
+}
+
+static bool closeEnough(float value, float expected)
+{
+	return fabsf(value - expected) <= kTestTolerance * std::max(1.0f, fabsf(expected));
+}
+
+// Fill blocks of input with samples about a millisecond apart
+static int nextBlock(std::vector<float>& values, std::vector<timestamp_type>& timestamps,
+					 int& sample, int samples)
+{
+	int count = 1 + rand() % kTestMaximumBlockLength;
+
+	if(count > samples - sample)
+		count = samples - sample;
+	for(int i = 0; i < count; i++, sample++) {
+		values[i] = testInput(sample);
+		timestamps[i] = 0.001 * (timestamp_type)sample;
+	}
+	return count;
+}
+
+// Compare the last count samples of two nodes, adding the number that differ to mismatches
+static void compareLatest(const char *name, Node<float>& node, Node<float>& expected, int count,
+						  int& mismatches)
+{
+	if(node.endIndex() != expected.endIndex()) {
+		std::cout << name << ": " << node.endIndex() << " samples, expected " << expected.endIndex() << std::endl;
+		mismatches++;
+		return;
+	}
+	for(Node<float>::size_type index = node.endIndex() - count; index < node.endIndex(); index++) {
+		float value = node[index], expectedValue = expected[index];
+
+		if(!closeEnough(value, expectedValue) || node.timestampAt(index) != expected.timestampAt(index)) {
+			if(mismatches == 0)
+				std::cout << name << ": sample " << index << " gave " << value << ", expected "
+						  << expectedValue << std::endl;
+			mismatches++;
+		}
+	}
+}
+
+static int testAccumulator(int samples)
+{
+	typedef Accumulator<float, kTestAccumulatorLength> TestAccumulator;
+	Node<float> sampleInput(kTestCapacity), blockInput(kTestCapacity);
+	TestAccumulator sampleAccumulator(kTestCapacity, sampleInput);
+	TestAccumulator blockAccumulator(kTestCapacity, blockInput);
+	std::vector<float> values(kTestMaximumBlockLength);
+	std::vector<timestamp_type> timestamps(kTestMaximumBlockLength);
+	int mismatches = 0;
+
+	blockAccumulator.setTriggeredByInput(false);
+
+	for(int sample = 0; sample < samples;) {
+		int count = nextBlock(values, timestamps, sample, samples);
+
+		for(int i = 0; i < count; i++)
+			sampleInput.insert(values[i], timestamps[i]);
+		blockInput.insertBlock(values.data(), timestamps.data(), count);
+		blockAccumulator.processBlock(values.data(), timestamps.data(), count);
+
+		if(blockAccumulator.endIndex() != sampleAccumulator.endIndex()) {
+			std::cout << "accumulator: " << blockAccumulator.endIndex() << " samples, expected "
+					  << sampleAccumulator.endIndex() << std::endl;
+			return mismatches + 1;
+		}
+		for(TestAccumulator::size_type index = blockAccumulator.endIndex() - count;
+			index < blockAccumulator.endIndex(); index++) {
+			TestAccumulator::return_type value = blockAccumulator[index], expected = sampleAccumulator[index];
+
+			if(value.first != expected.first || !closeEnough(value.second, expected.second) ||
+			   blockAccumulator.timestampAt(index) != sampleAccumulator.timestampAt(index)) {
+				if(mismatches == 0)
+					std::cout << "accumulator: sample " << index << " gave (" << value.first << ", "
+							  << value.second << "), expected (" << expected.first << ", "
+							  << expected.second << ")\n";
+				mismatches++;
+			}
+		}
+	}
+
+	std::cout << "accumulator: " << samples << " samples, " << mismatches << " differ\n";
+	return mismatches;
+}
+
+// Run the filter sample by sample, with processBlock() and with calculate(). Empty
+// coefficients leave the filter passing its input through.
+template<int Order>
+static int testFilter(const char *name, std::vector<double> const& bDesign,
+					  std::vector<double> const& aDesign, int samples)
+{
+	std::vector<float> bCoeffs(bDesign.begin(), bDesign.end());
+	std::vector<float> aCoeffs(aDesign.begin(), aDesign.end());
+	Node<float> sampleInput(kTestCapacity), blockInput(kTestCapacity);
+	IIRFilterNode<float, Order> sampleFilter(kTestCapacity, sampleInput);
+	IIRFilterNode<float, Order> blockFilter(kTestCapacity, blockInput);
+	IIRFilterNode<float, Order> calculatedFilter(kTestCapacity, blockInput);
+	std::vector<float> values(kTestMaximumBlockLength);
+	std::vector<timestamp_type> timestamps(kTestMaximumBlockLength);
+	int blockMismatches = 0, calculatedMismatches = 0;
+
+	if(!bCoeffs.empty()) {
+		sampleFilter.setCoefficients(bCoeffs, aCoeffs);
+		blockFilter.setCoefficients(bCoeffs, aCoeffs);
+		calculatedFilter.setCoefficients(bCoeffs, aCoeffs);
+	}
+	sampleFilter.setAutoCalculate(true);
+
+	for(int sample = 0; sample < samples;) {
+		int count = nextBlock(values, timestamps, sample, samples);
+
+		for(int i = 0; i < count; i++)
+			sampleInput.insert(values[i], timestamps[i]);
+		blockInput.insertBlock(values.data(), timestamps.data(), count);
+		blockFilter.processBlock(values.data(), timestamps.data(), count);
+		calculatedFilter.calculate();
+
+		compareLatest(name, blockFilter, sampleFilter, count, blockMismatches);
+		compareLatest(name, calculatedFilter, sampleFilter, count, calculatedMismatches);
+	}
+
+	std::cout << name << ": " << samples << " samples, " << blockMismatches << " differ with processBlock(), "
+			  << calculatedMismatches << " with calculate()\n";
+	return blockMismatches + calculatedMismatches;
+}
+
+int main(int argc, char *argv[])
+{
+	int samples = kDefaultTestSamples;
+	std::vector<double> bCoeffs, aCoeffs;
+	int failures = 0;
+
+	if(argc > 1)
+		samples = atoi(argv[1]);
+	if(samples <= 0) {
+		std::cerr << "Usage: " << argv[0] << " [samples]\n";
+		return 1;
+	}
+	srand(1);
+
+	failures += testAccumulator(samples);
+	failures += testFilter<0>("no coefficients", bCoeffs, aCoeffs, samples);
+	designFirstOrderLowpass(bCoeffs, aCoeffs, 20.0, 1000.0);
+	failures += testFilter<1>("first order lowpass", bCoeffs, aCoeffs, samples);
+	designSecondOrderLowpass(bCoeffs, aCoeffs, 50.0, 0.707, 1000.0);
+	failures += testFilter<2>("second order lowpass", bCoeffs, aCoeffs, samples);
+	failures += testFilter<0>("second order lowpass, any order", bCoeffs, aCoeffs, samples);
+
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+/*
+  TouchKeys: multi-touch musical keyboard control software
+  Copyright (c) 2013 Andrew McPherson
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  =====================================================================
+
+  IIRFilterTest.cpp: checks MultiChannelIIRFilter against an IIRFilterKernel
+  of the same order run separately on each channel, for first and second
+  order designs, including resetting single channels part way through.
+  Exits non-zero if any output differs.
+
+  Not part of the TouchKeys program (Tests/ is excluded from every build
+  configuration). Build and run it on its own from the project directory:
+
+    g++ -std=c++11 -O2 -pthread -I. -o IIRFilterTest Tests/IIRFilterTest.cpp \
+        Utility/IIRFilter.cpp Utility/Trigger.cpp && ./IIRFilterTest
+
+  Usage: IIRFilterTest [frames]
+*/
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "../Utility/IIRFilter.h"
+
+const int kDefaultTestFrames = 20000;
+const int kTestChannels = 25;				// As in an analog frame
+const float kTestTolerance = 1.0e-5f;		// Relative, allowing for fused multiply-adds
+
+// Input for one channel: a step, a slow sine and some noise, different on every channel
+static float testInput(int frame, int channel)
+{
+	float step = ((frame / 500 + channel) % 3 == 0) ? 1.0f : 0.0f;
+	float sine = 0.5f * sinf(0.01f * (float)frame * (float)(channel + 1));
+	float noise = 0.1f * ((float)rand() / (float)RAND_MAX - 0.5f);
+
+	return step + sine + noise;
+}
+
+// Run both filters over the same frames; returns the number of samples that differ
+template<int Order>
+static int compareFilters(const char *name, std::vector<double> const& bDesign,
+						  std::vector<double> const& aDesign, int frames)
+{
+	std::vector<float> bCoeffs(bDesign.begin(), bDesign.end());
+	std::vector<float> aCoeffs(aDesign.begin(), aDesign.end());
+	MultiChannelIIRFilter<float, Order> multiChannel(kTestChannels);
+	std::vector<IIRFilterKernel<float, Order> > kernels(kTestChannels);
+	float input[kTestChannels], output[kTestChannels];
+	int mismatches = 0;
+
+	if(!multiChannel.setCoefficients(bCoeffs, aCoeffs)) {
+		std::cout << name << ": coefficients rejected\n";
+		return 1;
+	}
+	for(int ch = 0; ch < kTestChannels; ch++)
+		kernels[ch].setCoefficients(bCoeffs, aCoeffs, true);
+
+	for(int frame = 0; frame < frames; frame++) {
+		// Now and then, start one channel afresh
+		if(frame % 1000 == 999) {
+			int channel = (frame / 1000) % kTestChannels;
+			multiChannel.reset(channel);
+			kernels[channel].reset();
+		}
+
+		for(int ch = 0; ch < kTestChannels; ch++)
+			input[ch] = testInput(frame, ch);
+		multiChannel.process(input, output);
+
+		for(int ch = 0; ch < kTestChannels; ch++) {
+			float expected = kernels[ch].filter(input[ch]);
+
+			if(fabsf(output[ch] - expected) > kTestTolerance * std::max(1.0f, fabsf(expected))) {
+				if(mismatches == 0)
+					std::cout << name << ": frame " << frame << " channel " << ch << " gave "
+							  << output[ch] << ", expected " << expected << std::endl;
+				mismatches++;
+			}
+		}
+	}
+
+	std::cout << name << ": " << frames * kTestChannels << " samples, " << mismatches << " differ\n";
+	return mismatches;
+}
+
+int main(int argc, char *argv[])
+{
+	int frames = kDefaultTestFrames;
+	std::vector<double> bCoeffs, aCoeffs;
+	int failures = 0;
+
+	if(argc > 1)
+		frames = atoi(argv[1]);
+	if(frames <= 0) {
+		std::cerr << "Usage: " << argv[0] << " [frames]\n";
+		return 1;
+	}
+	srand(1);
+
+	designFirstOrderLowpass(bCoeffs, aCoeffs, 20.0, 1000.0);
+	failures += compareFilters<1>("first order lowpass", bCoeffs, aCoeffs, frames);
+	designFirstOrderHighpass(bCoeffs, aCoeffs, 5.0, 1000.0);
+	failures += compareFilters<1>("first order highpass", bCoeffs, aCoeffs, frames);
+	designSecondOrderLowpass(bCoeffs, aCoeffs, 50.0, 0.707, 1000.0);
+	failures += compareFilters<2>("second order lowpass", bCoeffs, aCoeffs, frames);
+	designSecondOrderBandpass(bCoeffs, aCoeffs, 10.0, 2.0, 1000.0);
+	failures += compareFilters<2>("second order bandpass", bCoeffs, aCoeffs, frames);
+
+	// Coefficients of the wrong order must be refused
+	MultiChannelIIRFilter<float, 1> firstOrder(kTestChannels);
+	std::vector<float> bSecond(3, 0.5f), aSecond(2, 0.1f);
+	if(firstOrder.setCoefficients(bSecond, aSecond)) {
+		std::cout << "first order filter accepted second order coefficients\n";
+		failures++;
+	}
+
+	return failures == 0 ? 0 : 1;
+}
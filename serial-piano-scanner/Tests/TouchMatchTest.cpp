@@ -0,0 +1,187 @@
+/*
+  TouchKeys: multi-touch musical keyboard control software
+  Copyright (c) 2013 Andrew McPherson
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  =====================================================================
+
+  TouchMatchTest.cpp: checks touchMatchClosestPoints() against the recursive
+  search it replaced, on random pairs of touch frames, and exits non-zero if
+  any ordering differs. Then times both over the same frames and prints the
+  cost of each in ns per match.
+
+  Not part of the TouchKeys program (Tests/ is excluded from every build
+  configuration). Build and run it on its own from the project directory:
+
+    g++ -std=c++11 -O2 -o TouchMatchTest Tests/TouchMatchTest.cpp \
+        TouchKeys/KeyTouchMatching.cpp && ./TouchMatchTest
+
+  Usage: TouchMatchTest [frames]
+*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <list>
+#include <set>
+#include <utility>
+#include <vector>
+#include "../TouchKeys/KeyTouchMatching.h"
+#include "../Utility/Time.h"
+
+const int kDefaultTestFrames = 1000000;
+
+// The recursive search touchMatchClosestPoints() used to do, with old points from oldIndex
+// on matched to the new points in availableNewPoints. Allocates at every level.
+
+static std::pair<float, std::list<int> > touchMatchClosestPointsReference(const float* oldPoints, const float *newPoints,
+																	   int oldIndex, std::set<int>& availableNewPoints, float currentTotalDistance) {
+	if(availableNewPoints.size() == 0)
+		return std::pair<float, std::list<int> >(std::numeric_limits<float>::infinity(), std::list<int>());
+	
+	// End case: only one possible point available
+	if(availableNewPoints.size() == 1) {
+		int newIndex = *(availableNewPoints.begin());
+		
+		std::list<int> singleOrder;
+		singleOrder.push_front(newIndex);
+		
+		if(oldPoints[oldIndex] < 0.0 || newPoints[newIndex] < 0.0)
+			return std::pair<float, std::list<int> > (currentTotalDistance + 100.0, singleOrder);
+		else
+			return std::pair<float, std::list<int> > (currentTotalDistance + (oldPoints[oldIndex] - newPoints[newIndex])*(oldPoints[oldIndex] - newPoints[newIndex]), singleOrder);
+	}
+	
+	float minVal = std::numeric_limits<float>::infinity();
+	std::set<int> newPointsCopy(availableNewPoints);
+	std::set<int>::iterator it;
+	std::list<int> order;
+	
+	// Go through all available new points
+	for(it = availableNewPoints.begin(); it != availableNewPoints.end(); ++it) {
+		// Temporarily remove (and test) one point and recursively call ourselves
+		newPointsCopy.erase(*it);
+		
+		float dist;
+		if(newPoints[*it] >= 0.0 && oldPoints[oldIndex] >= 0.0)
+			dist = (oldPoints[oldIndex] - newPoints[*it])*(oldPoints[oldIndex] - newPoints[*it]);
+		else
+			dist = 100.0;
+		
+		std::pair<float, std::list<int> > rval = touchMatchClosestPointsReference(oldPoints, newPoints, oldIndex + 1, newPointsCopy,
+																			   currentTotalDistance + dist);
+		if(rval.first < minVal) {
+			minVal = rval.first;
+			order = rval.second;
+			order.push_front(*it);
+		}
+		
+		newPointsCopy.insert(*it);
+	}
+	
+	return std::pair<float, std::list<int> >(minVal, order);
+}
+
+// Random frame of up to three touches in ascending order, missing ones at the end as -1.
+// Positions are on a coarse grid some of the time so that ties between matchings happen.
+static int randomTouchFrame(unsigned int& seed, float* locs)
+{
+	seed = seed * 1664525 + 1013904223;
+	int count = (seed >> 8) % 4;
+	bool coarse = ((seed >> 16) & 3) == 0;
+	
+	for(int i = 0; i < 3; i++) {
+		seed = seed * 1664525 + 1013904223;
+		locs[i] = coarse ? (float)((seed >> 8) % 8) / 8.0f : (float)((seed >> 8) & 0xFFFF) / 65536.0f;
+	}
+	std::sort(locs, locs + count);
+	for(int i = count; i < 3; i++)
+		locs[i] = -1.0;
+	return count;
+}
+
+int main(int argc, char *argv[])
+{
+	int numFrames = kDefaultTestFrames;
+	
+	if(argc > 1)
+		numFrames = atoi(argv[1]);
+	if(numFrames <= 0) {
+		std::cerr << "Usage: " << argv[0] << " [frames]\n";
+		return 1;
+	}
+	
+	std::vector<float> locs(numFrames * 3);
+	std::vector<int> matchCounts(numFrames);	// How many points to match going from frame i-1 to i
+	unsigned int seed = 1;
+	int lastCount = 0, numMatches = 0, mismatches = 0;
+	
+	for(int i = 0; i < numFrames; i++) {
+		int count = randomTouchFrame(seed, &locs[i * 3]);
+		matchCounts[i] = 0;
+		if(i > 0 && count != lastCount) {
+			// Same as touchInsertFrame(): the new points when a touch is added, all three when one is removed
+			matchCounts[i] = (count > lastCount) ? count : 3;
+			numMatches++;
+		}
+		lastCount = count;
+	}
+	
+	// Check the two give the same ordering for every change in the number of touches
+	for(int i = 1; i < numFrames; i++) {
+		if(matchCounts[i] == 0)
+			continue;
+		std::set<int> availableNewPoints;
+		for(int j = 0; j < matchCounts[i]; j++)
+			availableNewPoints.insert(j);
+		std::list<int> expected(touchMatchClosestPointsReference(&locs[(i - 1) * 3], &locs[i * 3], 0, availableNewPoints, 0.0).second);
+		int ordering[3];
+		touchMatchClosestPoints(&locs[(i - 1) * 3], &locs[i * 3], matchCounts[i], ordering);
+		if(!std::equal(expected.begin(), expected.end(), ordering))
+			mismatches++;
+	}
+	
+	// Then time each of them over the same matches. The checksum keeps the results live.
+	int checksum = 0;
+	long long start = Time::getMicrosecondCounter();
+	for(int i = 1; i < numFrames; i++) {
+		if(matchCounts[i] == 0)
+			continue;
+		std::set<int> availableNewPoints;
+		for(int j = 0; j < matchCounts[i]; j++)
+			availableNewPoints.insert(j);
+		checksum += touchMatchClosestPointsReference(&locs[(i - 1) * 3], &locs[i * 3], 0, availableNewPoints, 0.0).second.front();
+	}
+	long long referenceElapsed = Time::getMicrosecondCounter() - start;
+	
+	start = Time::getMicrosecondCounter();
+	for(int i = 1; i < numFrames; i++) {
+		if(matchCounts[i] == 0)
+			continue;
+		int ordering[3];
+		touchMatchClosestPoints(&locs[(i - 1) * 3], &locs[i * 3], matchCounts[i], ordering);
+		checksum -= ordering[0];
+	}
+	long long elapsed = Time::getMicrosecondCounter() - start;
+	
+	std::cout << "Touch matching: " << numMatches << " changes in touch count, "
+			  << mismatches << " orderings differ from the recursive search\n";
+	std::cout << "  recursive search: " << (numMatches > 0 ? (double)referenceElapsed * 1000.0 / numMatches : 0) << " ns/match\n";
+	std::cout << "  ordering table:   " << (numMatches > 0 ? (double)elapsed * 1000.0 / numMatches : 0) << " ns/match\n";
+	if(checksum != 0)
+		std::cout << "  checksum mismatch\n";
+	return (mismatches == 0 && checksum == 0) ? 0 : 1;
+}
@@ -0,0 +1,331 @@
+/*
+  TouchKeys: multi-touch musical keyboard control software
+  Copyright (c) 2013 Andrew McPherson
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  =====================================================================
+
+  CalibrationFile.cpp: reading and writing key calibration files, in either
+  XML or compact binary form.
+*/
+
+#include "CalibrationFile.h"
+#include <iostream>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Whether the file starts with a binary calibration header
+bool CalibrationFile::isBinary(std::string const& filename)
+{
+	char magic[4];
+	FILE *file = fopen(filename.c_str(), "rb");
+
+	if(file == NULL)
+		return false;
+	bool binary = (fread(magic, 1, 4, file) == 4 && memcmp(magic, kCalibrationFileMagic, 4) == 0);
+	fclose(file);
+	return binary;
+}
+
+// Load from either format, detected from the file contents
+bool CalibrationFile::load(std::string const& filename, PianoKeyCalibrator** calibrators, int count)
+{
+	if(isBinary(filename))
+		return loadBinary(filename, calibrators, count);
+	return loadXml(filename, calibrators, count);
+}
+
+// ***** XML *****
+
+// Save to XML. Only keys with valid calibrations are written.
+bool CalibrationFile::saveXml(std::string const& filename, PianoKeyCalibrator** calibrators, int count)
+{
+	tinyxml2::XMLDocument doc;
+	tinyxml2::XMLElement* baseElement = doc.NewElement("TouchkeyDeviceCalibration");
+	bool savedValidData = false;
+
+	for(int i = 0; i < count; i++) {
+		tinyxml2::XMLElement* calibratorElement = doc.NewElement("Key");
+		calibratorElement->SetAttribute("id", i);
+
+		// Tell each individual calibrator to add its data to the XML tree
+		if(calibrators[i]->saveToXml(calibratorElement)) {
+			baseElement->InsertEndChild(calibratorElement);
+			savedValidData = true;
+		}
+	}
+
+	if(!savedValidData) {
+		std::cerr << "CalibrationFile: unable to find valid calibration data to save.\n";
+		return false;
+	}
+
+	// Now save the generated tree to a file
+	doc.InsertEndChild(baseElement);
+	if(doc.SaveFile(filename.c_str()) != tinyxml2::XML_SUCCESS) {
+		std::cerr << "CalibrationFile: could not write calibration file " << filename << "\n";
+		return false;
+	}
+
+	return true;
+}
+
+// Load from XML. Keys missing from the file are left uncalibrated.
+bool CalibrationFile::loadXml(std::string const& filename, PianoKeyCalibrator** calibrators, int count)
+{
+	tinyxml2::XMLDocument doc;
+	tinyxml2::XMLElement *baseElement, *calibratorElement;
+
+	tinyxml2::XMLError ret = doc.LoadFile(filename.c_str());
+	if(ret != tinyxml2::XML_SUCCESS) {
+		std::cerr << "CalibrationFile: unable to load calibration file: \"" << filename << "\". Error was:\n";
+		std::cerr << doc.ErrorStr() << " (Line " << doc.ErrorLineNum() << ")\n";
+		return false;
+	}
+
+	// All calibration data is encapsulated within the root element <TouchkeyDeviceCalibration>
+	baseElement = doc.FirstChildElement("TouchkeyDeviceCalibration");
+	if(baseElement == NULL) {
+		std::cerr << "CalibrationFile: malformed calibration file, aborting.\n";
+		return false;
+	}
+
+	// Go through and find each key's calibration information
+	calibratorElement = baseElement->FirstChildElement("Key");
+	if(calibratorElement == NULL) {
+		std::cerr << "CalibrationFile: warning: no keys found\n";
+	}
+	while(calibratorElement != NULL) {
+		int keyId;
+
+		if(calibratorElement->QueryIntAttribute("id", &keyId) == tinyxml2::XML_SUCCESS) {
+			if(keyId >= 0 && keyId < count)
+				calibrators[keyId]->loadFromXml(calibratorElement);
+		}
+		calibratorElement = calibratorElement->NextSiblingElement("Key");
+	}
+
+	return true;
+}
+
+// ***** Binary *****
+
+// Save to a binary file. Every key gets a record, valid or not. The file is
+// written under a temporary name and then renamed, so an existing file is never
+// left half-written.
+bool CalibrationFile::saveBinary(std::string const& filename, PianoKeyCalibrator** calibrators, int count)
+{
+	std::vector<PianoKeyCalibrationRecord> records(count);
+	CalibrationFileHeader header;
+	bool savedValidData = false;
+
+	for(int i = 0; i < count; i++) {
+		if(calibrators[i]->saveToRecord(records[i]))
+			savedValidData = true;
+	}
+
+	if(!savedValidData) {
+		std::cerr << "CalibrationFile: unable to find valid calibration data to save.\n";
+		return false;
+	}
+
+	memcpy(header.magic, kCalibrationFileMagic, 4);
+	header.version = kCalibrationFileVersion;
+	header.recordSize = sizeof(PianoKeyCalibrationRecord);
+	header.keyCount = count;
+	header.checksum = crc32((const unsigned char *)records.data(), count * sizeof(PianoKeyCalibrationRecord));
+
+	std::string temporaryFilename = filename + ".tmp";
+	FILE *file = fopen(temporaryFilename.c_str(), "wb");
+
+	if(file == NULL) {
+		std::cerr << "CalibrationFile: could not write calibration file " << filename << "\n";
+		return false;
+	}
+
+	bool written = (fwrite(&header, sizeof(header), 1, file) == 1);
+	if(written && count > 0)
+		written = (fwrite(records.data(), sizeof(PianoKeyCalibrationRecord), count, file) == (size_t)count);
+	if(fflush(file) != 0 || fsync(fileno(file)) != 0)
+		written = false;
+	fclose(file);
+
+	if(!written || rename(temporaryFilename.c_str(), filename.c_str()) != 0) {
+		std::cerr << "CalibrationFile: could not write calibration file " << filename << "\n";
+		unlink(temporaryFilename.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+// Load from a binary file. The file is mapped into memory, checked, and each record
+// applied to its calibrator directly from the mapping.
+bool CalibrationFile::loadBinary(std::string const& filename, PianoKeyCalibrator** calibrators, int count)
+{
+	size_t length;
+	const CalibrationFileHeader *header = mapBinary(filename, length);
+
+	if(header == 0)
+		return false;
+
+	const PianoKeyCalibrationRecord *records = (const PianoKeyCalibrationRecord *)(header + 1);
+
+	for(int i = 0; i < count && i < (int)header->keyCount; i++)
+		calibrators[i]->loadFromRecord(records[i]);
+	if((int)header->keyCount != count)
+		std::cerr << "CalibrationFile: warning: file has " << header->keyCount << " keys, expected " << count << "\n";
+
+	munmap((void *)header, length);
+	return true;
+}
+
+// Map a binary file and check it. The key count is checked against the maximum before
+// it is used to work out the expected length, so that the length can't overflow.
+const CalibrationFileHeader* CalibrationFile::mapBinary(std::string const& filename, size_t& length)
+{
+	struct stat fileInfo;
+	int fd = open(filename.c_str(), O_RDONLY);
+
+	if(fd < 0) {
+		std::cerr << "CalibrationFile: unable to open calibration file: \"" << filename << "\"\n";
+		return 0;
+	}
+	if(fstat(fd, &fileInfo) != 0 || (size_t)fileInfo.st_size < sizeof(CalibrationFileHeader)) {
+		std::cerr << "CalibrationFile: calibration file \"" << filename << "\" is too short\n";
+		close(fd);
+		return 0;
+	}
+
+	length = fileInfo.st_size;
+	void *mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(mapping == MAP_FAILED) {
+		std::cerr << "CalibrationFile: unable to map calibration file: \"" << filename << "\"\n";
+		return 0;
+	}
+
+	const CalibrationFileHeader *header = (const CalibrationFileHeader *)mapping;
+	const PianoKeyCalibrationRecord *records = (const PianoKeyCalibrationRecord *)(header + 1);
+	bool valid = false;
+
+	if(memcmp(header->magic, kCalibrationFileMagic, 4) != 0)
+		std::cerr << "CalibrationFile: \"" << filename << "\" is not a binary calibration file\n";
+	else if(header->version != kCalibrationFileVersion || header->recordSize != sizeof(PianoKeyCalibrationRecord))
+		std::cerr << "CalibrationFile: unsupported calibration file version " << header->version << "\n";
+	else if(header->keyCount > (uint32_t)kCalibrationFileMaximumKeys)
+		std::cerr << "CalibrationFile: calibration file \"" << filename << "\" claims " << header->keyCount << " keys, more than " << kCalibrationFileMaximumKeys << "\n";
+	else if(length != sizeof(CalibrationFileHeader) + (size_t)header->keyCount * sizeof(PianoKeyCalibrationRecord))
+		std::cerr << "CalibrationFile: calibration file \"" << filename << "\" has the wrong length\n";
+	else if(crc32((const unsigned char *)records, header->keyCount * sizeof(PianoKeyCalibrationRecord)) != header->checksum)
+		std::cerr << "CalibrationFile: checksum mismatch in calibration file \"" << filename << "\"\n";
+	else
+		valid = true;
+
+	if(!valid) {
+		munmap(mapping, length);
+		return 0;
+	}
+	return header;
+}
+
+// ***** Conversion *****
+
+// Convert a calibration file to the other format
+bool CalibrationFile::convert(std::string const& inputFilename, std::string const& outputFilename)
+{
+	int count = keyCount(inputFilename);
+
+	if(count <= 0) {
+		std::cerr << "CalibrationFile: no calibration data in \"" << inputFilename << "\"\n";
+		return false;
+	}
+
+	std::vector<PianoKeyCalibrator*> calibrators(count);
+	bool inputIsBinary = isBinary(inputFilename);
+	bool success;
+
+	for(int i = 0; i < count; i++)
+		calibrators[i] = new PianoKeyCalibrator(true, 0);
+
+	if(inputIsBinary)
+		success = loadBinary(inputFilename, calibrators.data(), count)
+				&& saveXml(outputFilename, calibrators.data(), count);
+	else
+		success = loadXml(inputFilename, calibrators.data(), count)
+				&& saveBinary(outputFilename, calibrators.data(), count);
+
+	for(int i = 0; i < count; i++)
+		delete calibrators[i];
+
+	return success;
+}
+
+// Number of keys described by a file: the record count for binary files, or one
+// more than the highest key id for XML files. Binary files are checked in full first,
+// and XML keys with ids beyond kCalibrationFileMaximumKeys are ignored, as loadXml()
+// ignores ids beyond the count it is given. Returns -1 if the file can't be read.
+int CalibrationFile::keyCount(std::string const& filename)
+{
+	if(isBinary(filename)) {
+		size_t length;
+		const CalibrationFileHeader *header = mapBinary(filename, length);
+
+		if(header == 0)
+			return -1;
+		int count = (int)header->keyCount;
+		munmap((void *)header, length);
+		return count;
+	}
+
+	tinyxml2::XMLDocument doc;
+	if(doc.LoadFile(filename.c_str()) != tinyxml2::XML_SUCCESS)
+		return -1;
+	tinyxml2::XMLElement *baseElement = doc.FirstChildElement("TouchkeyDeviceCalibration");
+	if(baseElement == NULL)
+		return -1;
+
+	int count = 0;
+	for(tinyxml2::XMLElement *element = baseElement->FirstChildElement("Key"); element != NULL;
+		element = element->NextSiblingElement("Key")) {
+		int keyId;
+
+		if(element->QueryIntAttribute("id", &keyId) != tinyxml2::XML_SUCCESS)
+			continue;
+		if(keyId >= kCalibrationFileMaximumKeys)
+			std::cerr << "CalibrationFile: warning: ignoring key " << keyId << ", more than " << kCalibrationFileMaximumKeys << " keys\n";
+		else if(keyId >= count)
+			count = keyId + 1;
+	}
+	return count;
+}
+
+// Standard CRC-32 (as used by zip and PNG)
+uint32_t CalibrationFile::crc32(const unsigned char *data, size_t length)
+{
+	uint32_t crc = 0xFFFFFFFF;
+
+	for(size_t i = 0; i < length; i++) {
+		crc ^= data[i];
+		for(int bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+	}
+	return ~crc;
+}
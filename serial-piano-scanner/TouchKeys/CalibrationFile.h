@@ -0,0 +1,89 @@
+/*
+  TouchKeys: multi-touch musical keyboard control software
+  Copyright (c) 2013 Andrew McPherson
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  =====================================================================
+
+  CalibrationFile.h: reading and writing key calibration files, in either
+  XML or compact binary form.
+*/
+
+#ifndef TOUCHKEY_CALIBRATION_FILE_H
+#define TOUCHKEY_CALIBRATION_FILE_H
+
+#include <string>
+#include <stdint.h>
+#include "PianoKeyCalibrator.h"
+
+// Binary calibration files hold a header followed by one PianoKeyCalibrationRecord
+// per key, in key order. Values are stored in host (little-endian) byte order so the
+// file can be mapped and applied directly. The checksum is a CRC-32 of the records.
+
+const char kCalibrationFileMagic[4] = { 'T', 'K', 'C', 'B' };
+const uint16_t kCalibrationFileVersion = 1;
+
+// Most keys a calibration file may describe (one per MIDI note). Files claiming
+// more are rejected before anything is allocated for them.
+const int kCalibrationFileMaximumKeys = 128;
+
+struct CalibrationFileHeader {
+	char magic[4];			// kCalibrationFileMagic
+	uint16_t version;		// kCalibrationFileVersion
+	uint16_t recordSize;	// sizeof(PianoKeyCalibrationRecord)
+	uint32_t keyCount;		// Number of records following the header
+	uint32_t checksum;		// CRC-32 of all records
+};
+
+/*
+ * CalibrationFile
+ *
+ * Saves and loads the calibration of an array of PianoKeyCalibrators. Key i in
+ * the file corresponds to calibrators[i].
+ */
+
+class CalibrationFile {
+public:
+	// Whether the file starts with a binary calibration header
+	static bool isBinary(std::string const& filename);
+
+	// Load from either format, detected from the file contents
+	static bool load(std::string const& filename, PianoKeyCalibrator** calibrators, int count);
+
+	// ***** XML *****
+	static bool saveXml(std::string const& filename, PianoKeyCalibrator** calibrators, int count);
+	static bool loadXml(std::string const& filename, PianoKeyCalibrator** calibrators, int count);
+
+	// ***** Binary *****
+	static bool saveBinary(std::string const& filename, PianoKeyCalibrator** calibrators, int count);
+	static bool loadBinary(std::string const& filename, PianoKeyCalibrator** calibrators, int count);
+
+	// ***** Conversion *****
+	// Convert a calibration file to the other format. The input format is detected
+	// from its contents; the output is binary if the input is XML and vice versa.
+	static bool convert(std::string const& inputFilename, std::string const& outputFilename);
+
+private:
+	// Number of keys described by a file, or -1 if it can't be read
+	static int keyCount(std::string const& filename);
+
+	// Map a binary file and check its header, length and checksum. Returns the
+	// mapping, to be released with munmap(), or 0 if the file is not valid.
+	static const CalibrationFileHeader* mapBinary(std::string const& filename, size_t& length);
+
+	static uint32_t crc32(const unsigned char *data, size_t length);
+};
+
+#endif /* TOUCHKEY_CALIBRATION_FILE_H */
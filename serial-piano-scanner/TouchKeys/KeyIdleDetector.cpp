@@ -27,26 +27,24 @@
 // Default constructor
 KeyIdleDetector::KeyIdleDetector(capacity_type capacity, Node<key_position>& keyBuffer, key_position positionThreshold, 
 								 key_position activityThreshold, int counterThreshold)
-: Node<int>(capacity), keyBuffer_(keyBuffer), accumulator_(kKeyIdleNumSamples+1, keyBuffer),
+: Node<int>(capacity), keyBuffer_(keyBuffer), triggeredByInput_(true),
   keyIdleThreshold_(kDefaultKeyIdleThreshold), activityThreshold_(activityThreshold), positionThreshold_(positionThreshold),
   numberOfFramesWithoutActivity_(0), noActivityCounterThreshold_(counterThreshold),
   idleState_(kIdleDetectorUnknown)
 {
-	// Register to receive messages from the accumulator each time it gets a new sample
+	// Register to receive messages from the key buffer each time it gets a new sample
 	  //std::cout << "Registering IdleDetector\n";
 	  
-	  registerForTrigger(&accumulator_);
-	  
-	//  std::cout << "IdleDetector: this_source = " << (TriggerSource*)this << " this_dest = " << (TriggerDestination*)this << " accumulator = " << &accumulator_ << std::endl;
+	  registerForTrigger(&keyBuffer_);
 }
 
 // Copy constructor
 /*KeyIdleDetector::KeyIdleDetector(KeyIdleDetector const& obj)
-  : Node<int>(obj), keyBuffer_(obj.keyBuffer_), accumulator_(obj.accumulator_), idleState_(obj.idleState_), 
+  : Node<int>(obj), keyBuffer_(obj.keyBuffer_), statistics_(obj.statistics_), idleState_(obj.idleState_), 
     activityThreshold_(obj.activityThreshold_), positionThreshold_(obj.positionThreshold_),
     numberOfFramesWithoutActivity_(obj.numberOfFramesWithoutActivity_),
     keyIdleThreshold_(obj.keyIdleThreshold_), noActivityCounterThreshold_(obj.noActivityCounterThreshold_) {
-	registerForTrigger(&accumulator_);
+	registerForTrigger(&keyBuffer_);
 }*/
 
 // Clear current state and reset to unknown idle state.
@@ -56,19 +54,34 @@ void KeyIdleDetector::clear() {
 	numberOfFramesWithoutActivity_ = 0;
 }
 
+// Switch between following the key buffer through triggers and being driven by process()
+void KeyIdleDetector::setTriggeredByInput(bool triggered) {
+	if(triggered == triggeredByInput_)
+		return;
+	if(triggered)
+		registerForTrigger(&keyBuffer_);
+	else
+		unregisterForTrigger(&keyBuffer_);
+	triggeredByInput_ = triggered;
+}
+
 // Evaluator function.  Find the maximum deviation from average of the key motion.
 
 void KeyIdleDetector::triggerReceived(TriggerSource* who, timestamp_type timestamp) {
 //	std::cout << "KeyIdleDetector::triggerReceived\n";
 
-	if(who != &accumulator_)
+	if(who != &keyBuffer_)
 		return;
 
-    key_position currentKeyPosition = keyBuffer_.latest();
-    std::pair<int, key_position> currentAccumulator = accumulator_.latest();
+    update(keyBuffer_.latest(), timestamp);
+}
+
+// Update the idle state from a new key position, sending a trigger when it changes
+void KeyIdleDetector::update(key_position currentKeyPosition, timestamp_type timestamp) {
+    statistics_.insert(currentKeyPosition);
     
     // Check that we have enough samples
-    if(currentAccumulator.first < kKeyIdleNumSamples)
+    if(statistics_.count() < kKeyIdleNumSamples)
         return;
     
     // Behavior depends on whether we were idle or not before (or in unknown state)
@@ -78,7 +91,7 @@ void KeyIdleDetector::triggerReceived(TriggerSource* who, timestamp_type timesta
             return;
 
         // If average is below a second, slightly higher threshold, stay idle
-        key_position averageValue = currentAccumulator.second / (key_position)currentAccumulator.first;
+        key_position averageValue = statistics_.average();
         if(averageValue < keyIdleThreshold_ * 2)
             return;
         
@@ -88,7 +101,7 @@ void KeyIdleDetector::triggerReceived(TriggerSource* who, timestamp_type timesta
     }
     else { // Active or unknown
         // Rule out any cases that would immediately take the key active
-        key_position averageValue = currentAccumulator.second / (key_position)currentAccumulator.first;
+        key_position averageValue = statistics_.average();
         if(averageValue >= keyIdleThreshold_ * 2) {
             numberOfFramesWithoutActivity_ = 0;
             return;
@@ -104,13 +117,8 @@ void KeyIdleDetector::triggerReceived(TriggerSource* who, timestamp_type timesta
                 maxDeviation = diff;
         }
 #endif
-        key_position averageDeviation = 0;
-        size_type endIndex = keyBuffer_.endIndex();
-        // Find and return the average deviation from mean
-        for(int i = endIndex - kKeyIdleNumSamples; i < endIndex; i++) {
-            averageDeviation += key_abs(keyBuffer_[i] - averageValue);
-        }
-        averageDeviation /= kKeyIdleNumSamples;
+        // Find the average deviation from mean
+        key_position averageDeviation = statistics_.averageDeviation(averageValue);
         
 //        std::cout << "averageDeviation = " << averageDeviation << " counter = " << numberOfFramesWithoutActivity_ << std::endl;
         
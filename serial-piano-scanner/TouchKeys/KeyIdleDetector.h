@@ -27,7 +27,6 @@
 #define KEYCONTROL_KEYIDLEDETECTOR_H
 
 #include "PianoTypes.h"
-#include "../Utility/Accumulator.h"
 #include "../Utility/Node.h"
 
 #define kKeyIdleNumSamples 10
@@ -40,15 +39,69 @@ enum {
 	kIdleDetectorUnknown = 2
 };
 
+/*
+ * KeyIdleStatistics
+ *
+ * The last kKeyIdleNumSamples key positions in a small ring, with their running sum, so the
+ * average is available in constant time. The average deviation from that average still
+ * has to look at every sample, since the average moves, but the samples are all in one
+ * short array here rather than spread through the key buffer.
+ */
+
+class KeyIdleStatistics {
+public:
+	KeyIdleStatistics() { clear(); }
+	
+	void clear() {
+		count_ = next_ = 0;
+		sum_ = 0;
+	}
+	
+	// Add a sample, replacing the oldest once the ring is full
+	void insert(key_position sample) {
+		if(count_ == kKeyIdleNumSamples)
+			sum_ -= samples_[next_];
+		else
+			count_++;
+		samples_[next_] = sample;
+		sum_ += sample;
+		if(++next_ == kKeyIdleNumSamples) {
+			next_ = 0;
+			// Recompute the sum from scratch once per lap so rounding errors can't build up
+			if(count_ == kKeyIdleNumSamples) {
+				sum_ = 0;
+				for(int i = 0; i < kKeyIdleNumSamples; i++)
+					sum_ += samples_[i];
+			}
+		}
+	}
+	
+	int count() const { return count_; }
+	key_position average() const { return sum_ / (key_position)count_; }
+	
+	// Average absolute deviation of the samples from the given value; the ring must be full
+	key_position averageDeviation(key_position from) const {
+		key_position deviation = 0;
+		for(int i = 0; i < kKeyIdleNumSamples; i++)
+			deviation += key_abs(samples_[i] - from);
+		return deviation / kKeyIdleNumSamples;
+	}
+	
+private:
+	key_position samples_[kKeyIdleNumSamples];
+	key_position sum_;			// Sum of the samples in the ring
+	int count_;					// How many of samples_ are in use
+	int next_;					// Where the next sample goes
+};
+
 /*
  * KeyIdleDetector
  *
  * A Filter that looks for whether the key position has been flat over time, or is changing.
  * Uses this information to detect when a key has begun to move.
  *
- * This class contains a second Filter object, operating on the same data source, which is used
- * to maintain a running sum of the last N values.  The running sum is converted to an average
- * value, and the maximum deviation from the average is calculated.
+ * The last N key positions are kept in a KeyIdleStatistics, which gives their average, and
+ * the average deviation from the average is calculated.
  *
  */
 
@@ -74,10 +127,17 @@ public:
 	void setActivityThreshold(key_position thresh) { activityThreshold_ = thresh; }
 	void setPositionThreshold(key_position thresh) { positionThreshold_ = thresh; }
 	
+	// While idle, samples below this position leave the idle state as it is
+	key_position idleThreshold() { return keyIdleThreshold_; }
+	
 	// ***** Modifiers *****
 	
 	void clear();
 	
+	// By default the detector follows keyBuffer through triggers. Turn this off to drive it
+	// from process() instead, e.g. as part of a StaticPipeline (see KeyPipeline.h).
+	void setTriggeredByInput(bool triggered);
+	
 	// ***** Evaluator *****
 	
 	// This method actually handles the quantification of key activity.  When it
@@ -85,10 +145,22 @@ public:
 	
 	void triggerReceived(TriggerSource* who, timestamp_type timestamp);
 	
+	// Handle the latest sample in keyBuffer without going through triggers.
+	// Only use this when not triggered by input.
+	void process(timestamp_type timestamp) {
+		update(keyBuffer_.latest(), timestamp);
+	}
+	
+private:
+	// Add a new key position to the statistics and update the idle state
+	void update(key_position currentKeyPosition, timestamp_type timestamp);
+	
+public:	
 	// ***** Member Variables *****
 	
 	Node<key_position>& keyBuffer_;								// Raw key position data	
-	Accumulator<key_position, kKeyIdleNumSamples> accumulator_;	// This class accumulates the last N key samples (to find an average)
+	KeyIdleStatistics statistics_;								// The last N key samples (to find an average)
+	bool triggeredByInput_;										// Whether we're registered for triggers from keyBuffer_
 	
     key_position keyIdleThreshold_;                             // Position below which we assume key is staying idle
     
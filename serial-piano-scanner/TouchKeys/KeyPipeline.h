@@ -0,0 +1,75 @@
+/*
+  TouchKeys: multi-touch musical keyboard control software
+  Copyright (c) 2013 Andrew McPherson
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  =====================================================================
+
+  KeyPipeline.h: fixed chain of processing stages run on each new key
+  position sample, composed at compile time.
+*/
+
+#ifndef KEYCONTROL_KEY_PIPELINE_H
+#define KEYCONTROL_KEY_PIPELINE_H
+
+#include "KeyIdleDetector.h"
+#include "KeyPositionTracker.h"
+
+/*
+ * StaticPipeline
+ *
+ * Calls process(timestamp) on each of its stages in order. Each stage is any object
+ * with such a method; the pipeline only holds references to them. Since the chain is
+ * fixed by the template arguments, the calls are direct and can be inlined, where the
+ * trigger graph would need a virtual triggerReceived() and a check of who sent it for
+ * every link.
+ *
+ * Stages driven this way should not also be registered for triggers from the same
+ * input, or they will see every sample twice.
+ */
+
+template<typename... Stages> class StaticPipeline;
+
+template<>
+class StaticPipeline<> {
+public:
+	StaticPipeline() {}
+	void process(timestamp_type) {}
+};
+
+template<typename Stage, typename... Rest>
+class StaticPipeline<Stage, Rest...> {
+public:
+	// ***** Constructor *****
+
+	StaticPipeline(Stage& stage, Rest&... rest) : stage_(stage), rest_(rest...) {}
+
+	// ***** Evaluator *****
+
+	void process(timestamp_type timestamp) {
+		stage_.process(timestamp);
+		rest_.process(timestamp);
+	}
+
+private:
+	Stage& stage_;
+	StaticPipeline<Rest...> rest_;
+};
+
+// Per-sample chain for key position: accumulate and check for idle, then update
+// the state of the press (the tracker does nothing unless it is engaged)
+typedef StaticPipeline<KeyIdleDetector, KeyPositionTracker> KeyPositionPipeline;
+
+#endif /* KEYCONTROL_KEY_PIPELINE_H */
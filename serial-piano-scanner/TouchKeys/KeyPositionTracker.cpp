@@ -23,9 +23,16 @@
 
 #include "KeyPositionTracker.h"
 
+#undef DEBUG_ONSET_PREDICTION
+
 // Default constructor
 KeyPositionTracker::KeyPositionTracker(capacity_type capacity, Node<key_position>& keyBuffer)
-: Node<KeyPositionTrackerNotification>(capacity), keyBuffer_(keyBuffer), engaged_(false) {
+: Node<KeyPositionTrackerNotification>(capacity), keyBuffer_(keyBuffer), engaged_(false), triggeredByInput_(true),
+  predictsOnset_(false), predictionPending_(false) {
+    predictionStatistics_.predictions = predictionStatistics_.confirmed = 0;
+    predictionStatistics_.cancelled = predictionStatistics_.measured = 0;
+    predictionStatistics_.sumVelocityError = predictionStatistics_.sumSquaredVelocityError = 0;
+    predictionStatistics_.sumLeadTime = predictionStatistics_.sumSquaredTimingError = 0;
     reset();
 }
 
@@ -48,34 +55,10 @@ std::pair<timestamp_type, key_velocity> KeyPositionTracker::pressVelocity(key_po
                                                        missing_value<key_velocity>::missing());
     }
     
-    // Find where the key position crosses the indicated level
-    key_buffer_index index = startIndex_;
-    if(index < keyBuffer_.beginIndex() + 2)
-        index = keyBuffer_.beginIndex() + 2;
-
-    while(index < keyBuffer_.endIndex() - kPositionTrackerSamplesNeededForPressVelocityAfterEscapement) {
-        // If the key press has a defined end, make sure we don't go past it
-        if(pressIndex_ != 0 && index >= pressIndex_)
-            break;
-        
-        if(keyBuffer_[index] > escapementPosition) {
-            // Found the place the position crosses the indicated threshold
-            // Now find the exact (interpolated) timestamp and velocity
-            timestamp_type exactPressTimestamp = keyBuffer_.timestampAt(index); // TODO
-            
-            // Velocity is calculated by an average of 2 samples before and 1 after
-            key_position diffPosition = keyBuffer_[index + kPositionTrackerSamplesNeededForPressVelocityAfterEscapement] - keyBuffer_[index - 2];
-            timestamp_diff_type diffTimestamp = keyBuffer_.timestampAt(index + kPositionTrackerSamplesNeededForPressVelocityAfterEscapement) - keyBuffer_.timestampAt(index - 2);
-            key_velocity velocity = calculate_key_velocity(diffPosition, diffTimestamp);
-            
-            return std::pair<timestamp_type, key_velocity>(exactPressTimestamp, velocity);
-        }
-        index++;
-    }
-    
-    // Didn't find anything matching that threshold
-    return std::pair<timestamp_type, key_velocity>(missing_value<timestamp_type>::missing(),
-                                                   missing_value<key_velocity>::missing());
+    // Find where the key position crosses the indicated level, without going past the
+    // end of the key press if it has one
+    return updateVelocitySearch(pressVelocitySearch_, startIndex_, pressIndex_, escapementPosition, true,
+                                kPositionTrackerSamplesNeededForPressVelocityAfterEscapement);
 }
 
 // Calculate (MIDI-style) key release velocity from continuous key position
@@ -90,45 +73,15 @@ std::pair<timestamp_type, key_velocity> KeyPositionTracker::releaseVelocity(key_
                                                        missing_value<key_velocity>::missing());
     }
     
-    // Find where the key position crosses the indicated level
-    key_buffer_index index = releaseBeginIndex_;
-    if(index < keyBuffer_.beginIndex() + 2)
-        index = keyBuffer_.beginIndex() + 2;
-
-    while(index < keyBuffer_.endIndex() - kPositionTrackerSamplesNeededForReleaseVelocityAfterEscapement) {
-        // Check for whether we've hit the end of the release interval, assuming
-        // the interval exists yet
-        if(releaseEndIndex_ != 0 && index >= releaseEndIndex_)
-            break;
-        
-        if(keyBuffer_[index] < returnPosition) {
-            // Found the place the position crosses the indicated threshold
-            // Now find the exact (interpolated) timestamp and velocity
-            timestamp_type exactPressTimestamp = keyBuffer_.timestampAt(index); // TODO
-            
-            // Velocity is calculated by an average of 2 samples before and 1 after
-            key_position diffPosition = keyBuffer_[index + kPositionTrackerSamplesNeededForReleaseVelocityAfterEscapement] - keyBuffer_[index - 2];
-            timestamp_diff_type diffTimestamp = keyBuffer_.timestampAt(index + kPositionTrackerSamplesNeededForReleaseVelocityAfterEscapement) - keyBuffer_.timestampAt(index - 2);
-            key_velocity velocity = calculate_key_velocity(diffPosition, diffTimestamp);
-            
-            std::cout << "found release velocity " << velocity << "(diffp " << diffPosition << ", diffT " << diffTimestamp << ")" << std::endl;
-            
-            return std::pair<timestamp_type, key_velocity>(exactPressTimestamp, velocity);
-        }
-        index++;
-    }
-    
-    // Didn't find anything matching that threshold
-    return std::pair<timestamp_type, key_velocity>(missing_value<timestamp_type>::missing(),
-                                                   missing_value<key_velocity>::missing());
+    // Find where the key position crosses the indicated level, without going past the
+    // end of the release interval if it exists yet
+    return updateVelocitySearch(releaseVelocitySearch_, releaseBeginIndex_, releaseEndIndex_, returnPosition, false,
+                                kPositionTrackerSamplesNeededForReleaseVelocityAfterEscapement);
 }
 
 // Calculate and return features about the percussiveness of the key press
 KeyPositionTracker::PercussivenessFeatures KeyPositionTracker::pressPercussiveness() {
     PercussivenessFeatures features;
-    key_buffer_index index;
-    key_velocity maximumVelocity, largestVelocityDifference;
-    key_buffer_index maximumVelocityIndex, largestVelocityDifferenceIndex;
     
     // Check that we have a valid start point from which to calculate
     if(missing_value<timestamp_type>::isMissing(startTimestamp_) || keyBuffer_.beginIndex() > startIndex_ - 1) {
@@ -137,77 +90,33 @@ KeyPositionTracker::PercussivenessFeatures KeyPositionTracker::pressPercussivene
         return features;
     }
     
-    // From the start of the key press, look for an initial maximum in velocity
-    index = startIndex_;
-    
-    maximumVelocity = scale_key_velocity(0);
-    maximumVelocityIndex = startIndex_;
-    largestVelocityDifference = scale_key_velocity(0);
-    largestVelocityDifferenceIndex = startIndex_;
+    std::cout << "*** start index " << startIndex_ << std::endl;
     
-    std::cout << "*** start index " << index << std::endl;
-    
-    while(index < keyBuffer_.endIndex()) {
-        if(pressIndex_ != 0 && index >= pressIndex_)
-            break;
-        
-        key_position diffPosition = keyBuffer_[index] - keyBuffer_[index - 1];
-        timestamp_diff_type diffTimestamp = keyBuffer_.timestampAt(index) - keyBuffer_.timestampAt(index - 1);
-        key_velocity velocity = calculate_key_velocity(diffPosition, diffTimestamp);
-        
-        // Look for maximum of velocity
-        if(velocity > maximumVelocity) {
-            maximumVelocity = velocity;
-            maximumVelocityIndex = index;
-            std::cout << "*** found new max velocity " << maximumVelocity << " at index " << index << std::endl;
-        }
-        
-        // And given the difference between the max and the current sample,
-        // look for the largest rebound (velocity hitting a peak and falling)
-        if(maximumVelocity - velocity > largestVelocityDifference) {
-            largestVelocityDifference = maximumVelocity - velocity;
-            largestVelocityDifferenceIndex = index;
-            std::cout << "*** found new diff velocity " << largestVelocityDifference << " at index " << index << std::endl;
-        }
-        
-        // Only look at the early part of the key press: if the key position
-        // makes it more than a certain amount down, assume the initial spike
-        // has passed and finish up. But always allow at least 5 points for the
-        // fastest key presses to be considered.
-        if(index - startIndex_ >= 4 && keyBuffer_[index] > kPositionTrackerPositionThresholdForPercussivenessCalculation) {
-            break;
-        }
-        
-        index++;
-    }
+    // From the start of the key press, look for an initial maximum in velocity
+    updatePercussivenessSearch(pressIndex_);
+    const PercussivenessSearch& search = percussivenessSearch_;
     
     // Now transfer what we've found to the data structure
-    features.velocitySpikeMaximum = Event(maximumVelocityIndex, maximumVelocity, keyBuffer_.timestampAt(maximumVelocityIndex));
-    features.velocitySpikeMinimum = Event(largestVelocityDifferenceIndex, maximumVelocity - largestVelocityDifference,
-                                          keyBuffer_.timestampAt(largestVelocityDifferenceIndex));
-    features.timeFromStartToSpike = keyBuffer_.timestampAt(maximumVelocityIndex) - keyBuffer_.timestampAt(startIndex_);
+    features.velocitySpikeMaximum = Event(search.maximumVelocityIndex, search.maximumVelocity, keyBuffer_.timestampAt(search.maximumVelocityIndex));
+    features.velocitySpikeMinimum = Event(search.largestVelocityDifferenceIndex, search.maximumVelocity - search.largestVelocityDifference,
+                                          keyBuffer_.timestampAt(search.largestVelocityDifferenceIndex));
+    features.timeFromStartToSpike = keyBuffer_.timestampAt(search.maximumVelocityIndex) - keyBuffer_.timestampAt(startIndex_);
     
     // Check if we found a meaningful difference. If not, percussiveness is set to 0
-    if(largestVelocityDifference == scale_key_velocity(0)) {
+    if(search.largestVelocityDifference == scale_key_velocity(0)) {
         features.percussiveness = 0.0;
         features.areaPrecedingSpike = scale_key_velocity(0);
         features.areaFollowingSpike = scale_key_velocity(0);
         return features;
     }
     
-    // Calculate the area under the velocity curve before and after the maximum
-    features.areaPrecedingSpike = scale_key_velocity(0);
-    for(index = startIndex_; index < maximumVelocityIndex; index++) {
-        key_position diffPosition = keyBuffer_[index] - keyBuffer_[index - 1];
-        timestamp_diff_type diffTimestamp = keyBuffer_.timestampAt(index) - keyBuffer_.timestampAt(index - 1);
-        features.areaPrecedingSpike += calculate_key_velocity(diffPosition, diffTimestamp);
-    }
-    features.areaFollowingSpike = scale_key_velocity(0);
-    for(index = maximumVelocityIndex; index < largestVelocityDifferenceIndex; index++) {
-        key_position diffPosition = keyBuffer_[index] - keyBuffer_[index - 1];
-        timestamp_diff_type diffTimestamp = keyBuffer_.timestampAt(index) - keyBuffer_.timestampAt(index - 1);
-        features.areaFollowingSpike += calculate_key_velocity(diffPosition, diffTimestamp);
-    }
+    // Area under the velocity curve before and after the maximum. If the largest difference
+    // came before the final maximum, nothing follows the spike.
+    features.areaPrecedingSpike = search.areaBeforeMaximum;
+    if(search.largestVelocityDifferenceIndex > search.maximumVelocityIndex)
+        features.areaFollowingSpike = search.areaBeforeDifference;
+    else
+        features.areaFollowingSpike = scale_key_velocity(0);
     
     std::cout << "area before = " << features.areaPrecedingSpike << " after = " << features.areaFollowingSpike << std::endl;
     
@@ -221,7 +130,8 @@ void KeyPositionTracker::engage() {
     if(engaged_)
         return;
 
-    registerForTrigger(&keyBuffer_);
+    if(triggeredByInput_)
+        registerForTrigger(&keyBuffer_);
     engaged_ = true;
 }
 
@@ -230,12 +140,28 @@ void KeyPositionTracker::disengage() {
     if(!engaged_)
         return;
     
-    unregisterForTrigger(&keyBuffer_);
+    if(triggeredByInput_)
+        unregisterForTrigger(&keyBuffer_);
     engaged_ = false;
 }
 
+// Switch between following the key buffer through triggers and being driven by process()
+void KeyPositionTracker::setTriggeredByInput(bool triggered) {
+    if(triggered == triggeredByInput_)
+        return;
+    if(engaged_) {
+        if(triggered)
+            registerForTrigger(&keyBuffer_);
+        else
+            unregisterForTrigger(&keyBuffer_);
+    }
+    triggeredByInput_ = triggered;
+}
+
 // Clear current state and reset to unknown state
 void KeyPositionTracker::reset() {
+    // A prediction still outstanding never saw its press finish
+    cancelPrediction(0, false);
 	Node<KeyPositionTrackerNotification>::clear();
     
     currentState_ = kPositionTrackerStateUnknown;
@@ -252,6 +178,14 @@ void KeyPositionTracker::reset() {
     releaseVelocityEscapementPosition_ = kPositionTrackerDefaultPositionForReleaseVelocityCalculation;
     pressVelocityAvailableIndex_ = releaseVelocityAvailableIndex_ = percussivenessAvailableIndex_ = 0;
     releaseVelocityWaitingForThresholdCross_ = false;
+    
+    restartCrossingSearch(pressCrossing_, pressVelocityEscapementPosition_, false, keyBuffer_.endIndex());
+    restartCrossingSearch(releaseCrossing_, releaseVelocityEscapementPosition_, true, keyBuffer_.endIndex());
+    pressVelocitySearch_.valid = releaseVelocitySearch_.valid = false;
+    percussivenessSearch_.valid = false;
+    
+    predictedVelocity_ = missing_value<key_velocity>::missing();
+    predictionTimestamp_ = predictedOnsetTimestamp_ = missing_value<timestamp_type>::missing();
 }
 
 // Evaluator function. Update the current state
@@ -260,6 +194,14 @@ void KeyPositionTracker::triggerReceived(TriggerSource* who, timestamp_type time
 	if(who != &keyBuffer_)
 		return;
     
+    process(timestamp);
+}
+
+// Update the state from the latest key position
+void KeyPositionTracker::process(timestamp_type timestamp) {
+    if(!engaged_)
+        return;
+    
     // Always start in the partial press state after a reset, retroactively locating
     // the start position for this key press
     if(empty()) {
@@ -270,11 +212,17 @@ void KeyPositionTracker::triggerReceived(TriggerSource* who, timestamp_type time
     key_position currentKeyPosition = keyBuffer_.latest();
     key_buffer_index currentBufferIndex = keyBuffer_.endIndex() - 1;
     
+    // Keep track of the escapement crossings as samples arrive. The velocity and
+    // percussiveness searches catch up when they are next asked for.
+    updateCrossingSearch(pressCrossing_);
+    updateCrossingSearch(releaseCrossing_);
+    
     // First, check queued actions to see if we can calculate a new feature
     // ** Press Velocity **
     if(pressVelocityAvailableIndex_ != 0) {
         if(currentBufferIndex >= pressVelocityAvailableIndex_) {
             // Can now calculate press velocity
+            confirmPrediction(timestamp);
             currentlyAvailableFeatures_ |= KeyPositionTrackerNotification::kFeaturePressVelocity;
             notifyFeature(KeyPositionTrackerNotification::kNotificationTypeFeatureAvailableVelocity, timestamp);
             pressVelocityAvailableIndex_ = 0;
@@ -303,6 +251,10 @@ void KeyPositionTracker::triggerReceived(TriggerSource* who, timestamp_type time
         }
     }
     
+    // ** Predicted Onset **
+    if(predictsOnset_ && !predictionPending_ && currentState_ == kPositionTrackerStatePartialPressAwaitingMax)
+        predictOnset(currentBufferIndex, timestamp);
+    
     // Major state transitions next, centered on whether the key is pressed
     // fully or partially
     if(currentState_ == kPositionTrackerStatePartialPressAwaitingMax ||
@@ -475,6 +427,7 @@ void KeyPositionTracker::changeState(int newState, timestamp_type timestamp) {
             index = findMostRecentKeyPositionCrossing(pressVelocityEscapementPosition_, false, 1000);
             if(index + kPositionTrackerSamplesNeededForPressVelocityAfterEscapement <= mostRecentIndex) {
                 // Here, we already have the velocity information
+                confirmPrediction(timestamp);
                 currentlyAvailableFeatures_ |= KeyPositionTrackerNotification::kFeaturePressVelocity;
                 notifyFeature(KeyPositionTrackerNotification::kNotificationTypeFeatureAvailableVelocity, timestamp);
             }
@@ -490,6 +443,9 @@ void KeyPositionTracker::changeState(int newState, timestamp_type timestamp) {
             prepareReleaseVelocityFeature(mostRecentIndex, timestamp);
             break;
         case kPositionTrackerStatePartialPressFoundMax:
+            // The key turned back short of a press, so any onset predicted for it was wrong
+            cancelPrediction(timestamp, true);
+            
             // Also look for the percussiveness features, if not already present
             if((currentlyAvailableFeatures_ & KeyPositionTrackerNotification::kFeaturePercussiveness) == 0
                && percussivenessAvailableIndex_ == 0) {
@@ -655,12 +611,35 @@ KeyPositionTracker::key_buffer_index KeyPositionTracker::findMostRecentKeyPositi
     if(keyBuffer_[index] <= threshold && !greaterThan)
         return 0;
     
+    // If one of the running searches is following this threshold, it knows the answer
+    // back to where it started; only look at the samples before that
+    CrossingSearch *search = 0;
+    if(pressCrossing_.threshold == threshold && pressCrossing_.greaterThan == greaterThan)
+        search = &pressCrossing_;
+    else if(releaseCrossing_.threshold == threshold && releaseCrossing_.greaterThan == greaterThan)
+        search = &releaseCrossing_;
+    if(search != 0) {
+        updateCrossingSearch(*search);
+        if(search->found) {
+            if(search->mostRecent >= keyBuffer_.beginIndex() && index - search->mostRecent <= (key_buffer_index)maxDistance)
+                return search->mostRecent;
+            return 0;
+        }
+        if(search->from <= keyBuffer_.beginIndex() || search->from > index + 1)
+            return 0;
+        searchBackCounter = index + 1 - search->from;
+        index = search->from - 1;
+    }
+    
     while(index >= keyBuffer_.beginIndex() && searchBackCounter <= maxDistance) {
         if(keyBuffer_[index] >= threshold && greaterThan)
             return index;
         else if(keyBuffer_[index] <= threshold && !greaterThan)
             return index;
         
+        // Can't decrement past 0 in an unsigned type
+        if(index == 0)
+            break;
         searchBackCounter++;
         index--;
     }
@@ -668,6 +647,296 @@ KeyPositionTracker::key_buffer_index KeyPositionTracker::findMostRecentKeyPositi
     return 0;
 }
 
+// Start following the latest sample at or beyond threshold, from sample index from onwards
+void KeyPositionTracker::restartCrossingSearch(CrossingSearch& search, key_position threshold, bool greaterThan, key_buffer_index from) {
+    search.threshold = threshold;
+    search.greaterThan = greaterThan;
+    search.from = search.next = from;
+    search.mostRecent = 0;
+    search.found = false;
+}
+
+// Look at any samples that have arrived since the search was last updated
+void KeyPositionTracker::updateCrossingSearch(CrossingSearch& search) {
+    key_buffer_index end = keyBuffer_.endIndex();
+    
+    if(search.next > end)   // The key buffer was cleared
+        restartCrossingSearch(search, search.threshold, search.greaterThan, end);
+    if(search.next < keyBuffer_.beginIndex())
+        search.next = keyBuffer_.beginIndex();
+    
+    for(; search.next < end; search.next++) {
+        key_position position = keyBuffer_[search.next];
+        if(search.greaterThan ? (position >= search.threshold) : (position <= search.threshold)) {
+            search.mostRecent = search.next;
+            search.found = true;
+        }
+    }
+}
+
+// Time at which the key position passed threshold on its way to the sample at index,
+// found by interpolating linearly from the sample before. If that sample was not on the
+// other side of the threshold, the crossing can't be placed any better than index itself.
+timestamp_type KeyPositionTracker::interpolatedCrossingTime(key_buffer_index index, key_position threshold) {
+    key_position before = keyBuffer_[index - 1], after = keyBuffer_[index];
+    timestamp_type beforeTimestamp = keyBuffer_.timestampAt(index - 1);
+    timestamp_type afterTimestamp = keyBuffer_.timestampAt(index);
+    
+    if(before == after || afterTimestamp <= beforeTimestamp)
+        return afterTimestamp;
+    double fraction = ((double)threshold - (double)before) / ((double)after - (double)before);
+    if(fraction < 0.0 || fraction > 1.0)
+        return afterTimestamp;
+    return beforeTimestamp + (timestamp_diff_type)(fraction * (double)(afterTimestamp - beforeTimestamp));
+}
+
+// Velocity from a least-squares line through the samples first to last, which is less
+// sensitive to noise on the two end samples than the difference between them
+key_velocity KeyPositionTracker::leastSquaresVelocity(key_buffer_index first, key_buffer_index last) {
+    timestamp_diff_type span = keyBuffer_.timestampAt(last) - keyBuffer_.timestampAt(first);
+    double slope, positionAtLast;
+    
+    // Express the slope as the change in position it gives over the whole span, so the
+    // result comes out in the same units as calculate_key_velocity() on any other pair
+    key_position diffPosition;
+    if(leastSquaresFit(first, last, slope, positionAtLast))
+        diffPosition = (key_position)(slope * (double)span);
+    else
+        diffPosition = keyBuffer_[last] - keyBuffer_[first];
+    return calculate_key_velocity(diffPosition, span);
+}
+
+// Fit a line through the samples first to last by least squares, giving its slope in
+// position per timestamp unit and the position it passes through at the last sample.
+// Times are taken relative to the first sample so the sums keep their precision. Returns
+// false if the samples don't spread out in time enough to fit anything.
+bool KeyPositionTracker::leastSquaresFit(key_buffer_index first, key_buffer_index last, double& slope, double& positionAtLast) {
+    timestamp_type origin = keyBuffer_.timestampAt(first);
+    double count = 0, sumT = 0, sumX = 0, sumTT = 0, sumTX = 0;
+    
+    for(key_buffer_index index = first; index <= last; index++) {
+        double t = (double)(keyBuffer_.timestampAt(index) - origin);
+        double x = (double)keyBuffer_[index];
+        count += 1.0;
+        sumT += t;
+        sumX += x;
+        sumTT += t * t;
+        sumTX += t * x;
+    }
+    
+    double denominator = count * sumTT - sumT * sumT;
+    if(denominator <= 0.0)
+        return false;
+    slope = (count * sumTX - sumT * sumX) / denominator;
+    positionAtLast = (sumX + slope * ((double)(keyBuffer_.timestampAt(last) - origin) * count - sumT)) / count;
+    return true;
+}
+
+// While a press from rest is on its way down, extrapolate its recent trajectory and, if it
+// should reach the press position within the lead time, send a provisional onset. The velocity
+// goes with it: measured if the key is already past the escapement point, otherwise the
+// speed the key is going now.
+void KeyPositionTracker::predictOnset(key_buffer_index index, timestamp_type timestamp) {
+    const key_position pressThreshold = kPositionTrackerPressPosition + kPositionTrackerPressHysteresis;
+    key_position position = keyBuffer_[index];
+    
+    if(position < kPositionTrackerPredictionMinimumPosition || position >= pressThreshold)
+        return;
+    if(index < keyBuffer_.beginIndex() + kPositionTrackerSamplesForPrediction - 1)
+        return;
+    
+    key_buffer_index first = index - (kPositionTrackerSamplesForPrediction - 1);
+    double slope, positionAtLast;
+    if(!leastSquaresFit(first, index, slope, positionAtLast) || slope <= 0.0)
+        return;
+    
+    timestamp_diff_type span = keyBuffer_.timestampAt(index) - keyBuffer_.timestampAt(first);
+    key_position diffPosition = (key_position)(slope * (double)span);
+    key_velocity velocity = calculate_key_velocity(diffPosition, span);
+    if(velocity < kPositionTrackerPredictionMinimumVelocity)
+        return;
+    
+    double timeToPress = ((double)pressThreshold - positionAtLast) / slope;
+    if(timeToPress > (double)kPositionTrackerPredictionLeadTime)
+        return;
+    if(timeToPress < 0.0)
+        timeToPress = 0.0;
+    
+    if(position >= pressVelocityEscapementPosition_) {
+        std::pair<timestamp_type, key_velocity> measured = pressVelocity();
+        if(!missing_value<key_velocity>::isMissing(measured.second))
+            velocity = measured.second;
+    }
+    
+    predictionPending_ = true;
+    predictedVelocity_ = velocity;
+    predictionTimestamp_ = timestamp;
+    predictedOnsetTimestamp_ = keyBuffer_.timestampAt(index) + (timestamp_diff_type)timeToPress;
+    predictionStatistics_.predictions++;
+    
+    currentlyAvailableFeatures_ |= KeyPositionTrackerNotification::kFeaturePredictedPressVelocity;
+    notifyFeature(KeyPositionTrackerNotification::kNotificationTypeFeatureAvailablePredictedVelocity, timestamp);
+}
+
+// The press went through: compare the prediction against the measured velocity and the time
+// it became available, and log how the predictions are doing
+void KeyPositionTracker::confirmPrediction(timestamp_type timestamp) {
+    if(!predictionPending_)
+        return;
+    predictionPending_ = false;
+    
+    PredictionStatistics& stats = predictionStatistics_;
+    std::pair<timestamp_type, key_velocity> measured = pressVelocity();
+    double leadTime = (double)(timestamp - predictionTimestamp_);
+    double timingError = (double)timestamp - (double)predictedOnsetTimestamp_;
+    
+    stats.confirmed++;
+    stats.sumLeadTime += leadTime;
+    stats.sumSquaredTimingError += timingError * timingError;
+    if(!missing_value<key_velocity>::isMissing(measured.second) && measured.second != scale_key_velocity(0)) {
+        double error = ((double)predictedVelocity_ - (double)measured.second) / (double)measured.second;
+        stats.measured++;
+        stats.sumVelocityError += error;
+        stats.sumSquaredVelocityError += error * error;
+    }
+    
+#ifdef DEBUG_ONSET_PREDICTION
+    std::cout << "predicted velocity " << predictedVelocity_ << ", measured " << measured.second
+              << ", lead " << leadTime << " (" << stats.predictions << " predictions, " << stats.cancelled << " cancelled";
+    if(stats.measured > 0)
+        std::cout << ", velocity error mean " << stats.sumVelocityError / stats.measured
+                  << " rms " << sqrt(stats.sumSquaredVelocityError / stats.measured);
+    std::cout << ", mean lead " << stats.sumLeadTime / stats.confirmed
+              << ", rms timing error " << sqrt(stats.sumSquaredTimingError / stats.confirmed) << ")" << std::endl;
+#endif
+}
+
+// The press stopped short of the press position, or the tracker was reset before it got
+// there. Listeners are told unless the notification would be cleared straight away.
+void KeyPositionTracker::cancelPrediction(timestamp_type timestamp, bool notify) {
+    if(!predictionPending_)
+        return;
+    predictionPending_ = false;
+    predictionStatistics_.cancelled++;
+    
+#ifdef DEBUG_ONSET_PREDICTION
+    std::cout << "cancelled predicted onset (" << predictionStatistics_.cancelled << " of "
+              << predictionStatistics_.predictions << " predictions)" << std::endl;
+#endif
+    
+    if(notify) {
+        currentlyAvailableFeatures_ &= ~KeyPositionTrackerNotification::kFeaturePredictedPressVelocity;
+        notifyFeature(KeyPositionTrackerNotification::kNotificationTypePredictionCancelled, timestamp);
+    }
+}
+
+// Find the first sample from the given start where the key position goes above (or below)
+// threshold, and the velocity there, fitted over 2 samples before and samplesAfter after.
+// A crossing at or after until, if that is not 0, doesn't count. The search carries on
+// from where it last got to unless the start or threshold have changed.
+std::pair<timestamp_type, key_velocity> KeyPositionTracker::updateVelocitySearch(VelocitySearch& search, key_buffer_index from, key_buffer_index until,
+                                                                                 key_position threshold, bool above, int samplesAfter) {
+    key_buffer_index end = keyBuffer_.endIndex();
+    key_buffer_index earliest = from;
+    if(earliest < keyBuffer_.beginIndex() + 2)
+        earliest = keyBuffer_.beginIndex() + 2;
+    
+    if(!search.valid || search.from != from || search.threshold != threshold || search.next > end ||
+       (search.found && search.foundIndex < earliest)) {
+        search.valid = true;
+        search.from = from;
+        search.threshold = threshold;
+        search.next = earliest;
+        search.found = false;
+    }
+    if(search.next < earliest)
+        search.next = earliest;
+    
+    while(!search.found && search.next < end - samplesAfter) {
+        key_buffer_index index = search.next;
+        
+        if(above ? (keyBuffer_[index] > threshold) : (keyBuffer_[index] < threshold)) {
+            // Found the place the position crosses the indicated threshold
+            // Now find the exact (interpolated) timestamp and velocity
+            timestamp_type exactTimestamp = interpolatedCrossingTime(index, threshold);
+            key_velocity velocity = leastSquaresVelocity(index - 2, index + samplesAfter);
+            
+            search.found = true;
+            search.foundIndex = index;
+            search.result = std::pair<timestamp_type, key_velocity>(exactTimestamp, velocity);
+            if(!above)
+                std::cout << "found release velocity " << velocity << std::endl;
+            break;
+        }
+        search.next++;
+    }
+    
+    if(search.found && (until == 0 || search.foundIndex < until))
+        return search.result;
+    
+    // Didn't find anything matching that threshold
+    return std::pair<timestamp_type, key_velocity>(missing_value<timestamp_type>::missing(),
+                                                   missing_value<key_velocity>::missing());
+}
+
+// Follow the velocity from the start of the key press, looking for an initial maximum and
+// the largest fall from it, until the key is far enough down that the spike has passed.
+// Samples at or after until, if that is not 0, are not part of the press.
+void KeyPositionTracker::updatePercussivenessSearch(key_buffer_index until) {
+    PercussivenessSearch& search = percussivenessSearch_;
+    key_buffer_index end = keyBuffer_.endIndex();
+    
+    // Start again for a new press, or if the search already went past the end of this one
+    if(!search.valid || search.from != startIndex_ || search.next > end || (until != 0 && search.next > until)) {
+        search.valid = true;
+        search.finished = false;
+        search.from = search.next = startIndex_;
+        search.maximumVelocity = scale_key_velocity(0);
+        search.maximumVelocityIndex = startIndex_;
+        search.largestVelocityDifference = scale_key_velocity(0);
+        search.largestVelocityDifferenceIndex = startIndex_;
+        search.area = search.areaBeforeMaximum = search.areaSinceMaximum = search.areaBeforeDifference = scale_key_velocity(0);
+    }
+    
+    while(!search.finished && search.next < end) {
+        key_buffer_index index = search.next;
+        
+        if(until != 0 && index >= until)
+            break;
+        
+        key_position diffPosition = keyBuffer_[index] - keyBuffer_[index - 1];
+        timestamp_diff_type diffTimestamp = keyBuffer_.timestampAt(index) - keyBuffer_.timestampAt(index - 1);
+        key_velocity velocity = calculate_key_velocity(diffPosition, diffTimestamp);
+        
+        // Look for maximum of velocity
+        if(velocity > search.maximumVelocity) {
+            search.maximumVelocity = velocity;
+            search.maximumVelocityIndex = index;
+            search.areaBeforeMaximum = search.area;
+            search.areaSinceMaximum = scale_key_velocity(0);
+        }
+        
+        // And given the difference between the max and the current sample,
+        // look for the largest rebound (velocity hitting a peak and falling)
+        if(search.maximumVelocity - velocity > search.largestVelocityDifference) {
+            search.largestVelocityDifference = search.maximumVelocity - velocity;
+            search.largestVelocityDifferenceIndex = index;
+            search.areaBeforeDifference = search.areaSinceMaximum;
+        }
+        
+        search.area += velocity;
+        search.areaSinceMaximum += velocity;
+        search.next++;
+        
+        // Only look at the early part of the key press: if the key position
+        // makes it more than a certain amount down, assume the initial spike
+        // has passed and finish up. But always allow at least 5 points for the
+        // fastest key presses to be considered.
+        if(index - startIndex_ >= 4 && keyBuffer_[index] > kPositionTrackerPositionThresholdForPercussivenessCalculation)
+            search.finished = true;
+    }
+}
+
 void KeyPositionTracker::prepareReleaseVelocityFeature(KeyPositionTracker::key_buffer_index mostRecentIndex, timestamp_type timestamp) {
     KeyPositionTracker::key_buffer_index index;
 
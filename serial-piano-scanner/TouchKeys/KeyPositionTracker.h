@@ -65,6 +65,15 @@ const key_position kPositionTrackerPositionThresholdForPercussivenessCalculation
 const int kPositionTrackerSamplesNeededForPressVelocityAfterEscapement = 1;
 const int kPositionTrackerSamplesNeededForReleaseVelocityAfterEscapement = 1;
 
+// Constants for predicting the onset of a press before it reaches the press position: the
+// trajectory is fitted over the most recent samples and a provisional onset sent when it is
+// expected to get there within the lead time. Presses shallower or slower than the minimums
+// are left alone.
+const int kPositionTrackerSamplesForPrediction = 4;
+const timestamp_diff_type kPositionTrackerPredictionLeadTime = milliseconds_to_timestamp(5);
+const key_position kPositionTrackerPredictionMinimumPosition = scale_key_position(0.3);
+const key_velocity kPositionTrackerPredictionMinimumVelocity = scale_key_velocity(2.0);
+
 // KeyPositionTrackerNotification
 //
 // This class contains information on the notifications sent and stored by
@@ -78,14 +87,17 @@ public:
         kNotificationTypeFeatureAvailableReleaseVelocity,
         kNotificationTypeFeatureAvailablePercussiveness,
         kNotificationTypeNewMinimum,
-        kNotificationTypeNewMaximum
+        kNotificationTypeNewMaximum,
+        kNotificationTypeFeatureAvailablePredictedVelocity,
+        kNotificationTypePredictionCancelled
     };
     
     enum {
         kFeaturesNone = 0,
         kFeaturePressVelocity = 0x0001,
         kFeatureReleaseVelocity = 0x0002,
-        kFeaturePercussiveness = 0x0004
+        kFeaturePercussiveness = 0x0004,
+        kFeaturePredictedPressVelocity = 0x0008
     };
     
     int type;
@@ -142,6 +154,18 @@ public:
         key_velocity areaFollowingSpike;        // Total sum of velocity values from max to min
     };
     
+    // Running record of how the onset predictions have turned out
+    struct PredictionStatistics {
+        int predictions;                        // Provisional onsets sent
+        int confirmed;                          // ... followed by a full press
+        int cancelled;                          // ... where the press stopped short
+        int measured;                           // Confirmed predictions with a velocity to compare against
+        double sumVelocityError;                // Relative error of the predicted velocity over those
+        double sumSquaredVelocityError;
+        double sumLeadTime;                     // How long before the velocity notification each confirmed
+        double sumSquaredTimingError;           // prediction came, and the error in that against what was predicted
+    };
+    
 public:
 	// ***** Constructors *****
 	
@@ -201,18 +225,37 @@ public:
             pressVelocityEscapementPosition_ = kPositionTrackerPressPosition + kPositionTrackerPressHysteresis;
         else
             pressVelocityEscapementPosition_ = pos;
+        restartCrossingSearch(pressCrossing_, pressVelocityEscapementPosition_, false, keyBuffer_.endIndex());
     }
     void setReleaseVelocityEscapementPosition(key_position pos) {
         if(pos < kPositionTrackerReleaseFinishPosition)
             releaseVelocityEscapementPosition_ = kPositionTrackerReleaseFinishPosition;
         else
             releaseVelocityEscapementPosition_ = pos;
+        restartCrossingSearch(releaseCrossing_, releaseVelocityEscapementPosition_, true, keyBuffer_.endIndex());
     }
     
     
     // Percussiveness (struck vs. pressed keys)
     PercussivenessFeatures pressPercussiveness();
     
+    // ***** Predicted Onset *****
+    //
+    // Optionally, a press from rest can be reported before it reaches the press position.
+    // Once its recent trajectory is expected to get there within kPositionTrackerPredictionLeadTime,
+    // a kNotificationTypeFeatureAvailablePredictedVelocity notification is sent, and
+    // predictedPressVelocity() gives the velocity fitted to its most recent samples (or the
+    // measured escapement velocity if it is already past the escapement point). The usual
+    // velocity notification follows if the press goes on, with pressVelocity() then giving
+    // the measured value; or kNotificationTypePredictionCancelled if it stops short.
+    
+    bool predictsOnset() { return predictsOnset_; }
+    void setPredictsOnset(bool predicts) { predictsOnset_ = predicts; }
+    key_velocity predictedPressVelocity() { return predictedVelocity_; }
+    
+    // How well the predictions have matched what followed, since construction
+    const PredictionStatistics& predictionStatistics() { return predictionStatistics_; }
+    
 	// ***** Modifiers *****
     
     // Register for updates from the key positon buffer
@@ -223,14 +266,82 @@ public:
 	
     // Reset the state back initial values
 	void reset();
+    
+    // By default, engaging the tracker registers it for triggers from the key buffer. Turn
+    // this off to drive it from process() instead, e.g. as part of a StaticPipeline.
+    void setTriggeredByInput(bool triggered);
 	
 	// ***** Evaluator *****
 	
     // This method receives triggers whenever a new sample enters the buffer. It updates
     // the state depending on the profile of the key position.
 	void triggerReceived(TriggerSource* who, timestamp_type timestamp);
+    
+    // Update the state from the latest sample in the key buffer, if engaged
+    void process(timestamp_type timestamp);
 	
 private:
+    // ***** Incremental Searches *****
+    //
+    // The features above come from searching the key buffer around the press or release.
+    // Rather than search from scratch on every query, each search remembers how far it has
+    // got and carries on from there, so each sample is looked at once per press however
+    // many mappings ask. The crossing searches follow every sample in process(); the others
+    // catch up when queried. A search starts again if what it was started from (the start
+    // of the press, the threshold) changes.
+    
+    // Latest sample at or beyond a threshold, for findMostRecentKeyPositionCrossing()
+    struct CrossingSearch {
+        key_position threshold;
+        bool greaterThan;                   // Looking for samples >= threshold rather than <=
+        key_buffer_index from;              // First sample examined
+        key_buffer_index next;              // Next sample to examine
+        key_buffer_index mostRecent;        // Latest sample meeting the threshold, if found
+        bool found;
+    };
+    
+    // First sample past a threshold from the start of a press or release, for
+    // pressVelocity() and releaseVelocity()
+    struct VelocitySearch {
+        bool valid;                         // Whether the fields below mean anything yet
+        key_buffer_index from;
+        key_position threshold;
+        key_buffer_index next;
+        bool found;
+        key_buffer_index foundIndex;
+        std::pair<timestamp_type, key_velocity> result;
+    };
+    
+    // Initial velocity spike of a press, for pressPercussiveness()
+    struct PercussivenessSearch {
+        bool valid;
+        bool finished;                      // Got far enough into the press to stop looking
+        key_buffer_index from;
+        key_buffer_index next;
+        key_velocity maximumVelocity, largestVelocityDifference;
+        key_buffer_index maximumVelocityIndex, largestVelocityDifferenceIndex;
+        key_velocity area;                  // Sum of the velocities from from to next - 1
+        key_velocity areaBeforeMaximum;     // ... from from to maximumVelocityIndex - 1
+        key_velocity areaSinceMaximum;      // ... from maximumVelocityIndex to next - 1
+        key_velocity areaBeforeDifference;  // areaSinceMaximum when largestVelocityDifference was found
+    };
+    
+    void restartCrossingSearch(CrossingSearch& search, key_position threshold, bool greaterThan, key_buffer_index from);
+    void updateCrossingSearch(CrossingSearch& search);
+    std::pair<timestamp_type, key_velocity> updateVelocitySearch(VelocitySearch& search, key_buffer_index from, key_buffer_index until,
+                                                                 key_position threshold, bool above, int samplesAfter);
+    void updatePercussivenessSearch(key_buffer_index until);
+    
+    // Estimates made once a crossing is found
+    timestamp_type interpolatedCrossingTime(key_buffer_index index, key_position threshold);
+    key_velocity leastSquaresVelocity(key_buffer_index first, key_buffer_index last);
+    bool leastSquaresFit(key_buffer_index first, key_buffer_index last, double& slope, double& positionAtLast);
+    
+    // Send, confirm or cancel a predicted onset (see above), keeping the statistics up to date
+    void predictOnset(key_buffer_index index, timestamp_type timestamp);
+    void confirmPrediction(timestamp_type timestamp);
+    void cancelPrediction(timestamp_type timestamp, bool notify);
+    
     // ***** Internal Helper Methods *****
     
     // Change the current state
@@ -253,6 +364,9 @@ private:
 	
 	Node<key_position>& keyBuffer_;		// Raw key position data
     bool engaged_;                      // Whether we're actively listening to incoming updates
+    bool triggeredByInput_;             // Whether engaging registers for triggers from keyBuffer_
+    bool predictsOnset_;                // Whether to send provisional onsets (see above)
+    bool predictionPending_;            // Whether one has been sent for the current press
     int currentState_;                  // Our current state
     int currentlyAvailableFeatures_;    // Which features can be calculated for the current press
     
@@ -282,6 +396,17 @@ private:
     bool releaseVelocityWaitingForThresholdCross_;              // Set to true if we need to look for release escapement cross
     key_buffer_index percussivenessAvailableIndex_;             // When we can calculate percussiveness features
     
+    // Searches behind the features (see above)
+    CrossingSearch pressCrossing_, releaseCrossing_;
+    VelocitySearch pressVelocitySearch_, releaseVelocitySearch_;
+    PercussivenessSearch percussivenessSearch_;
+    
+    // Outstanding onset prediction, and how they have gone so far
+    key_velocity predictedVelocity_;
+    timestamp_type predictionTimestamp_;                        // When the prediction was made
+    timestamp_type predictedOnsetTimestamp_;                    // When the press position was expected to be reached
+    PredictionStatistics predictionStatistics_;
+    
     /*
     typedef struct {
 		int runningSum;						// sum of last N points (i.e. mean * N)
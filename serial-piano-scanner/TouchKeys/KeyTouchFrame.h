@@ -23,6 +23,9 @@
 #ifndef KEY_TOUCH_FRAME_H
 #define KEY_TOUCH_FRAME_H
 
+#include <stdint.h>
+#include "../Utility/NodeStorage.h"
+
 #define kWhiteFrontBackCutoff (6.5/19.0)	// Border between 2- and 1-dimensional sensing regions
 
 // This class holds one frame of key touch data, both raw values and unique ID numbers
@@ -81,4 +84,104 @@ public:
 	bool white;			// Whether this is a white key
 };
 
+// Packed form of KeyTouchFrame kept in touch history: 16 bytes instead of 52. Positions
+// are 14-bit fixed point over [0, 2), finer than the 12-bit sensor data, and sizes are
+// 8 bits, which holds the sensor's size values exactly. IDs are kept as distances back
+// from nextId, which stays small within a gesture since the IDs start again from 0 with
+// each new touch. Out of range values (e.g. over 65535 touches in one gesture) are clamped.
+// The accessors unpack one field each, so scanning the history for one value does not
+// need to expand whole frames.
+
+class PackedKeyTouchFrame {
+public:
+	static const int kLocationBits = 14;
+	static const uint64_t kLocationMask = (1 << kLocationBits) - 1;
+	static const uint64_t kLocationNone = kLocationMask;		// Stands for -1 (no touch)
+	static const int kCountShift = 4 * kLocationBits;
+	static const uint64_t kWhiteBit = 1ULL << (kCountShift + 2);
+	
+	// ***** Constructors *****
+	
+	PackedKeyTouchFrame() : PackedKeyTouchFrame(KeyTouchFrame()) {}
+	
+	explicit PackedKeyTouchFrame(const KeyTouchFrame& frame) : bits_(0) {
+		for(int i = 0; i < 3; i++)
+			bits_ |= packLocation(frame.locs[i]) << (i * kLocationBits);
+		bits_ |= packLocation(frame.locH) << (3 * kLocationBits);
+		bits_ |= (uint64_t)(frame.count & 3) << kCountShift;
+		if(frame.white)
+			bits_ |= kWhiteBit;
+		
+		int nextId = frame.nextId < 0 ? 0 : (frame.nextId > 0xFFFF ? 0xFFFF : frame.nextId);
+		nextId_ = (uint16_t)nextId;
+		for(int i = 0; i < 3; i++) {
+			float size = frame.sizes[i] * 255.0f + 0.5f;
+			sizes_[i] = size <= 0 ? 0 : (size >= 255.0f ? 255 : (uint8_t)size);
+			if(frame.ids[i] < 0)
+				idOffsets_[i] = 0;
+			else {
+				int offset = nextId - frame.ids[i];
+				idOffsets_[i] = offset < 1 ? 1 : (offset > 255 ? 255 : (uint8_t)offset);
+			}
+		}
+	}
+	
+	// ***** Accessors *****
+	
+	int count() const { return (int)(bits_ >> kCountShift) & 3; }
+	float loc(int index) const { return unpackLocation(bits_ >> (index * kLocationBits)); }
+	float locH() const { return unpackLocation(bits_ >> (3 * kLocationBits)); }
+	float size(int index) const { return (float)sizes_[index] * (1.0f / 255.0f); }
+	int id(int index) const { return idOffsets_[index] == 0 ? -1 : (int)nextId_ - idOffsets_[index]; }
+	int nextId() const { return nextId_; }
+	bool white() const { return (bits_ & kWhiteBit) != 0; }
+	
+	// Unpack into a full frame
+	KeyTouchFrame expand() const {
+		KeyTouchFrame frame;
+		
+		frame.count = count();
+		for(int i = 0; i < 3; i++) {
+			frame.ids[i] = id(i);
+			frame.locs[i] = loc(i);
+			frame.sizes[i] = size(i);
+		}
+		frame.locH = locH();
+		frame.nextId = nextId();
+		frame.white = white();
+		return frame;
+	}
+	
+private:
+	static uint64_t packLocation(float location) {
+		if(location < 0)
+			return kLocationNone;
+		float scaled = location * (float)(1 << (kLocationBits - 1)) + 0.5f;
+		if(scaled >= (float)(kLocationNone - 1))
+			return kLocationNone - 1;
+		return (uint64_t)scaled;
+	}
+	static float unpackLocation(uint64_t bits) {
+		bits &= kLocationMask;
+		if(bits == kLocationNone)
+			return -1.0;
+		return (float)bits * (1.0f / (float)(1 << (kLocationBits - 1)));
+	}
+	
+	uint64_t bits_;			// locs[0..2] and locH at 14 bits each, then count (2 bits) and white
+	uint8_t sizes_[3];		// Contact areas scaled to 0-255
+	uint8_t idOffsets_[3];	// nextId minus each ID, or 0 for no ID
+	uint16_t nextId_;
+};
+
+// Touch history in a Node<KeyTouchFrame> is kept packed
+template<>
+struct NodeValueTraits<KeyTouchFrame> {
+	typedef PackedKeyTouchFrame stored_type;
+	typedef KeyTouchFrame const_reference;
+	
+	static PackedKeyTouchFrame pack(const KeyTouchFrame& frame) { return PackedKeyTouchFrame(frame); }
+	static KeyTouchFrame expand(const PackedKeyTouchFrame& stored) { return stored.expand(); }
+};
+
 #endif /* KEY_TOUCH_FRAME_H */
\ No newline at end of file
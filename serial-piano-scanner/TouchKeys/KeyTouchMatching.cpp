@@ -0,0 +1,78 @@
+/*
+  TouchKeys: multi-touch musical keyboard control software
+  Copyright (c) 2013 Andrew McPherson
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  =====================================================================
+
+  KeyTouchMatching.cpp: matching the touches in one frame to those in the next
+  when the number of touches on a key changes.
+*/
+
+#include <algorithm>
+#include <limits>
+#include "KeyTouchMatching.h"
+
+// Every ordering of three points, in lexicographic order. Rows 0 and 2 are also the
+// orderings of two points, and row 0 the only ordering of one.
+static const int kTouchMatchOrderings[6][3] = {
+	{0, 1, 2}, {0, 2, 1}, {1, 0, 2}, {1, 2, 0}, {2, 0, 1}, {2, 1, 0}
+};
+
+// Orderings are tried in lexicographic order and only a strictly smaller total replaces
+// the best so far, so ties go the same way as in the recursive search this replaces
+// (which Tests/TouchMatchTest.cpp keeps as a reference).
+//
+// Example: old points 1-3, new points A-C
+//   1A  *2A*  3A
+//  *1B*  2B   3B
+//   1C   2C  *3C*
+
+void touchMatchClosestPoints(const float* oldPoints, const float* newPoints, int count, int* ordering) {
+	if(count <= 0)
+		return;
+	if(count > 3)
+		count = 3;
+	
+	// Distances for every pairing, so each ordering is just a sum of lookups
+	float distances[3][3];
+	for(int oldIndex = 0; oldIndex < count; oldIndex++) {
+		for(int newIndex = 0; newIndex < count; newIndex++) {
+			if(oldPoints[oldIndex] >= 0.0 && newPoints[newIndex] >= 0.0)
+				distances[oldIndex][newIndex] = (oldPoints[oldIndex] - newPoints[newIndex])*(oldPoints[oldIndex] - newPoints[newIndex]);
+			else
+				distances[oldIndex][newIndex] = 100.0;
+		}
+	}
+	
+	int numOrderings = (count == 3) ? 6 : count;
+	int rowStep = (count == 2) ? 2 : 1;
+	int bestRow = 0;
+	float minVal = std::numeric_limits<float>::infinity();
+	
+	for(int i = 0; i < numOrderings; i++) {
+		const int *candidate = kTouchMatchOrderings[i * rowStep];
+		float total = 0.0;
+		
+		for(int oldIndex = 0; oldIndex < count; oldIndex++)
+			total += distances[oldIndex][candidate[oldIndex]];
+		if(total < minVal) {
+			minVal = total;
+			bestRow = i * rowStep;
+		}
+	}
+	
+	std::copy(kTouchMatchOrderings[bestRow], kTouchMatchOrderings[bestRow] + count, ordering);
+}
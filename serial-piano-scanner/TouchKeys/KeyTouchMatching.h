@@ -0,0 +1,34 @@
+/*
+  TouchKeys: multi-touch musical keyboard control software
+  Copyright (c) 2013 Andrew McPherson
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  =====================================================================
+
+  KeyTouchMatching.h: matching the touches in one frame to those in the next
+  when the number of touches on a key changes.
+*/
+
+#ifndef KEYCONTROL_KEY_TOUCH_MATCHING_H
+#define KEYCONTROL_KEY_TOUCH_MATCHING_H
+
+// Match old and new frames of touch locations, as PianoKey::touchInsertFrame() does when
+// the number of touches changes. The first count (at most 3) old points are each given a
+// different one of new points 0 to count-1, minimizing the total squared distance; a
+// pairing where either point is missing (negative) counts as 100. Sets ordering[i] to the
+// new point for old point i. Does not allocate.
+void touchMatchClosestPoints(const float* oldPoints, const float* newPoints, int count, int* ordering);
+
+#endif /* KEYCONTROL_KEY_TOUCH_MATCHING_H */
@@ -44,6 +44,7 @@ PianoKey::PianoKey(PianoKeyboard& keyboard, int noteNumber, int bufferLength)
   idleDetector_(kPianoKeyIdleBufferLength, positionBuffer_, kPianoKeyDefaultIdlePositionThreshold,
               kPianoKeyDefaultIdleActivityThreshold, kPianoKeyDefaultIdleCounter),
   positionTracker_(kPianoKeyPositionTrackerBufferLength, positionBuffer_),
+  positionPipeline_(idleDetector_, positionTracker_),
   stateBuffer_(kPianoKeyStateBufferLength), state_(kKeyStateToBeInitialized),
   touchSensorsArePresent_(true), touchIsActive_(false), 
   touchBuffer_(bufferLength), touchIsWaiting_(false), touchWaitingSource_(0),
@@ -53,6 +54,11 @@ PianoKey::PianoKey(PianoKeyboard& keyboard, int noteNumber, int bufferLength)
 {    
 	enable();
 	registerForTrigger(&idleDetector_);
+	
+	// The idle detector and position tracker are run directly from insertSample()
+	// rather than through triggers from positionBuffer_
+	idleDetector_.setTriggeredByInput(false);
+	positionTracker_.setTriggeredByInput(false);
 //            MIDIKeyPositionMapping *mapping = new MIDIKeyPositionMapping(keyboard_, noteNumber_, &touchBuffer_,
 //                                                                         &positionBuffer_, &positionTracker_);
 
@@ -70,12 +76,14 @@ PianoKey::PianoKey(PianoKeyboard& keyboard, int noteNumber, int bufferLength)
     touchkeyControlMapping1->setName("/touchkeys/ypos");
 
     touchkeysMapping_ = touchkeyControlMapping1;
-    keyboard_.addMapping(noteNumber_, touchkeysMapping_);
+    if(!keyboard_.addMapping(noteNumber_, touchkeysMapping_))
+        touchkeysMapping_ = 0;      // Deleted by the keyboard
 
 #else
     mrpMapping_ = new MRPMapping(keyboard_, NULL, noteNumber_, &touchBuffer_,
                                        &positionBuffer_, &positionTracker_);
-    keyboard_.addMapping(noteNumber_, mrpMapping_ );
+    if(!keyboard_.addMapping(noteNumber_, mrpMapping_))
+        mrpMapping_ = 0;            // Deleted by the keyboard
 #endif
 
 
@@ -83,18 +91,58 @@ PianoKey::PianoKey(PianoKeyboard& keyboard, int noteNumber, int bufferLength)
 
 // Destructor
 PianoKey::~PianoKey() {
-    // Remove any mappings we've created
-    //keyboard_.removeMapping(noteNumber_);
-
+    // Remove any mappings we've created. The keyboard deletes them, and may already
+    // have done so if it cleared its mappings before deleting the keys.
 #ifdef TOUCHKEYS_MAPPINGS
-	delete touchkeysMapping_;
+	if(touchkeysMapping_ != 0 && keyboard_.mapping(noteNumber_) == touchkeysMapping_)
+		keyboard_.removeMapping(noteNumber_);
 #else
-	delete mrpMapping_;
+	if(mrpMapping_ != 0 && keyboard_.mapping(noteNumber_) == mrpMapping_)
+		keyboard_.removeMapping(noteNumber_);
 #endif
 
 }
 
 
+// Resize the history buffers, then reset the key so that nothing refers to samples
+// in the old ones
+void PianoKey::setHistoryLengths(int positionLength, int touchLength, int aftertouchLength) {
+	ScopedLock sl(stateMutex_);
+	
+	terminateActivity();
+	positionBuffer_.setCapacity(positionLength);
+	touchBuffer_.setCapacity(touchLength);
+	midiAftertouch_.setCapacity(aftertouchLength);
+	reset();
+}
+
+// Add the memory used by this key's buffers to the totals in usage
+void PianoKey::addMemoryUsage(PianoKeyMemoryUsage& usage) {
+	usage.positionAllocated += positionBuffer_.allocatedBytes();
+	usage.positionUsed += positionBuffer_.usedBytes();
+	usage.touchAllocated += touchBuffer_.allocatedBytes();
+	usage.touchUsed += touchBuffer_.usedBytes();
+	usage.aftertouchAllocated += midiAftertouch_.allocatedBytes();
+	usage.aftertouchUsed += midiAftertouch_.usedBytes();
+	usage.otherAllocated += idleDetector_.allocatedBytes() + positionTracker_.allocatedBytes() +
+							stateBuffer_.allocatedBytes();
+	usage.otherUsed += idleDetector_.usedBytes() + positionTracker_.usedBytes() + stateBuffer_.usedBytes();
+}
+
+// Add this key's onset prediction results to the totals in statistics
+void PianoKey::addPredictionStatistics(KeyPositionTracker::PredictionStatistics& statistics) {
+	const KeyPositionTracker::PredictionStatistics& keyStatistics = positionTracker_.predictionStatistics();
+	
+	statistics.predictions += keyStatistics.predictions;
+	statistics.confirmed += keyStatistics.confirmed;
+	statistics.cancelled += keyStatistics.cancelled;
+	statistics.measured += keyStatistics.measured;
+	statistics.sumVelocityError += keyStatistics.sumVelocityError;
+	statistics.sumSquaredVelocityError += keyStatistics.sumSquaredVelocityError;
+	statistics.sumLeadTime += keyStatistics.sumLeadTime;
+	statistics.sumSquaredTimingError += keyStatistics.sumSquaredTimingError;
+}
+
 // Disable the key from sending events.  Do this by removing anything that
 // listens to its status.
 void PianoKey::disable() {
@@ -132,12 +180,14 @@ void PianoKey::reset() {
 	positionBuffer_.clear();	// Clear all history
 	stateBuffer_.clear();
 	idleDetector_.clear();
+	keyboard_.setKeyQuiescent(noteNumber_, false);
 	changeState(kKeyStateUnknown);	// Reinitialize with unknown state
 }
 
 // Insert a new sample in the key buffer
 void PianoKey::insertSample(key_position pos, timestamp_type ts) {
     positionBuffer_.insert(pos, ts);
+    positionPipeline_.process(ts);
 
 #ifdef KEY_POSITION_LOGGING
     // Insert key position into the log if key is active
@@ -167,6 +217,7 @@ void PianoKey::triggerReceived(TriggerSource* who, timestamp_type timestamp) {
 	
 	if(who == &idleDetector_) {
 //		std::cout << "Key " << noteNumber_ << ": IdleDetector says: " << idleDetector_.latest() << std::endl;
+		keyboard_.setKeyQuiescent(noteNumber_, idleDetector_.latest() == kIdleDetectorIdle);
 		
 		if(idleDetector_.latest() == kIdleDetectorIdle) {
             cout << "Key " << noteNumber_ << " --> Idle\n";
@@ -180,7 +231,8 @@ void PianoKey::triggerReceived(TriggerSource* who, timestamp_type timestamp) {
 #ifdef TOUCHKEYS_MAPPINGS
 //            touchkeysMapping_->disengage();
 #else
-            mrpMapping_->disengage();
+            if(mrpMapping_ != 0)
+                mrpMapping_->disengage();
 #endif
             
             positionTracker_.disengage();
@@ -212,7 +264,8 @@ void PianoKey::triggerReceived(TriggerSource* who, timestamp_type timestamp) {
 #ifdef TOUCHKEYS_MAPPINGS
 //            touchkeysMapping_->engage();
 #else
-            mrpMapping_->engage();
+            if(mrpMapping_ != 0)
+                mrpMapping_->engage();
 #endif
 //            mapping->setPercussivenessMIDIChannel(1);
 
@@ -486,7 +539,8 @@ void PianoKey::touchInsertFrame(KeyTouchFrame& newFrame, timestamp_type timestam
         keyboard_.tellAllMappingFactoriesTouchBegan(noteNumber_, midiNoteIsOn_, (idleDetector_.idleState() == kIdleDetectorActive),
                                                     &touchBuffer_, &positionBuffer_, &positionTracker_);
 #ifdef TOUCHKEYS_MAPPINGS
-            touchkeysMapping_->engage();
+            if(touchkeysMapping_ != 0)
+                touchkeysMapping_->engage();
 #else
 //            mrpMapping_->engage();
 #endif
@@ -512,11 +566,8 @@ void PianoKey::touchInsertFrame(KeyTouchFrame& newFrame, timestamp_type timestam
 			// One or more points have been added.  Match the new points to the old ones to figure out
 			// which points have been added, versus which moved from before.
 			
-			std::set<int> availableNewPoints;
-			for(int i = 0; i < newFrame.count; i++)
-				availableNewPoints.insert(i);
-			
-			std::list<int> ordering(touchMatchClosestPoints(lastFrame.locs, newFrame.locs, 3, 0, availableNewPoints, 0.0).second);
+			int ordering[3];
+			touchMatchClosestPoints(lastFrame.locs, newFrame.locs, newFrame.count, ordering);
 			
 			// ordering tells us the index of the new point corresponding to each old index,
 			// e.g. {2, 0, 1} --> old point 0 goes to new point 2, old point 1 goes to new point 0, ...
@@ -524,40 +575,36 @@ void PianoKey::touchInsertFrame(KeyTouchFrame& newFrame, timestamp_type timestam
 			// new points are still in ascending position order, so we use this matching to assign unique IDs
 			// and send relevant "add" messages
 			
-			int counter = 0;
-			for(std::list<int>::iterator it = ordering.begin(); it != ordering.end(); ++it) {
-				newFrame.ids[*it] = lastFrame.ids[counter];
+			for(int counter = 0; counter < newFrame.count; counter++) {
+				int newIndex = ordering[counter];
+				
+				newFrame.ids[newIndex] = lastFrame.ids[counter];
 				
-				if(newFrame.ids[*it] < 0) {
+				if(newFrame.ids[newIndex] < 0) {
 					// Matching to a negative ID means the touch is new
 					
-					newFrame.ids[*it] = newFrame.nextId++;
-					touchAdd(newFrame, *it, timestamp);
+					newFrame.ids[newIndex] = newFrame.nextId++;
+					touchAdd(newFrame, newIndex, timestamp);
 				}
 				else {
 #ifdef TOUCHKEYS_LEGACY_OSC
 					// Send "move" messages for the points that have moved
-                    if(fabsf(newFrame.locs[*it] - lastFrame.locs[counter]) > 0 /*moveThreshold_*/)
-						keyboard_.sendMessage("/touchkeys/move", "iiff", noteNumber_, newFrame.ids[*it],
-													 newFrame.locs[*it], newFrame.horizontal(*it), LO_ARGS_END);
-					if(fabsf(newFrame.sizes[*it] - lastFrame.sizes[counter]) > 0 /*resizeThreshold_*/)
-						keyboard_.sendMessage("/touchkeys/resize", "iif", noteNumber_, newFrame.ids[*it],
-													 newFrame.sizes[*it], LO_ARGS_END);
+                    if(fabsf(newFrame.locs[newIndex] - lastFrame.locs[counter]) > 0 /*moveThreshold_*/)
+						keyboard_.sendMessage("/touchkeys/move", "iiff", noteNumber_, newFrame.ids[newIndex],
+													 newFrame.locs[newIndex], newFrame.horizontal(newIndex), LO_ARGS_END);
+					if(fabsf(newFrame.sizes[newIndex] - lastFrame.sizes[counter]) > 0 /*resizeThreshold_*/)
+						keyboard_.sendMessage("/touchkeys/resize", "iif", noteNumber_, newFrame.ids[newIndex],
+													 newFrame.sizes[newIndex], LO_ARGS_END);
 #endif
 				}
-				
-				counter++;
 			}			
 		}
 		else if(newFrame.count < lastFrame.count) {
 			// One or more points have been removed.  Match the new points to the old ones to figure out
 			// which points have been removed, versus which moved from before.
 			
-			std::set<int> availableNewPoints;
-			for(int i = 0; i < 3; i++)		
-				availableNewPoints.insert(i);
-			
-			std::list<int> ordering(touchMatchClosestPoints(lastFrame.locs, newFrame.locs, 3, 0, availableNewPoints, 0.0).second);
+			int ordering[3];
+			touchMatchClosestPoints(lastFrame.locs, newFrame.locs, 3, ordering);
 			
 			// ordering tells us the index of the new point corresponding to each old index,
 			// e.g. {2, 0, 1} --> old point 0 goes to new point 2, old point 1 goes to new point 0, ...
@@ -565,29 +612,28 @@ void PianoKey::touchInsertFrame(KeyTouchFrame& newFrame, timestamp_type timestam
 			// new points are still in ascending position order, so we use this matching to assign unique IDs
 			// and send relevant "add" messages
 			
-			int counter = 0;
-			for(std::list<int>::iterator it = ordering.begin(); it != ordering.end(); ++it) {
-				if(*it < newFrame.count) {
+			for(int counter = 0; counter < 3; counter++) {
+				int newIndex = ordering[counter];
+				
+				if(newIndex < newFrame.count) {
 					// Old index {counter} matches a valid new touch
 					
-					newFrame.ids[*it] = lastFrame.ids[counter];	// Match IDs for currently active touches
+					newFrame.ids[newIndex] = lastFrame.ids[counter];	// Match IDs for currently active touches
 					
 #ifdef TOUCHKEYS_LEGACY_OSC
 					// Send "move" messages for the points that have moved
-					if(fabsf(newFrame.locs[*it] - lastFrame.locs[counter]) > 0 /*moveThreshold_*/)
-						keyboard_.sendMessage("/touchkeys/move", "iiff", noteNumber_, newFrame.ids[*it],
-													 newFrame.locs[*it], newFrame.horizontal(*it), LO_ARGS_END);
-					if(fabsf(newFrame.sizes[*it] - lastFrame.sizes[counter]) > 0 /*resizeThreshold_*/)
-						keyboard_.sendMessage("/touchkeys/resize", "iif", noteNumber_, newFrame.ids[*it],
-													 newFrame.sizes[*it], LO_ARGS_END);
+					if(fabsf(newFrame.locs[newIndex] - lastFrame.locs[counter]) > 0 /*moveThreshold_*/)
+						keyboard_.sendMessage("/touchkeys/move", "iiff", noteNumber_, newFrame.ids[newIndex],
+													 newFrame.locs[newIndex], newFrame.horizontal(newIndex), LO_ARGS_END);
+					if(fabsf(newFrame.sizes[newIndex] - lastFrame.sizes[counter]) > 0 /*resizeThreshold_*/)
+						keyboard_.sendMessage("/touchkeys/resize", "iif", noteNumber_, newFrame.ids[newIndex],
+													 newFrame.sizes[newIndex], LO_ARGS_END);
 #endif
 				}
 				else if(lastFrame.ids[counter] >= 0) {
 					// Old index {counter} matches an invalid new index, meaning a touch has been removed.
 					touchRemove(lastFrame, lastFrame.ids[counter], newFrame.count, timestamp);
 				}
-				
-				counter++;
 			}			
 		}
 		else {
@@ -652,7 +698,8 @@ void PianoKey::touchOff(timestamp_type timestamp) {
                                                &touchBuffer_, &positionBuffer_, &positionTracker_);
     
 #ifdef TOUCHKEYS_MAPPINGS
-            touchkeysMapping_->disengage();
+            if(touchkeysMapping_ != 0)
+                touchkeysMapping_->disengage();
 #else
 //            mrpMapping_->engage();
 #endif
@@ -692,84 +739,6 @@ timestamp_type PianoKey::touchTimedOut() {
     return 0;
 }
 
-// Recursive function for matching old and new frames of touch locations, each with up to (count) points
-//
-// Example: old points 1-3, new points A-C
-//   1A  *2A*  3A
-//  *1B*  2B   3B
-//   1C   2C  *3C*
-
-std::pair<float, std::list<int> > PianoKey::touchMatchClosestPoints(const float* oldPoints, const float *newPoints, float count,
-															   int oldIndex, std::set<int>& availableNewPoints, float currentTotalDistance) {
-	if(availableNewPoints.size() == 0)	// Shouldn't happen but prevent an infinite loop
-		throw new std::exception;
-	
-	// End case: only one possible point available
-	if(availableNewPoints.size() == 1) {
-		int newIndex = *(availableNewPoints.begin());
-		
-		std::list<int> singleOrder;
-		singleOrder.push_front(newIndex);
-		
-		if(oldPoints[oldIndex] < 0.0 || newPoints[newIndex] < 0.0) {
-			//if(verbose_ >= 4)
-			//	cout << " -> [" << newIndex << "] (" << currentTotalDistance + 100.0 << ")\n";
-			
-			// Return the distance between the last old point and the only available new point
-			return std::pair<float, std::list<int> > (currentTotalDistance + 100.0, singleOrder);			
-		}
-		else {
-			//if(verbose_ >= 4)
-			//	cout << " -> [" << newIndex << "] (" << currentTotalDistance + (oldPoints[oldIndex] - newPoints[newIndex])*(oldPoints[oldIndex] - newPoints[newIndex]) << ")\n";
-			
-			// Return the distance between the last old point and the only available new point
-			return std::pair<float, std::list<int> > (currentTotalDistance + (oldPoints[oldIndex] - newPoints[newIndex])*(oldPoints[oldIndex] - newPoints[newIndex]), singleOrder);
-		}
-	}
-	
-	float minVal = std::numeric_limits<float>::infinity();
-	std::set<int> newPointsCopy(availableNewPoints);
-	std::set<int>::iterator it;
-	std::list<int> order;
-	
-	// Go through all available new points
-	for(it = availableNewPoints.begin(); it != availableNewPoints.end(); ++it) {
-		// Temporarily remove (and test) one point and recursively call ourselves
-		newPointsCopy.erase(*it);
-		
-		float dist;
-		if(newPoints[*it] >= 0.0 && oldPoints[oldIndex] >= 0.0)
-			dist = (oldPoints[oldIndex] - newPoints[*it])*(oldPoints[oldIndex] - newPoints[*it]);
-		else
-			dist = 100.0;
-		
-		std::pair<float, std::list<int> > rval = touchMatchClosestPoints(oldPoints, newPoints, count, oldIndex + 1, newPointsCopy,
-														  currentTotalDistance + dist);
-		
-		//if(verbose_ >= 4)
-		//	cout << "     from " << *it << " got " << rval.first << endl;
-		
-		if(rval.first < minVal) {
-			minVal = rval.first;
-			order = rval.second;
-			order.push_front(*it);
-		}
-		
-		newPointsCopy.insert(*it);
-	}
-	
-	/*if(verbose_ >= 4) {
-		cout << " -> [";
-		list<int>::iterator it2;
-		
-		for(it2 = order.begin(); it2 != order.end(); ++it2)
-			cout << *it2 << ", ";
-		cout << "] (" << minVal << ")\n";
-	}*/
-	
-	return std::pair<float, std::list<int> >(minVal, order);
-}
-
 // A new touch was added from the last frame to this one
 
 void PianoKey::touchAdd(const KeyTouchFrame& frame, int index, timestamp_type timestamp) {
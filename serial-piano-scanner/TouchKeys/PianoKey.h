@@ -33,8 +33,10 @@
 #include "../Utility/Node.h"
 #include "PianoTypes.h"
 #include "KeyIdleDetector.h"
+#include "KeyPipeline.h"
 #include "KeyPositionTracker.h"
 #include "KeyTouchFrame.h"
+#include "KeyTouchMatching.h"
 //#include "MidiKeyboardSegment.h"
 #include "../Utility/Scheduler.h"
 #include "../Utility/IIRFilter.h"
@@ -73,6 +75,18 @@ enum {
 
 typedef int key_state;
 
+// Memory held by the history buffers of one or more keys, in bytes. For each buffer,
+// allocated is its full size and used is the part which has been written to.
+struct PianoKeyMemoryUsage {
+	PianoKeyMemoryUsage() : positionAllocated(0), positionUsed(0), touchAllocated(0), touchUsed(0),
+	  aftertouchAllocated(0), aftertouchUsed(0), otherAllocated(0), otherUsed(0) {}
+
+	size_t positionAllocated, positionUsed;		// Key position
+	size_t touchAllocated, touchUsed;			// Touch frames
+	size_t aftertouchAllocated, aftertouchUsed;	// MIDI aftertouch
+	size_t otherAllocated, otherUsed;			// Idle detector, position tracker and state
+};
+
 class PianoKeyboard;
 class MidiKeyboardSegment;
 
@@ -108,6 +122,17 @@ public:
 	
 	Node<key_position>& buffer() { return positionBuffer_; }
 	
+	// ***** Memory Methods *****
+	//
+	// Resize the history buffers: key position, touch frames and MIDI aftertouch. This
+	// resets the key as reset() does and frees the old buffers at once, so it should only
+	// be done before data starts streaming, while nothing else can be reading them.
+	
+	void setHistoryLengths(int positionLength, int touchLength, int aftertouchLength);
+	
+	// Add the memory used by this key's buffers to the totals in usage
+	void addMemoryUsage(PianoKeyMemoryUsage& usage);
+	
 	// ***** Control Methods *****
 	//
 	// Force changes in the key state (e.g. to resolve stuck notes)
@@ -124,6 +149,18 @@ public:
 	
 	void insertSample(key_position pos, timestamp_type ts);
 	
+	// While the key is quiescent (see PianoKeyboard::keyIsQuiescent()), samples below this
+	// position change nothing apart from the history kept of them
+	key_position quiescentThreshold() { return idleDetector_.idleThreshold(); }
+	
+	// Whether the position tracker sends provisional onsets before the key reaches the
+	// press position (see KeyPositionTracker::setPredictsOnset()). Set before data streams.
+	bool predictsOnset() { return positionTracker_.predictsOnset(); }
+	void setPredictsOnset(bool predicts) { positionTracker_.setPredictsOnset(predicts); }
+	
+	// Add how this key's onset predictions have turned out to the totals in statistics
+	void addPredictionStatistics(KeyPositionTracker::PredictionStatistics& statistics);
+	
 	// ***** Trigger Methods *****
 	//
 	// This will be called by positionBuffer_ on each new sample.  Examine each sample to see
@@ -169,8 +206,6 @@ private:
 	
 	// ***** Touch Methods (private) *****
 	
-	std::pair<float, std::list<int> > touchMatchClosestPoints(const float* oldPoints, const float *newPoints, float count,
-														 int oldIndex, std::set<int>& availableNewPoints, float currentTotalDistance); 
 	void touchAdd(const KeyTouchFrame& frame, int index, timestamp_type timestamp);
 	void touchRemove(const KeyTouchFrame& frame, int idRemoved, int remainingCount, timestamp_type timestamp);
 	void touchMultiFingerGestures(const KeyTouchFrame& lastFrame, const KeyTouchFrame& newFrame, timestamp_type timestamp);
@@ -206,9 +241,10 @@ private:
 	
 	// --- Data related to continuous key position ---
 
-	Node<key_position> positionBuffer_;     // Buffer that holds the key positions
+	SingleWriterNode<key_position> positionBuffer_;	// Buffer that holds the key positions; written only by the data thread
 	KeyIdleDetector idleDetector_;          // Detector for whether the key is still or moving
     KeyPositionTracker positionTracker_;    // Object to track the various active states of the key
+    KeyPositionPipeline positionPipeline_;  // Runs the idle detector and position tracker on each new sample
     timestamp_type timeOfLastGuiUpdate_;    // How long it's been since the last key position GUI call
     timestamp_type timeOfLastDebugPrint_;   // TESTING
     
@@ -222,7 +258,7 @@ private:
 
     bool touchSensorsArePresent_;                   // Whether touch sensitivity exists on this key
 	bool touchIsActive_;							// Whether the user is currently touching the key
-	Node<KeyTouchFrame> touchBuffer_;				// Buffer that holds touchkey frames
+	SingleWriterNode<KeyTouchFrame> touchBuffer_;	// Buffer that holds touchkey frames; written only by the data thread
 	std::multimap<int, KeyTouchEvent> touchEvents_;	// Mapping from touch number to event
 	bool touchIsWaiting_;							// Whether we're waiting for a touch to occur
     MidiKeyboardSegment *touchWaitingSource_;  // Who we're waiting from a touch for
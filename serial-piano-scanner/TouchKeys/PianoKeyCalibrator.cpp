@@ -21,52 +21,48 @@
 */
 
 #include "PianoKeyCalibrator.h"
+#include <sstream>
+#include <cmath>
 
 // Constructor
 PianoKeyCalibrator::PianoKeyCalibrator(bool pressValueGoesDown, key_position* warpTable)
 : status_(kPianoKeyNotCalibrated), prevStatus_(kPianoKeyNotCalibrated),
-  pressValueGoesDown_(pressValueGoesDown), history_(0), warpTable_(warpTable) {}
+  pressValueGoesDown_(pressValueGoesDown), history_(0), warpTable_(warpTable),
+  hasStoredWarp_(false), snapshot_(0), snapshotReaders_(0),
+  snapshotGeneration_(0), driftGeneration_(0),
+  driftSum_(0), driftCount_(0), driftAverage_(missing_value<int>::missing()) {}
 
 // Destructor
 PianoKeyCalibrator::~PianoKeyCalibrator() {
     if(history_ != 0)
         delete history_;
+    delete snapshot_.load();
     
 	// warpTable_ is passed in externally-- don't delete it
 }
 
-// Produce the calibrated value for a raw sample
+// Produce the calibrated value for a raw sample. Once calibrated, this uses the
+// published snapshot and takes no lock.
 key_position PianoKeyCalibrator::evaluate(int rawValue) {
-	key_position calibratedValue, calibratedValueDenominator;
+	{
+		SnapshotReader reader(*this);
+		
+		if(reader.snapshot != 0)
+			return reader.snapshot->evaluate(rawValue);
+	}
 
     ScopedLock sl(calibrationMutex_);
+	const CalibratedSnapshot *snapshot;
 	
 	switch(status_) {
 		case kPianoKeyCalibrated:
-			if(missing_value<int>::isMissing(quiescent_) ||
-			   missing_value<int>::isMissing(press_)) {
-				return missing_value<key_position>::missing();
-			}
-			
-			// Do the calculation either in integer or floating-point arithmetic
-			calibratedValueDenominator = (key_position)(press_ - quiescent_);
-			
-			// Prevent divide-by-0 errors
-			if(calibratedValueDenominator == 0)
-				calibratedValue = missing_value<key_position>::missing();
-			else {
-                // Scale the value and clip it to a sensible range (for badly calibrated sensors)
-				calibratedValue = (scale_key_position((rawValue - quiescent_))) / calibratedValueDenominator;
-                if(calibratedValue < -0.5)
-                    calibratedValue = -0.5;
-                if(calibratedValue > 1.2)
-                    calibratedValue = 1.2;
-            }
-			
-			if(warpTable_ != 0) {
-				// TODO: warping
-			}
-			return calibratedValue;
+			// The snapshot may have been published since we checked. It can't be
+			// replaced while we hold calibrationMutex_.
+			snapshot = snapshot_.load(std::memory_order_acquire);
+			if(snapshot != 0)
+				return snapshot->evaluate(rawValue);
+			// Otherwise quiescent_ or press_ is missing, or the range is 0
+			return missing_value<key_position>::missing();
 		case kPianoKeyInCalibration:
 			historyMutex_.enter();
 
@@ -103,6 +99,20 @@ key_position PianoKeyCalibrator::evaluate(int rawValue) {
 	}
 }
 
+// Return the offset and scale which evaluate() would apply to a raw value, so that
+// callers can calibrate a block of samples without calling evaluate() for each one.
+
+bool PianoKeyCalibrator::calibrationParameters(float& offset, float& scale) {
+	SnapshotReader reader(*this);
+
+	if(reader.snapshot == 0 || reader.snapshot->hasWarp)
+		return false;
+
+	offset = reader.snapshot->offset;
+	scale = reader.snapshot->scale;
+	return true;
+}
+
 // Begin the calibrating process.
 void PianoKeyCalibrator::calibrationStart() {
 	if(status_ == kPianoKeyInCalibration)	// Throw away the old results if we're already in progress
@@ -175,6 +185,8 @@ void PianoKeyCalibrator::calibrationClear() {
 		calibrationAbort();
     ScopedLock sl(calibrationMutex_);
 	status_ = prevStatus_ = kPianoKeyNotCalibrated;
+	hasStoredWarp_ = false;
+	publishSnapshot();
 }
 
 // Generate new quiescent values without changing the press values
@@ -187,6 +199,54 @@ void PianoKeyCalibrator::calibrationUpdateQuiescent() {
 	calibrationAbort();
 }
 
+// Add a raw value to the drift tracker. Only values near rest are counted, and
+// each full window leaves its average for calibrationCheckDrift(). Only called
+// from the data thread.
+void PianoKeyCalibrator::driftTrackerInsert(int rawValue) {
+	SnapshotReader reader(*this);
+	const CalibratedSnapshot *snapshot = reader.snapshot;
+
+	if(snapshot == 0)
+		return;
+	if(snapshot->generation != driftGeneration_) {
+		// Calibration changed: start a new window against the new values
+		driftGeneration_ = snapshot->generation;
+		driftSum_ = driftCount_ = 0;
+	}
+
+	float position = ((float)rawValue - snapshot->offset) * snapshot->scale;
+	if(fabsf(position) > kPianoKeyDriftRestBand * (float)scale_key_position(1))
+		return;
+
+	driftSum_ += rawValue;
+	if(++driftCount_ >= kPianoKeyDriftWindowLength) {
+		driftAverage_.store(driftSum_ / driftCount_, std::memory_order_release);
+		driftSum_ = driftCount_ = 0;
+	}
+}
+
+// Move the quiescent value to the latest rest average if it has drifted far enough
+bool PianoKeyCalibrator::calibrationCheckDrift() {
+	int average = driftAverage_.exchange(missing_value<int>::missing(), std::memory_order_acq_rel);
+
+	if(missing_value<int>::isMissing(average))
+		return false;
+
+	ScopedLock sl(calibrationMutex_);
+	if(status_ != kPianoKeyCalibrated)
+		return false;
+
+	int range = abs(press_ - quiescent_);
+	if((float)abs(average - quiescent_) < kPianoKeyDriftThreshold * (float)range)
+		return false;
+	if(abs(press_ - average) < kPianoKeyCalibrationMinimumRange)
+		return false;
+
+	quiescent_ = average;
+	publishSnapshot();
+	return true;
+}
+
 // Load calibration data from an XML string
 void PianoKeyCalibrator::loadFromXml(tinyxml2::XMLElement* baseElement) {
 	// Abort any calibration in progress and reset to default values
@@ -194,6 +254,7 @@ void PianoKeyCalibrator::loadFromXml(tinyxml2::XMLElement* baseElement) {
 		calibrationAbort();
 	calibrationClear();
 	
+    ScopedLock sl(calibrationMutex_);
 	tinyxml2::XMLElement *calibrationElement = baseElement->FirstChildElement("Calibration");
 	
 	if(calibrationElement != NULL) {
@@ -204,6 +265,17 @@ void PianoKeyCalibrator::loadFromXml(tinyxml2::XMLElement* baseElement) {
                 // Found both values: update our state accordingly
                 quiescent_ = quiescent;
                 press_ = press;
+                
+                // The warp table is optional; use it only if it is complete
+                tinyxml2::XMLElement *warpElement = calibrationElement->FirstChildElement("Warp");
+                if(warpElement != NULL && warpElement->GetText() != NULL) {
+                    std::istringstream warpStream(warpElement->GetText());
+                    int count = 0;
+                    
+                    while(count < kPianoKeyWarpTableLength && warpStream >> storedWarp_[count])
+                        count++;
+                    hasStoredWarp_ = (count == kPianoKeyWarpTableLength);
+                }
                 changeStatus(kPianoKeyCalibrated);
             }
         }
@@ -221,14 +293,108 @@ bool PianoKeyCalibrator::saveToXml(tinyxml2::XMLElement *baseElement) {
     newElement->SetAttribute("quiescent", quiescent_);
     newElement->SetAttribute("press", press_);
 
+    if(hasStoredWarp_) {
+        std::ostringstream warpStream;
+        
+        for(int i = 0; i < kPianoKeyWarpTableLength; i++) {
+            if(i > 0)
+                warpStream << " ";
+            warpStream << storedWarp_[i];
+        }
+        tinyxml2::XMLElement* warpElement = baseElement->GetDocument()->NewElement("Warp");
+        warpElement->SetText(warpStream.str().c_str());
+        newElement->InsertEndChild(warpElement);
+    }
+
     if(baseElement->InsertEndChild(newElement) == NULL)
         return false;
 
 	return true;
 }
 
+// Load calibration data from a binary record
+void PianoKeyCalibrator::loadFromRecord(const PianoKeyCalibrationRecord& record) {
+	// Abort any calibration in progress and reset to default values
+	if(status_ == kPianoKeyInCalibration)
+		calibrationAbort();
+	calibrationClear();
+
+	if(!(record.flags & kPianoKeyCalibrationRecordValid))
+		return;
+
+	ScopedLock sl(calibrationMutex_);
+	quiescent_ = record.quiescent;
+	press_ = record.press;
+	if(record.flags & kPianoKeyCalibrationRecordHasWarp) {
+		for(int i = 0; i < kPianoKeyWarpTableLength; i++)
+			storedWarp_[i] = record.warp[i];
+		hasStoredWarp_ = true;
+	}
+	changeStatus(kPianoKeyCalibrated);
+}
+
+// Save calibration data to a binary record. Returns true if valid data was saved.
+bool PianoKeyCalibrator::saveToRecord(PianoKeyCalibrationRecord& record) {
+	ScopedLock sl(calibrationMutex_);
+
+	record.quiescent = 0;
+	record.press = 0;
+	record.flags = 0;
+	for(int i = 0; i < kPianoKeyWarpTableLength; i++)
+		record.warp[i] = hasStoredWarp_ ? storedWarp_[i] : 0.0f;
+
+	if(status_ != kPianoKeyCalibrated)
+		return false;
+
+	record.quiescent = quiescent_;
+	record.press = press_;
+	record.flags = kPianoKeyCalibrationRecordValid;
+	if(hasStoredWarp_)
+		record.flags |= kPianoKeyCalibrationRecordHasWarp;
+	return true;
+}
+
 // ***** Internal Methods *****
 
+// Build a new snapshot from the current calibration and make it visible to
+// evaluate(). Must be called with calibrationMutex_ held.
+void PianoKeyCalibrator::publishSnapshot() {
+    CalibratedSnapshot *snapshot = 0;
+
+    if(status_ == kPianoKeyCalibrated &&
+       !missing_value<int>::isMissing(quiescent_) &&
+       !missing_value<int>::isMissing(press_) &&
+       press_ != quiescent_) {
+        snapshot = new CalibratedSnapshot;
+        snapshot->offset = (float)quiescent_;
+        snapshot->scale = (float)scale_key_position(1) / (float)(press_ - quiescent_);
+        snapshot->minimum = kPianoKeyCalibratedMinimum;
+        snapshot->maximum = kPianoKeyCalibratedMaximum;
+        snapshot->hasWarp = (warpTable_ != 0 || hasStoredWarp_);
+        for(int i = 0; i < kPianoKeyWarpTableLength; i++) {
+            if(warpTable_ != 0)
+                snapshot->warpTable[i] = (float)warpTable_[i];
+            else if(hasStoredWarp_)
+                snapshot->warpTable[i] = storedWarp_[i];
+            else
+                snapshot->warpTable[i] = (float)i / (float)(kPianoKeyWarpTableLength - 1);
+        }
+        snapshot->generation = ++snapshotGeneration_;
+    }
+
+    // Readers that got the old snapshot registered before loading it, so once the
+    // count has been seen at 0 after the exchange, nobody can still be using it
+    const CalibratedSnapshot *old = snapshot_.exchange(snapshot);
+    if(old != 0) {
+        while(snapshotReaders_.load() != 0)
+            usleep(1);
+        delete old;
+    }
+
+    // Any pending drift measurement was made against the old calibration
+    driftAverage_.store(missing_value<int>::missing(), std::memory_order_release);
+}
+
 // Internal method to clean up after a calibration session.
 void PianoKeyCalibrator::cleanup() {
     ScopedLock sl(historyMutex_);
@@ -25,6 +25,9 @@
 #define KEYCONTROL_PIANO_KEY_CALIBRATOR_H
 
 #include <iostream>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
 #include <boost/circular_buffer.hpp>
 #include "../Utility/Xml.h"
 //#include "../JuceLibraryCode/JuceHeader.h"
@@ -45,6 +48,36 @@ const size_t kPianoKeyCalibrationPressLength = 10; // 10
 // Minimum amount of range between quiescent and press for a note to be calibrated
 const int kPianoKeyCalibrationMinimumRange = 64;
 
+// Range calibrated values are clipped to (for badly calibrated sensors)
+const float kPianoKeyCalibratedMinimum = -0.5;
+const float kPianoKeyCalibratedMaximum = 1.2;
+
+// Number of points in a warp table, evenly spaced over calibrated positions 0 to 1
+const int kPianoKeyWarpTableLength = 33;
+
+// Drift tracking: while calibrated, raw values within kPianoKeyDriftRestBand of rest
+// are averaged over windows of kPianoKeyDriftWindowLength samples. When the average
+// moves more than kPianoKeyDriftThreshold from the quiescent value, the quiescent value
+// follows it. Both are fractions of the key's travel.
+const float kPianoKeyDriftRestBand = 0.1;
+const float kPianoKeyDriftThreshold = 0.02;
+const int kPianoKeyDriftWindowLength = 256;
+
+// Fixed-size calibration data for one key, as stored in binary calibration files
+// (see CalibrationFile.h). Layout must not change without changing the file version.
+
+enum {
+	kPianoKeyCalibrationRecordValid = 0x01,	// quiescent and press hold a calibration
+	kPianoKeyCalibrationRecordHasWarp = 0x02	// warp holds a stored warp table
+};
+
+struct PianoKeyCalibrationRecord {
+	int32_t quiescent;
+	int32_t press;
+	uint32_t flags;
+	float warp[kPianoKeyWarpTableLength];
+};
+
 /*
  * PianoKeyboardCalibrator
  *
@@ -56,7 +89,48 @@ const int kPianoKeyCalibrationMinimumRange = 64;
 
 class PianoKeyCalibrator {
 public:
+	// Everything needed to turn a raw value into a calibrated one, precomputed when
+	// the calibration changes. Snapshots are never modified once published, so
+	// evaluate() can use one without taking any lock.
+	class CalibratedSnapshot {
+	public:
+		key_position evaluate(int rawValue) const {
+			float position = ((float)rawValue - offset) * scale;
+
+			if(position < minimum)
+				position = minimum;
+			if(position > maximum)
+				position = maximum;
+			if(hasWarp)
+				position = warp(position);
+			return (key_position)position;
+		}
+
+		// Piecewise-linear lookup in the warp table, indexed in 16.16 fixed point;
+		// values outside 0-1 are unchanged
+		float warp(float position) const {
+			if(position <= 0.0f || position >= 1.0f)
+				return position;
+			int index = (int)(position * (float)((kPianoKeyWarpTableLength - 1) << 16));
+			int lower = index >> 16;
+			float fraction = (float)(index & 0xFFFF) * (1.0f / 65536.0f);
+			return warpTable[lower] + fraction * (warpTable[lower + 1] - warpTable[lower]);
+		}
+
+		float offset;		// Quiescent value
+		float scale;		// Reciprocal of the range from quiescent to press
+		float minimum, maximum;	// Clipping range for the result
+		bool hasWarp;		// Whether warpTable holds valid data
+		float warpTable[kPianoKeyWarpTableLength];
+		unsigned int generation;	// Counts up with each snapshot published
+	};
+
 	// ***** Constructor *****
+	//
+	// warpTable, if not 0, holds kPianoKeyWarpTableLength points correcting for sensor
+	// non-linearity; it is copied on use and remains owned by the caller. Otherwise
+	// a table measured against a position reference can be stored with the calibration
+	// (the <Warp> element, or the warp field of a binary record).
 	
 	PianoKeyCalibrator(bool pressValueGoesDown, key_position* warpTable);
 	
@@ -71,6 +145,12 @@ public:
 	// the settings for calibration.
 	
 	key_position evaluate(int rawValue);
+
+	// For applying the calibration to many samples at once: when calibrated, the
+	// calibrated value is (raw - offset) * scale, clipped to the range above. Returns
+	// false if evaluate() has to be called instead (not calibrated, or calibrating).
+
+	bool calibrationParameters(float& offset, float& scale);
 	
 	// ***** Calibration Methods *****
 	//
@@ -89,6 +169,16 @@ public:
 	
 	void calibrationUpdateQuiescent();
 	
+	// ***** Drift Tracking *****
+	//
+	// driftTrackerInsert() is called from the data thread with raw values and never blocks.
+	// calibrationCheckDrift() is called periodically from another thread and moves the
+	// quiescent value to follow the key at rest, without taking the key out of calibration
+	// the way calibrationUpdateQuiescent() does. Returns true if the quiescent value changed.
+	
+	void driftTrackerInsert(int rawValue);
+	bool calibrationCheckDrift();
+	
 	// ***** XML I/O Methods *****
 	//
 	// These methods load and save calibration data from an XML string.  The PianoKeyCalibrator object handles
@@ -97,14 +187,42 @@ public:
 	void loadFromXml(tinyxml2::XMLElement* baseElement);
 	bool saveToXml(tinyxml2::XMLElement* baseElement);
 	
+	// ***** Binary I/O Methods *****
+	//
+	// Equivalent to the above using a fixed-size record, for binary calibration files.
+	// saveToRecord() always fills in the record, and returns true if it holds valid data.
+	
+	void loadFromRecord(const PianoKeyCalibrationRecord& record);
+	bool saveToRecord(PianoKeyCalibrationRecord& record);
+	
 private:
 	// ***** Helper Methods *****
 	
 	void changeStatus(int newStatus) {
 		prevStatus_ = status_;
 		status_ = newStatus;
+		publishSnapshot();
 	}
 	
+	// Rebuild the calibrated snapshot from the current state; call with calibrationMutex_ held.
+	// Waits for any SnapshotReader still using the old snapshot before freeing it.
+	void publishSnapshot();
+	
+	// Holds on to the current snapshot (which may be 0) for as long as it is in scope.
+	// Only a count of readers is kept, so this costs two atomic operations.
+	class SnapshotReader {
+	public:
+		SnapshotReader(PianoKeyCalibrator& calibrator) : readers_(calibrator.snapshotReaders_) {
+			readers_.fetch_add(1);
+			snapshot = calibrator.snapshot_.load();
+		}
+		~SnapshotReader() { readers_.fetch_sub(1, std::memory_order_release); }
+		
+		const CalibratedSnapshot *snapshot;
+	private:
+		std::atomic<int>& readers_;
+	};
+	
 	// Update quiescent values
 	bool internalUpdateQuiescent();
 	
@@ -126,6 +244,23 @@ private:
 	
 	// Table of warping values to correct for sensor non-linearity
 	key_position* warpTable_;
+	
+	// Warp table loaded with the calibration, used when none is passed in
+	bool hasStoredWarp_;
+	float storedWarp_[kPianoKeyWarpTableLength];
+	
+	// Current snapshot used by evaluate(); 0 unless calibrated. Read through a
+	// SnapshotReader outside calibrationMutex_, so that a replaced snapshot is only
+	// freed once nobody is using it.
+	std::atomic<const CalibratedSnapshot*> snapshot_;
+	std::atomic<int> snapshotReaders_;
+	unsigned int snapshotGeneration_;
+	
+	// Drift tracking. The sums belong to the data thread; completed window averages are
+	// passed to calibrationCheckDrift() through driftAverage_ (missing if none).
+	unsigned int driftGeneration_;	// Generation of the snapshot the current window was measured against
+	int driftSum_, driftCount_;
+	std::atomic<int> driftAverage_;
     
 	CriticalSection calibrationMutex_;	// This mutex protects access to the entire calibration structure
 	CriticalSection historyMutex_;		// This mutex is specifically tied to the history_ buffers
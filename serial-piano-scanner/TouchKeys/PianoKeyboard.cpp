@@ -27,16 +27,19 @@
 #include "TouchkeyDevice.h"
 #include "../Utility/CriticalSection.h"
 #include "../Mappings/Mapping.h"
+#include "../Mappings/MRPMapping.h"
 #include "MidiKeyboardSegment.h"
 #include "MidiOutputController.h"
 #include "../Mappings/MappingFactory.h"
 #include "../Mappings/MappingScheduler.h"
 #include <string>
+#include <cmath>
 
 // Constructor
 PianoKeyboard::PianoKeyboard() 
-: midiOutputController_(0),
-  oscTransmitter_(0), touchkeyDevice_(0),
+: keyPositionHistoryLength_(kDefaultKeyHistoryLength), keyTouchHistoryLength_(kDefaultKeyTouchHistoryLength),
+  keyAftertouchHistoryLength_(kDefaultKeyAftertouchHistoryLength),
+  midiOutputController_(0), oscTransmitter_(0), touchkeyDevice_(0),
   lowestMidiNote_(0), highestMidiNote_(0), numberOfPedals_(0),
   isInitialized_(false), isRunning_(false), isCalibrated_(false), calibrationInProgress_(false)
 {
@@ -45,12 +48,17 @@ PianoKeyboard::PianoKeyboard()
 	keyPositionLog_.open(logFilename, ios::out | ios::binary);
 	keyPositionLog_.seekp(0);
 
+	quiescentKeys_[0] = quiescentKeys_[1] = 0;
+	for(int i = 0; i < MappingTable<Mapping>::kNumNotes; i++)
+		mrpMappings_[i] = 0;
+
 	// Start a thread by which we can schedule future events
 	futureEventScheduler_.start(0);
 
-	// Build the key list
+	// Build the key list. Keys start out small and get their full history once
+	// we know they are present.
 	for(int i = 0; i <= 127; i++)
-	  keys_.push_back(new PianoKey(*this, i, kDefaultKeyHistoryLength));
+	  keys_.push_back(new PianoKey(*this, i, kAbsentKeyHistoryLength));
 
 	mappingScheduler_ = new MappingScheduler(*this);
 	mappingScheduler_->start();
@@ -111,6 +119,89 @@ void PianoKeyboard::setKeyboardGUIRange(int lowest, int highest) {
 //		gui_->setKeyboardRange(lowestMidiNote_, highestMidiNote_);
 }
 
+// Set which keys have sensors, resizing the history of any key that changes
+void PianoKeyboard::setKeysPresent(std::set<int> const& notes) {
+	for(int i = 0; i <= 127; i++) {
+		bool present = (notes.count(i) != 0);
+		if(present == keysPresent_[i])
+			continue;
+		if(present)
+			keys_[i]->setHistoryLengths(keyPositionHistoryLength_, keyTouchHistoryLength_, keyAftertouchHistoryLength_);
+		else
+			keys_[i]->setHistoryLengths(kAbsentKeyHistoryLength, kAbsentKeyHistoryLength, kAbsentKeyHistoryLength);
+		keysPresent_[i] = present;
+	}
+}
+
+// Record whether a key's idle detector has it at rest. Called from the key on the data thread,
+// or when the key is reset.
+void PianoKeyboard::setKeyQuiescent(int note, bool quiescent) {
+	if(note < 0 || note > 127)
+		return;
+	uint64_t bit = (uint64_t)1 << (note & 63);
+	if(quiescent)
+		quiescentKeys_[note >> 6].fetch_or(bit, std::memory_order_relaxed);
+	else
+		quiescentKeys_[note >> 6].fetch_and(~bit, std::memory_order_relaxed);
+}
+
+// Set the history lengths for present keys, and apply them to the keys already present
+void PianoKeyboard::setKeyHistoryLengths(int positionLength, int touchLength, int aftertouchLength) {
+	keyPositionHistoryLength_ = positionLength;
+	keyTouchHistoryLength_ = touchLength;
+	keyAftertouchHistoryLength_ = aftertouchLength;
+	
+	for(int i = 0; i <= 127; i++) {
+		if(keysPresent_[i])
+			keys_[i]->setHistoryLengths(keyPositionHistoryLength_, keyTouchHistoryLength_, keyAftertouchHistoryLength_);
+	}
+}
+
+// Turn onset prediction on or off for every key
+void PianoKeyboard::setKeysPredictOnset(bool predicts) {
+	for(std::vector<PianoKey*>::iterator it = keys_.begin(); it != keys_.end(); ++it)
+		(*it)->setPredictsOnset(predicts);
+}
+
+// Print the onset prediction statistics summed over all keys: how many predictions were
+// confirmed or cancelled, the relative error in the predicted velocity, and how far ahead
+// of the measured velocity they came (in timestamp units)
+void PianoKeyboard::printPredictionReport() {
+	KeyPositionTracker::PredictionStatistics stats = {0, 0, 0, 0, 0, 0, 0, 0};
+	
+	for(std::vector<PianoKey*>::iterator it = keys_.begin(); it != keys_.end(); ++it)
+		(*it)->addPredictionStatistics(stats);
+	
+	cout << "Onset prediction: " << stats.predictions << " predictions, " << stats.confirmed << " confirmed, "
+		 << stats.cancelled << " cancelled\n";
+	if(stats.measured > 0)
+		cout << "  velocity error: mean " << stats.sumVelocityError / stats.measured
+			 << ", rms " << sqrt(stats.sumSquaredVelocityError / stats.measured) << "\n";
+	if(stats.confirmed > 0)
+		cout << "  lead: mean " << stats.sumLeadTime / stats.confirmed
+			 << ", rms timing error " << sqrt(stats.sumSquaredTimingError / stats.confirmed) << "\n";
+}
+
+// Print the memory taken by each kind of key history, allocated and actually written to
+void PianoKeyboard::printMemoryReport() {
+	PianoKeyMemoryUsage usage;
+	
+	for(std::vector<PianoKey*>::iterator it = keys_.begin(); it != keys_.end(); ++it)
+		(*it)->addMemoryUsage(usage);
+	
+	size_t totalAllocated = usage.positionAllocated + usage.touchAllocated + usage.aftertouchAllocated + usage.otherAllocated;
+	size_t totalUsed = usage.positionUsed + usage.touchUsed + usage.aftertouchUsed + usage.otherUsed;
+	
+	cout << "Key history memory (" << keysPresent_.count() << " of " << keys_.size() << " keys present; "
+		 << keyPositionHistoryLength_ << "/" << keyTouchHistoryLength_ << "/" << keyAftertouchHistoryLength_
+		 << " samples of position/touch/aftertouch):\n";
+	cout << "  position:   " << usage.positionAllocated / 1024 << " kB allocated, " << usage.positionUsed / 1024 << " kB used\n";
+	cout << "  touch:      " << usage.touchAllocated / 1024 << " kB allocated, " << usage.touchUsed / 1024 << " kB used\n";
+	cout << "  aftertouch: " << usage.aftertouchAllocated / 1024 << " kB allocated, " << usage.aftertouchUsed / 1024 << " kB used\n";
+	cout << "  other:      " << usage.otherAllocated / 1024 << " kB allocated, " << usage.otherUsed / 1024 << " kB used\n";
+	cout << "  total:      " << totalAllocated / 1024 << " kB allocated, " << totalUsed / 1024 << " kB used\n";
+}
+
 // Send a message by OSC (and potentially by other means depending on who's listening)
 
 void PianoKeyboard::sendMessage(const char * path, const char * type, ...) {
@@ -212,51 +303,47 @@ void PianoKeyboard::setAllKeyLEDsOff() {
 
 // ***** Mapping Methods *****
 
-// Add a new mapping identified by a MIDI note and an owner
-void PianoKeyboard::addMapping(int noteNumber, Mapping* mapping) {
+// Add a new mapping identified by a MIDI note. If the note can't hold a mapping,
+// the mapping is disengaged and deleted and false is returned.
+bool PianoKeyboard::addMapping(int noteNumber, Mapping* mapping) {
+    if(mapping == 0)
+        return false;
     removeMapping(noteNumber);  // Free any mapping that's already present on this note
-    mappings_[noteNumber] = mapping;
+    if(!mappings_.insert(noteNumber, mapping)) {
+        std::cerr << "PianoKeyboard: can't add a mapping on note " << noteNumber << std::endl;
+        mapping->disengage();
+        delete mapping;
+        return false;
+    }
+    return true;
 }
 
-// Remove an existing mapping identified by owner
+// Add an MRPMapping, which neighbouring MRPMappings can then find without a cast
+bool PianoKeyboard::addMapping(int noteNumber, MRPMapping* mapping) {
+    if(!addMapping(noteNumber, static_cast<Mapping*>(mapping)))
+        return false;
+    mrpMappings_[noteNumber] = mapping;
+    return true;
+}
+
+// Remove an existing mapping identified by MIDI note
 void PianoKeyboard::removeMapping(int noteNumber) {
-    if(mappings_.count(noteNumber) == 0)
+    Mapping* mapping = mappings_.release(noteNumber);
+    if(mapping == 0)
         return;
-    Mapping* mapping = mappings_[noteNumber];
+    mrpMappings_[noteNumber] = 0;
     delete mapping;
-    mappings_.erase(noteNumber);
-}
-
-// Return a specific mapping by owner and note number
-Mapping* PianoKeyboard::mapping(int noteNumber) {
-    if(mappings_.count(noteNumber) == 0)
-        return 0;
-    return mappings_[noteNumber];
 }
 
-// Return a list of all MIDI notes with active mappings. Some may have more than
-// one but we only want the list of active notes
+// Return a list of all MIDI notes with active mappings
 std::vector<int> PianoKeyboard::activeMappings() {
-    std::vector<int> keys;
-    std::map<int, Mapping*>::iterator it = mappings_.begin();
-    while(it != mappings_.end()) {
-        int nextKey = (it++)->first;
-        keys.push_back(nextKey);
-    }
-    return keys;
+    return mappings_.notes();
 }
 
 void PianoKeyboard::clearMappings() {
-    std::map<int, Mapping*>::iterator it = mappings_.begin();
-    
-    while(it != mappings_.end()) {
-        // Delete everybody in the container
-        Mapping *mapping = it->second;
-        delete mapping;
-    }
-    
-    // Now clear the container
-    mappings_.clear();
+    // Delete everybody in the container
+    for(int note = 0; note < MappingTable<Mapping>::kNumNotes && !mappings_.empty(); note++)
+        removeMapping(note);
 }
 
 // Mapping factory methods: tell each registered factory about these events if it listens to this particular note
@@ -29,6 +29,10 @@
 #include <iostream>
 #include <fstream>
 #include <map>
+#include <set>
+#include <bitset>
+#include <atomic>
+#include <stdint.h>
 #include "../Utility/Types.h"
 #include "../Utility/Node.h"
 #include "PianoKey.h"
@@ -38,6 +42,7 @@
 #include "Osc.h"
 #include "../Utility/Scheduler.h"
 #include "../Utility/CriticalSection.h"
+#include "../Mappings/MappingTable.h"
 //#include "../JuceLibraryCode/JuceHeader.h"
 
 #define NUM_KEYS 88
@@ -50,11 +55,17 @@ enum {							// Index of each pedal in the buffers
 	kNumPedals
 };
 
-const int kDefaultKeyHistoryLength = 8192;
+// History kept for each key, in samples. Keys which have no sensor get the much shorter
+// kAbsentKeyHistoryLength until the device reports them present (see setKeysPresent()).
+const int kDefaultKeyHistoryLength = 8192;				// Key position
+const int kDefaultKeyTouchHistoryLength = 8192;			// Touch frames
+const int kDefaultKeyAftertouchHistoryLength = 256;		// MIDI aftertouch
+const int kAbsentKeyHistoryLength = 16;
 const int kDefaultPedalHistoryLength = 1024;
 
 class TouchkeyDevice;
 class Mapping;
+class MRPMapping;
 class MidiOutputController;
 class MappingFactory;
 class MidiKeyboardSegment;
@@ -152,6 +163,37 @@ public:
             return 0;
         return keys_[note];
 	}
+	
+	// Which keys have sensors, by MIDI note. Keys get their full history buffers when they
+	// become present and give them up when they stop being present. The old buffers are
+	// freed at once, so only call this before data starts streaming.
+	void setKeysPresent(std::set<int> const& notes);
+	bool keyIsPresent(int note) { return note >= 0 && note <= 127 && keysPresent_[note]; }
+	
+	// Keys whose idle detector has found them at rest, by MIDI note. While a key is quiescent,
+	// samples below its PianoKey::quiescentThreshold() make no difference to it, so the
+	// device can leave them out rather than run the key's whole processing chain on them.
+	void setKeyQuiescent(int note, bool quiescent);
+	bool keyIsQuiescent(int note) {
+		if(note < 0 || note > 127)
+			return false;
+		return (quiescentKeys_[note >> 6].load(std::memory_order_relaxed) >> (note & 63)) & 1;
+	}
+	
+	// How many samples of history present keys keep for key position, touch frames and
+	// MIDI aftertouch. Changing these resets the present keys, so like setKeysPresent()
+	// it should only be done before data starts streaming.
+	void setKeyHistoryLengths(int positionLength, int touchLength, int aftertouchLength);
+	
+	// Print how much memory the keys' history buffers take up
+	void printMemoryReport();
+	
+	// Whether keys predict their press onsets from the position data, so that mappings
+	// can start notes early (see KeyPositionTracker::setPredictsOnset()). Off by default.
+	void setKeysPredictOnset(bool predicts);
+	
+	// Print how the onset predictions have turned out, over all keys
+	void printPredictionReport();
 //	PianoPedal* pedal(int pedal) {
 //		if(pedal < 0 || pedal >= numberOfPedals_)
 //			return 0;
@@ -178,11 +220,18 @@ public:
     void setAllKeyLEDsOff();
     
     // ***** Mapping Methods *****
-    // Mappings are identified by the MIDI note they affect and by
-    // their owner object.
-    void addMapping(int noteNumber, Mapping* mapping);    // Add a new mapping to the container
+    // Mappings are identified by the MIDI note they affect, one per note.
+    // Notes outside 0-127 never have a mapping.
+    // A mapping that can't be added is disengaged and deleted, and false returned.
+    bool addMapping(int noteNumber, Mapping* mapping);    // Add a new mapping to the container
+    bool addMapping(int noteNumber, MRPMapping* mapping); // Same, also making it available from mrpMapping()
     void removeMapping(int noteNumber);                  // Remove a mapping from the container
-    Mapping* mapping(int noteNumber);                    // Look up a mapping with the given note and owner
+    Mapping* mapping(int noteNumber) { return mappings_.get(noteNumber); }
+    MRPMapping* mrpMapping(int noteNumber) {             // The mapping on this note if it is an MRPMapping, or 0
+        if(noteNumber < 0 || noteNumber >= MappingTable<Mapping>::kNumNotes)
+            return 0;
+        return mrpMappings_[noteNumber];
+    }
     std::vector<int> activeMappings();                   // Return a list of all active note mappings
     void clearMappings();                                // Remove all mappings
     
@@ -239,6 +288,11 @@ public:
 private:
 	// Individual key and pedal data structures
 	std::vector<PianoKey*> keys_;
+	std::bitset<128> keysPresent_;				// Which keys have full history buffers
+	std::atomic<uint64_t> quiescentKeys_[2];	// Bit per MIDI note, see keyIsQuiescent()
+	int keyPositionHistoryLength_;				// History lengths for present keys
+	int keyTouchHistoryLength_;
+	int keyAftertouchHistoryLength_;
 //	std::vector<PianoPedal*> pedals_;
 //
 //	// Reference to GUI display (if present)
@@ -275,7 +329,8 @@ private:
 	Scheduler futureEventScheduler_;
     
     // Data related to mappings for active notes
-    std::map<int, Mapping*> mappings_;            // Mappings from key motion to sound
+    MappingTable<Mapping> mappings_;              // Mappings from key motion to sound
+    MRPMapping* mrpMappings_[MappingTable<Mapping>::kNumNotes];  // The same mappings where they are MRPMappings
     
     // Collection of mapping factories organised by segment of the keyboard. Different
     // segments may have different mappings
@@ -0,0 +1,69 @@
+/*
+  TouchKeys: multi-touch musical keyboard control software
+  Copyright (c) 2013 Andrew McPherson
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  =====================================================================
+
+  TouchkeyCentroidDecoder.h: unpacks the touch positions and sizes of one key
+  from a centroid frame.
+*/
+
+#ifndef TOUCHKEY_CENTROID_DECODER_H
+#define TOUCHKEY_CENTROID_DECODER_H
+
+const float kSizeMaxValue = 255.0;
+const float kSizeScale = 1.0 / kSizeMaxValue;
+
+// Unpacks the centroid data for one key into positions and sizes of up to three
+// touches plus the horizontal position. Returns the number of active touches.
+typedef int (*CentroidDecoder)(const unsigned char *buffer, const float scaleY,
+		const float scaleH, float *position, float *size, float *positionH);
+
+// Unpack the centroid data for one key. Positions are packed as 12-bit values:
+// the high nibbles of the first and second touch share byte 0, the third touch and
+// the horizontal position share byte 3. 0x0FFF means no touch. Sizes follow the
+// packed positions at sizeOffset. Specialized per hardware/key colour layout so the
+// layout decisions are made once, when the decoder is chosen.
+
+template<bool hasHorizontal, int sizeOffset>
+inline int decodeKeyCentroid(const unsigned char *buffer, const float scaleY,
+		const float scaleH, float *position, float *size, float *positionH)
+{
+	int raw[3];
+	int touchCount = 0;
+
+	raw[0] = ((buffer[0] & 0xF0) << 4) + buffer[1];
+	raw[1] = ((buffer[0] & 0x0F) << 8) + buffer[2];
+	raw[2] = ((buffer[3] & 0xF0) << 4) + buffer[4];
+
+	for (int i = 0; i < 3; i++) {
+		bool touched = (raw[i] != 0x0FFF);
+
+		position[i] = touched ? (float) raw[i] * scaleY : -1.0f;
+		size[i] = touched ? (float) buffer[i + sizeOffset] * kSizeScale : 0.0f;
+		touchCount += touched;
+	}
+
+	if (hasHorizontal) {
+		int rawH = ((buffer[3] & 0x0F) << 8) + buffer[5];
+		*positionH = (rawH != 0x0FFF) ? (float) rawH * scaleH : -1.0f;
+	} else
+		*positionH = -1.0;
+
+	return touchCount;
+}
+
+#endif /* TOUCHKEY_CENTROID_DECODER_H */
@@ -21,12 +21,16 @@
  */
 
 #include "TouchkeyDevice.h"
+#include "CalibrationFile.h"
 
 #include <iomanip>
+#include <algorithm>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include "../Utility/Time.h"
+#include <boost/bind.hpp>
 
 #include <termios.h>
 #include <errno.h>
@@ -52,7 +56,10 @@ TouchkeyDevice::TouchkeyDevice(PianoKeyboard& keyboard) :
 				kTransmissionLengthBlackNewHardware), deviceHasRGBLEDs_(false), isCalibrated_(
 				false), calibrationInProgress_(false), keyCalibrators_(0), keyCalibratorsLength_(
 				0), ioThread_(runLoop()), rawDataThread_(rawDataRunLoop()), ledThread_(
-				ledUpdateLoop())
+				ledUpdateLoop()), processThread_(processLoop()), frameQueue_(
+				kFrameQueueLength), currentReadTime_(0), currentFrameArrivalTime_(
+				0), framesDroppedReported_(0), driftCheckThread_(
+				driftCheckLoop()), driftCheckEnabled_(false)
 {
 	// Tell the piano keyboard class how to call us back
 	keyboard_.setTouchkeyDevice(this);
@@ -65,11 +72,44 @@ TouchkeyDevice::TouchkeyDevice(PianoKeyboard& keyboard) :
 	timestampSynchronizer_.setNominalSampleInterval(.001);
 	timestampSynchronizer_.setFrameModulus(65536);
 
-	for (int i = 0; i < 4; i++)
+	for (int i = 0; i < 4; i++) {
 		analogLastFrame_[i] = 0;
+		analogHistory_[i].frames = 0;
+		for (int key = 0; key < kAnalogValuesPerFrame; key++)
+			analogHistory_[i].inserted[key] = 0;
+	}
+
+	// Until the device reports otherwise, assume current sensor hardware
+	whiteMaxX_ = kWhiteMaxXValueNewHardware;
+	whiteMaxY_ = kWhiteMaxYValueNewHardware;
+	blackMaxX_ = kBlackMaxXValueNewHardware;
+	blackMaxY_ = kBlackMaxYValueNewHardware;
+	centroidLayoutInit();
 
 	logFileCreated_ = false;
 	loggingActive_ = false;
+
+	// Self-pipe used to wake the I/O threads when gathering stops. Both ends are
+	// non-blocking so that signalling never stalls the caller.
+	if (pipe(wakeupPipe_) == 0) {
+		fcntl(wakeupPipe_[0], F_SETFL, fcntl(wakeupPipe_[0], F_GETFL) | O_NONBLOCK);
+		fcntl(wakeupPipe_[1], F_SETFL, fcntl(wakeupPipe_[1], F_GETFL) | O_NONBLOCK);
+	} else {
+		wakeupPipe_[0] = wakeupPipe_[1] = -1;
+		if (verbose_ >= 1)
+			cout << "Warning: unable to create wakeup pipe (error " << errno
+					<< ").  Threads will stop on timeout.\n";
+	}
+
+	sem_init(&frameQueueSemaphore_, 0, 0);
+
+#ifdef DEBUG_SERIAL_LATENCY
+	for (int i = 0; i < kLatencyHistogramBins; i++)
+		latencyHistogram_[i] = 0;
+	latencyMaxMicroseconds_ = 0;
+	for (int i = 0; i < kLatencySources; i++)
+		latencyBaselineValid_[i] = false;
+#endif
 }
 
 bool TouchkeyDevice::checkIfDevicePresent(int millisecondsToWait)
@@ -256,6 +296,7 @@ bool TouchkeyDevice::checkIfDevicePresent(int millisecondsToWait)
 								blackMaxX_ = 1.0; // irrelevant -- no X data
 								blackMaxY_ = kBlackMaxYValueOldHardware;
 							}
+							centroidLayoutInit();
 
 							// Software version indicates what information is available. On version
 							// 2 and greater, can indicate which is lowest sensor available. Might
@@ -279,6 +320,7 @@ bool TouchkeyDevice::checkIfDevicePresent(int millisecondsToWait)
 									lowestKeyPresentMidiNote_,
 									lowestMidiNote_ + 12 * numOctaves_
 											+ lowestNotePerOctave_);
+							updateKeysPresent();
 							calibrationInit(12 * numOctaves_ + 1); // One more for the top C
 						} else {
 							if (verbose_ >= 1)
@@ -388,13 +430,27 @@ bool TouchkeyDevice::startAutoGathering()
 		return true;
 	shouldStop_ = false;
 	ledShouldStop_ = false;
+	deviceWakeupClear();
+
+	// No threads are running, so the queue can safely be reset from here
+	frameQueue_.clear();
+	frameQueue_.resetOverflows();
+	framesDroppedReported_ = 0;
+	while (sem_trywait(&frameQueueSemaphore_) == 0)
+		;
+
+	// Likewise the key history buffers, in case the octave changed while running
+	updateKeysPresent();
 
 	if (verbose_ >= 1)
 		cout << "Starting auto centroid collection\n";
 
 	// TODO: Start the data input and LED threads. Test Adapter!
+	processThread_.startThread(this);
 	ioThread_.startThread(this);
 	ledThread_.startThread(this);
+	if (driftCheckEnabled_)
+		driftCheckThread_.startThread(this);
 	autoGathering_ = true;
 
 	// Tell the device to start scanning for new data
@@ -437,9 +493,12 @@ void TouchkeyDevice::stopAutoGathering(bool writeStopCommandToDevice)
 		}
 	}
 
-	// Setting this to true tells the run loop to exit what it's doing
+	// Setting this to true tells the run loop to exit what it's doing, and the
+	// wakeup signal interrupts it if it is waiting for data
 	shouldStop_ = true;
 	ledShouldStop_ = true;
+	deviceWakeupSignal();
+	sem_post(&frameQueueSemaphore_);
 
 	if (verbose_ >= 1)
 		cout << "Stopping auto centroid collection\n";
@@ -455,6 +514,16 @@ void TouchkeyDevice::stopAutoGathering(bool writeStopCommandToDevice)
 	if (rawDataThread_.getThreadId() != juniper::getCurrentThreadId())
 		if (rawDataThread_.isThreadRunning())
 			rawDataThread_.stopThread(3000);
+	if (processThread_.getThreadId() != juniper::getCurrentThreadId())
+		if (processThread_.isThreadRunning())
+			processThread_.stopThread(3000);
+	if (driftCheckThread_.getThreadId() != juniper::getCurrentThreadId())
+		if (driftCheckThread_.isThreadRunning())
+			driftCheckThread_.stopThread(3000);
+
+	if (frameQueue_.overflows() > 0 && verbose_ >= 1)
+		cout << "Warning: " << frameQueue_.overflows()
+				<< " frames dropped because processing fell behind\n";
 
 	// Stop any currently playing notes
 	keyboard_.sendMessage("/allnotesoff", "", LO_ARGS_END);
@@ -476,6 +545,10 @@ void TouchkeyDevice::stopAutoGathering(bool writeStopCommandToDevice)
 	if (verbose_ >= 2)
 		cout << "...done.\n";
 
+#ifdef DEBUG_SERIAL_LATENCY
+	latencyHistogramPrint();
+#endif
+
 	autoGathering_ = false;
 }
 
@@ -772,53 +845,24 @@ bool TouchkeyDevice::calibrationSaveToFile(std::string const& filename)
 //
 //	return true;
 
-	int i;
-
 	if(!isCalibrated()) {
 		std::cerr << "TouchKeys not calibrated, so can't save calibration data.\n";
 		return false;
 	}
 
-	// Create an XML structure and save it to file.
-	try {
-		tinyxml2::XMLDocument doc;
-
-		tinyxml2::XMLElement* baseElement = doc.NewElement("TouchkeyDeviceCalibration");
-//		tinyxml2::XMLElement baseElement("TouchkeyDeviceCalibration");
-		bool savedValidData = false;
-
-		for(i = 0; i < keyCalibratorsLength_; i++) {
-			tinyxml2::XMLElement* calibratorElement = doc.NewElement("Key");
-//			tinyxml2::XMLElement calibratorElement("Key");
-			calibratorElement->SetAttribute("id", i);
-
-			// Tell each individual calibrator to add its data to the XML tree
-			if(keyCalibrators_[i]->saveToXml(calibratorElement)) {
-				baseElement->InsertEndChild(calibratorElement);
-				savedValidData = true;
-			}
-		}
-
-		if(!savedValidData) {
-			std::cerr << "TouchkeyDevice: unable to find valid calibration data to save.\n";
-			throw 1;
-		}
-
-		// Now save the generated tree to a file
-
-		doc.InsertEndChild(baseElement);
-		if(!doc.SaveFile(filename.c_str())) {
-			std::cerr << "TouchkeyDevice: could not write calibration file " << filename << "\n";
-			throw 1;
-		}
+	//lastCalibrationFile_ = filename;
+	return CalibrationFile::saveXml(filename, keyCalibrators_, keyCalibratorsLength_);
+}
 
-		//lastCalibrationFile_ = filename;
-	}
-	catch(...) {
+// Save calibration data to a compact binary file, which loads faster than XML
+bool TouchkeyDevice::calibrationSaveToBinaryFile(std::string const& filename)
+{
+	if(!isCalibrated()) {
+		std::cerr << "TouchKeys not calibrated, so can't save calibration data.\n";
 		return false;
 	}
 
-	return true;
+	return CalibrationFile::saveBinary(filename, keyCalibrators_, keyCalibratorsLength_);
 }
 
 // TODO: calibrationLoadFromFile()
@@ -885,55 +929,28 @@ bool TouchkeyDevice::calibrationLoadFromFile(std::string const& filename)
 
 	calibrationClear();
 
-	// Open the file and read the new values
-	try {
-		tinyxml2::XMLDocument doc;
-		tinyxml2::XMLElement *baseElement, *calibratorElement;
-
-		tinyxml2::XMLError ret = doc.LoadFile(filename.c_str());
-		if(ret != tinyxml2::XML_SUCCESS) {
-			std::cerr << "TouchkeyDevice: unable to load patch table file: \"" << filename << "\". Error was:\n";
-			std::cerr << doc.ErrorStr() << " (Line " << doc.ErrorLineNum() << ")\n";
-			throw 1;
-		}
-
-		// All calibration data is encapsulated within the root element <PianoBarCalibration>
-		baseElement = doc.FirstChildElement("TouchkeyDeviceCalibration");
-		if(baseElement == NULL) {
-			std::cerr << "TouchkeyDevice: malformed calibration file, aborting.\n";
-			throw 1;
-		}
-
-		// Go through and find each key's calibration information
-		calibratorElement = baseElement->FirstChildElement("Key");
-		if(calibratorElement == NULL) {
-			std::cerr << "TouchkeyDevice: warning: no keys found\n";
-		}
-		else {
-			while(calibratorElement != NULL) {
-				int keyId;
-
-				if(calibratorElement->QueryIntAttribute("id", &keyId) == tinyxml2::XML_SUCCESS) {
-					if(keyId >= 0 && keyId < keyCalibratorsLength_)
-						keyCalibrators_[keyId]->loadFromXml(calibratorElement);
-				}
-				calibratorElement = calibratorElement->NextSiblingElement("Key");
-			}
-		}
-
-        calibrationInProgress_ = false;
-        isCalibrated_ = true;
-		//lastCalibrationFile_ = filename;
-	}
-	catch(...) {
+	// Either format is accepted; binary files are recognised by their header
+	if(!CalibrationFile::load(filename, keyCalibrators_, keyCalibratorsLength_))
 		return false;
-	}
+
+	calibrationInProgress_ = false;
+	isCalibrated_ = true;
+	//lastCalibrationFile_ = filename;
 
 	// TODO: reset key states?
 
 	return true;
 }
 
+// Enable or disable the background drift check. If data is already being
+// gathered, the check starts right away; otherwise it starts with gathering.
+void TouchkeyDevice::calibrationDriftCheckSetEnabled(bool enable)
+{
+	driftCheckEnabled_ = enable;
+	if (enable && autoGathering_ && !driftCheckThread_.isThreadRunning())
+		driftCheckThread_.startThread(this);
+}
+
 // Initialize the calibrators
 void TouchkeyDevice::calibrationInit(int numberOfCalibrators)
 {
@@ -982,9 +999,11 @@ void TouchkeyDevice::setLowestMidiNote(int note)
 	else {
 		lowestKeyPresentMidiNote_ += (note - lowestMidiNote_);
 		lowestMidiNote_ = updatedLowestMidiNote_ = note;
-		if (isOpen())
+		if (isOpen()) {
 			keyboard_.setKeyboardGUIRange(lowestKeyPresentMidiNote_,
 					lowestMidiNote_ + 12 * numOctaves_ + lowestNotePerOctave_);
+			updateKeysPresent();
+		}
 	}
 }
 
@@ -1161,19 +1180,16 @@ bool TouchkeyDevice::isOpen()
 void* TouchkeyDevice::runLoopFunction(Thread* thread)
 {
 	unsigned char buffer[1024];							// Raw data from device
-	unsigned char frame[TOUCHKEY_MAX_FRAME_LENGTH];	// Accumulated frame of data
-	int frameLength;
-	bool controlSeq = false;
-	bool inFrame = false;
-//	bool frameError = false;
+	TouchkeyFrameDecoder decoder(
+			boost::bind(&TouchkeyDevice::decodedFrame, this, _1, _2), verbose_);
 
 	/* struct timeval currentTime;
 	 unsigned long long currentTicks = 0, lastTicks = 0;
 	 int currentNote = 21;*/
 
-	// Continuously read from the input device.  Read as much data as is available, up to
-	// 1024 bytes at a time.  If no data is available, wait 0.5ms before trying again.  USB
-	// data comes in every 1ms, so this guarantees no more than a 1ms wait for data, and often less.
+	// Continuously read from the input device.  Block in poll() until data is available,
+	// then read as much as is there, up to 1024 bytes at a time.  stopAutoGathering()
+	// wakes us through the wakeup pipe, so there is no need to sleep between reads.
 	while (!shouldStop_ && !thread->threadShouldExit()) {
 
 		/*
@@ -1192,12 +1208,21 @@ void* TouchkeyDevice::runLoopFunction(Thread* thread)
 		 rgbledSetColorHSV(currentNote, (float)(currentNote - 21)/(float)(highestMidiNote() - 21), 1.0, 1.0);
 		 }
 		 */
-		long count = deviceRead((char *) buffer, 1024);
+		int ready = deviceWaitForData(kDeviceWaitTimeoutMilliseconds);
 
-		if (count == 0) {
-			usleep(500);
+		if (ready == 0)
+			continue;
+		if (ready < 0) {
+			if (verbose_ >= 1)
+				cout << "Unable to poll device (error " << errno
+						<< ").  Aborting.\n";
+			stopAutoGathering(false);
 			continue;
 		}
+		long count = deviceRead((char *) buffer, 1024);
+
+		if (count == 0)
+			continue;
 		if (count < 0) {
 			if (errno != EAGAIN) {	// EAGAIN just means no data was available
 				if (verbose_ >= 1)
@@ -1206,79 +1231,12 @@ void* TouchkeyDevice::runLoopFunction(Thread* thread)
 				stopAutoGathering(false);
 				//shouldStop_ = true;
 			}
-
-			usleep(500);
 			continue;
 		}
 
-		// Process the received data
-
-		for (int i = 0; i < count; i++) {
-			unsigned char ch = buffer[i];
-
-			if (inFrame) {
-				// Receiving a frame
-
-				if (controlSeq) {
-					controlSeq = false;
-					if (ch == kControlCharacterFrameEnd) {	// frame finished?
-						inFrame = false;
-						processFrame(frame, frameLength);
-					} else if (ch == kControlCharacterFrameError) { // device telling us about an internal comm error
-						if (verbose_ >= 1)
-							cout
-									<< "Warning: received frame error, continuing anyway.\n";
-//						frameError = true;
-					} else if (ch == ESCAPE_CHARACTER) { // double-escape means a literal escape character
-						frame[frameLength++] = ch;
-						if (frameLength >= TOUCHKEY_MAX_FRAME_LENGTH) {
-							inFrame = false;
-							if (verbose_ >= 1)
-								cout
-										<< "Warning: ignoring frame exceeding length limit "
-										<< (int) TOUCHKEY_MAX_FRAME_LENGTH
-										<< endl;
-						}
-					} else if (ch == kControlCharacterNak && verbose_ >= 1) {
-						// TODO: pass this on to a checkForAck() call
-						cout
-								<< "Warning: received NAK (while receiving frame)\n";
-					}
-				} else {
-					if (ch == ESCAPE_CHARACTER)
-						controlSeq = true;
-					else {
-						frame[frameLength++] = ch;
-						if (frameLength >= TOUCHKEY_MAX_FRAME_LENGTH) {
-							inFrame = false;
-							if (verbose_ >= 1)
-								cout
-										<< "Warning: ignoring frame exceeding length limit "
-										<< (int) TOUCHKEY_MAX_FRAME_LENGTH
-										<< endl;
-						}
-					}
-				}
-			} else {
-				// Waiting for a frame beginning control sequence
-
-				if (controlSeq) {
-					controlSeq = false;
-					if (ch == kControlCharacterFrameBegin) {
-						inFrame = true;
-						frameLength = 0;
-//						frameError = false;
-					} else if (ch == kControlCharacterNak && verbose_ >= 1) {
-						// TODO: pass this on to a checkForAck() call
-						cout
-								<< "Warning: received NAK (while waiting for frame)\n";
-					}
-				} else {
-					if (ch == ESCAPE_CHARACTER)
-						controlSeq = true;
-				}
-			}
-		}
+		// Split the received data into frames and queue them for processing
+		currentReadTime_ = Time::getMillisecondCounterHiRes();
+		decoder.decode(buffer, count);
 	}
 
 	return NULL;
@@ -1289,11 +1247,8 @@ void* TouchkeyDevice::runLoopFunction(Thread* thread)
 void* TouchkeyDevice::rawDataRunLoopFunction(Thread* thread)
 {
 	unsigned char buffer[1024];							// Raw data from device
-	unsigned char frame[TOUCHKEY_MAX_FRAME_LENGTH];	// Accumulated frame of data
-	int frameLength;
-	bool controlSeq = false;
-	bool inFrame = false;
-//	bool frameError = false;
+	TouchkeyFrameDecoder decoder(
+			boost::bind(&TouchkeyDevice::decodedFrame, this, _1, _2), verbose_);
 
 	unsigned char gatherDataCommand[] = { ESCAPE_CHARACTER,
 			kControlCharacterFrameBegin, kFrameTypeSendI2CCommand,
@@ -1306,12 +1261,11 @@ void* TouchkeyDevice::rawDataRunLoopFunction(Thread* thread)
 	double lastTime = 0;
 	//unsigned long long currentTicks = 0, lastTicks = 0;
 
-	// Continuously read from the input device.  Read as much data as is available, up to
-	// 1024 bytes at a time.  If no data is available, wait 0.5ms before trying again.  USB
-	// data comes in every 1ms, so this guarantees no more than a 1ms wait for data, and often less.
+	// Continuously read from the input device.  Block in poll() until data is available
+	// or the next data request is due, then read as much as is there, up to 1024 bytes.
 
 	while (!shouldStop_ && !thread->threadShouldExit()) {
-		// Every 100ms, request raw data from the active key
+		// Every 50ms, request raw data from the active key
 		double currentTime = Time::getMillisecondCounterHiRes();
 
 		if (currentTime - lastTime > 50.0) {
@@ -1336,12 +1290,26 @@ void* TouchkeyDevice::rawDataRunLoopFunction(Thread* thread)
 			}
 		}
 
-		long count = deviceRead((char *) buffer, 1024);
+		// Wait no longer than the time until the next request
+		int rawDataWaitTime = (int) (lastTime + 50.0 - currentTime) + 1;
+		if (rawDataWaitTime < 1)
+			rawDataWaitTime = 1;
 
-		if (count == 0) {
-			usleep(500);
+		int ready = deviceWaitForData(rawDataWaitTime);
+
+		if (ready == 0)
+			continue;
+		if (ready < 0) {
+			if (verbose_ >= 1)
+				cout << "Unable to poll device (error " << errno
+						<< ").  Aborting.\n";
+			stopAutoGathering(false);
 			continue;
 		}
+		long count = deviceRead((char *) buffer, 1024);
+
+		if (count == 0)
+			continue;
 		if (count < 0) {
 			if (errno != EAGAIN) {	// EAGAIN just means no data was available
 				if (verbose_ >= 1)
@@ -1350,78 +1318,98 @@ void* TouchkeyDevice::rawDataRunLoopFunction(Thread* thread)
 				stopAutoGathering(false);
 				//shouldStop_ = true;
 			}
+			continue;
+		}
 
-			usleep(500);
+		// Split the received data into frames and queue them for processing
+		currentReadTime_ = Time::getMillisecondCounterHiRes();
+		decoder.decode(buffer, count);
+	}
+
+	return NULL;
+}
+
+// Called by the frame decoder in the I/O threads for every complete frame.
+// Frames are only copied into the queue here; parsing them (and everything
+// downstream: key tracking, mappings, OSC) happens in processLoopFunction()
+// so that slow processing can never hold up reading from the device.
+void TouchkeyDevice::decodedFrame(unsigned char * const frame, int length)
+{
+	ReceivedFrame *slot = frameQueue_.writeSlot();
+
+	if (slot == 0)		// Queue full: the frame is dropped and counted
+		return;
+
+	slot->arrivalTime = currentReadTime_;
+	slot->length = length;
+	memcpy(slot->data, frame, length);
+	frameQueue_.commitWrite();
+	sem_post(&frameQueueSemaphore_);
+}
+
+// Wait for the reader to queue a frame, up to the given timeout
+void TouchkeyDevice::frameQueueWait(int timeoutMilliseconds)
+{
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeoutMilliseconds / 1000;
+	deadline.tv_nsec += (timeoutMilliseconds % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	sem_timedwait(&frameQueueSemaphore_, &deadline);
+}
+
+// Processing run loop: parses the frames queued by the I/O threads
+void* TouchkeyDevice::processLoopFunction(Thread* thread)
+{
+	while (!shouldStop_ && !thread->threadShouldExit()) {
+		ReceivedFrame *received = frameQueue_.readSlot();
+
+		if (received == 0) {
+			frameQueueWait(kDeviceWaitTimeoutMilliseconds);
 			continue;
 		}
 
-		// Process the received data
-
-		for (int i = 0; i < count; i++) {
-			unsigned char ch = buffer[i];
-
-			if (inFrame) {
-				// Receiving a frame
-
-				if (controlSeq) {
-					controlSeq = false;
-					if (ch == kControlCharacterFrameEnd) {	// frame finished?
-						inFrame = false;
-						processFrame(frame, frameLength);
-					} else if (ch == kControlCharacterFrameError) { // device telling us about an internal comm error
-						if (verbose_ >= 1)
-							cout
-									<< "Warning: received frame error, continuing anyway.\n";
-//						frameError = true;
-					} else if (ch == ESCAPE_CHARACTER) { // double-escape means a literal escape character
-						frame[frameLength++] = ch;
-						if (frameLength >= TOUCHKEY_MAX_FRAME_LENGTH) {
-							inFrame = false;
-							if (verbose_ >= 1)
-								cout
-										<< "Warning: ignoring frame exceeding length limit "
-										<< (int) TOUCHKEY_MAX_FRAME_LENGTH
-										<< endl;
-						}
-					} else if (ch == kControlCharacterNak && verbose_ >= 1) {
-						// TODO: pass this on to a checkForAck() call
-						cout
-								<< "Warning: received NAK (while receiving frame)\n";
-					}
-				} else {
-					if (ch == ESCAPE_CHARACTER)
-						controlSeq = true;
-					else {
-						frame[frameLength++] = ch;
-						if (frameLength >= TOUCHKEY_MAX_FRAME_LENGTH) {
-							inFrame = false;
-							if (verbose_ >= 1)
-								cout
-										<< "Warning: ignoring frame exceeding length limit "
-										<< (int) TOUCHKEY_MAX_FRAME_LENGTH
-										<< endl;
-						}
-					}
-				}
-			} else {
-				// Waiting for a frame beginning control sequence
-
-				if (controlSeq) {
-					controlSeq = false;
-					if (ch == kControlCharacterFrameBegin) {
-						inFrame = true;
-						frameLength = 0;
-//						frameError = false;
-					} else if (ch == kControlCharacterNak && verbose_ >= 1) {
-						// TODO: pass this on to a checkForAck() call
-						cout
-								<< "Warning: received NAK (while waiting for frame)\n";
-					}
-				} else {
-					if (ch == ESCAPE_CHARACTER)
-						controlSeq = true;
-				}
-			}
+		currentFrameArrivalTime_ = received->arrivalTime;
+		processFrame(received->data, received->length);
+		frameQueue_.commitRead();
+
+		// Report newly dropped frames from here rather than from the reader
+		unsigned long dropped = frameQueue_.overflows();
+		if (dropped != framesDroppedReported_) {
+			if (verbose_ >= 1)
+				cout << "Warning: processing fell behind, "
+						<< dropped - framesDroppedReported_
+						<< " frames dropped\n";
+			framesDroppedReported_ = dropped;
+		}
+	}
+
+	return NULL;
+}
+
+// Drift check run loop: every few seconds, give each calibrated key the chance to
+// move its quiescent value to where the key now rests. The data itself is gathered
+// by the calibrators as analog frames arrive, so keys stay in calibration throughout
+// and only the keys which have actually drifted are changed.
+void* TouchkeyDevice::driftCheckLoopFunction(Thread* thread)
+{
+	while (!shouldStop_ && driftCheckEnabled_ && !thread->threadShouldExit()) {
+		for (int waited = 0; waited < kCalibrationDriftCheckIntervalMilliseconds
+				&& !shouldStop_ && driftCheckEnabled_; waited += kDeviceWaitTimeoutMilliseconds)
+			usleep(kDeviceWaitTimeoutMilliseconds * 1000);
+
+		if (shouldStop_ || !driftCheckEnabled_)
+			break;
+		if (!isCalibrated_ || calibrationInProgress_)
+			continue;
+
+		for (int i = 0; i < keyCalibratorsLength_; i++) {
+			if (keyCalibrators_[i]->calibrationCheckDrift() && verbose_ >= 2)
+				cout << "Updated quiescent value for key " << i << " after drift\n";
 		}
 	}
 
@@ -1506,6 +1494,9 @@ void TouchkeyDevice::processCentroidFrame(unsigned char * const buffer,
 		if (verbose_ >= 3)
 			cout << "Centroid frame octave " << octave << " timestamp " << frame
 					<< endl;
+#ifdef DEBUG_SERIAL_LATENCY
+		latencyHistogramRecord(0, (unsigned int) frame);
+#endif
 	} else {
 		frame = (buffer[0] << 8) + buffer[1]; // First two bytes give us the timestamp in milliseconds (mod 2^16)
 		octave = buffer[2];	// Third byte tells us which octave of keys is being addressed
@@ -1555,6 +1546,8 @@ void TouchkeyDevice::processCentroidFrame(unsigned char * const buffer,
 				if (keyboard_.key(i)->touchIsActive())
 					keyboard_.key(i)->touchOff(lastTimestamp_);
 
+		// The key history buffers follow on the next startAutoGathering(), since
+		// they can't be resized while data is streaming
 		keyboard_.setKeyboardGUIRange(lowestKeyPresentMidiNote_,
 				lowestMidiNote_ + 12 * numOctaves_ + lowestNotePerOctave_);
 	}
@@ -1591,6 +1584,45 @@ void TouchkeyDevice::processRawDataFrame(unsigned char * const buffer,
 //	lo_blob_free(b);
 }
 
+// Choose the centroid decoder for each key in the octave. Version 2 sensor
+// hardware always sends an H value; earlier hardware only has one on white keys,
+// and its black keys have the sizes one byte earlier.
+
+void TouchkeyDevice::centroidLayoutInit()
+{
+	for (int key = 0; key < 13; key++) {
+		CentroidLayout& layout = centroidLayout_[key];
+
+		if (kKeyColor[key] == kKeyColorWhite) {
+			layout.decode = &decodeKeyCentroid<true, 6>;
+			layout.scaleY = 1.0 / whiteMaxY_;
+			layout.length = expectedLengthWhite_;
+		} else {
+			if (deviceHardwareVersion_ >= 2)
+				layout.decode = &decodeKeyCentroid<true, 6>;
+			else
+				layout.decode = &decodeKeyCentroid<false, 5>;
+			layout.scaleY = 1.0 / blackMaxY_;
+			layout.length = expectedLengthBlack_;
+		}
+	}
+
+	centroidScaleH_ = 1.0 / whiteMaxX_;
+}
+
+// The keys present move with the lowest MIDI note, so this is called whenever
+// either changes while not running, and before running starts. Keys are only given
+// their history buffers while no data is streaming.
+
+void TouchkeyDevice::updateKeysPresent()
+{
+	std::set<int> notes;
+
+	for (set<int>::iterator it = keysPresent_.begin(); it != keysPresent_.end(); ++it)
+		notes.insert(octaveKeyToMidi(indexToOctave(*it), indexToNote(*it)));
+	keyboard_.setKeysPresent(notes);
+}
+
 // Extract the floating-point centroid data for a key from packed character input.
 // Send OSC features as appropriate
 
@@ -1620,7 +1652,7 @@ int TouchkeyDevice::processKeyCentroid(int frame, int octave, int key,
 			cout << "Warning: octave " << octave << " key " << key
 					<< " data is not ready.  Check scan rate.\n";
 		if (deviceSoftwareVersion_ >= 1)
-			return white ? expectedLengthWhite_ : expectedLengthBlack_;
+			return centroidLayout_[key].length;
 		else
 			return 1;
 	}
@@ -1638,90 +1670,19 @@ int TouchkeyDevice::processKeyCentroid(int frame, int octave, int key,
 					<< timestamp << "): ff\n";
 		}
 	} else {
-		bytesParsed = white ? expectedLengthWhite_ : expectedLengthBlack_;
+		const CentroidLayout& layout = centroidLayout_[key];
+
+		bytesParsed = layout.length;
 
 		if (bytesParsed > maxLength)// Make sure there's enough buffer left to process this key
 			return -1;
 
-		int rawSliderPosition[3];
-		int rawSliderPositionH;
-
-		rawSliderPosition[0] = (((buffer[0] & 0xF0) << 4) + buffer[1]);
-		rawSliderPosition[1] = (((buffer[0] & 0x0F) << 8) + buffer[2]);
-		rawSliderPosition[2] = (((buffer[3] & 0xF0) << 4) + buffer[4]);
-
-		if (deviceHardwareVersion_ >= 2) {
-			// Always an H value with version 2 sensor hardware
-			rawSliderPositionH = (((buffer[3] & 0x0F) << 8) + buffer[5]);
-
-			if (white) {
-				for (int i = 0; i < 3; i++) {
-					if (rawSliderPosition[i] != 0x0FFF) {// 0x0FFF means no touch
-						sliderPosition[i] = (float) rawSliderPosition[i]
-								/ whiteMaxY_;
-						sliderSize[i] = (float) buffer[i + 6] / kSizeMaxValue;
-						touchCount++;
-					} else {
-						sliderPosition[i] = -1.0;
-						sliderSize[i] = 0.0;
-					}
-				}
-			} else {
-				for (int i = 0; i < 3; i++) {
-					if (rawSliderPosition[i] != 0x0FFF) {// 0x0FFF means no touch
-						sliderPosition[i] = (float) rawSliderPosition[i]
-								/ blackMaxY_;
-						sliderSize[i] = (float) buffer[i + 6] / kSizeMaxValue;
-						touchCount++;
-					} else {
-						sliderPosition[i] = -1.0;
-						sliderSize[i] = 0.0;
-					}
-				}
-			}
-		} else {
-			// H value only on white keys with version 0-1 sensor hardware
-
-			if (white) {
-				rawSliderPositionH = (((buffer[3] & 0x0F) << 8) + buffer[5]);
-
-				for (int i = 0; i < 3; i++) {
-					if (rawSliderPosition[i] != 0x0FFF) {// 0x0FFF means no touch
-						sliderPosition[i] = (float) rawSliderPosition[i]
-								/ whiteMaxY_;
-						sliderSize[i] = (float) buffer[i + 6] / kSizeMaxValue;
-						touchCount++;
-					} else {
-						sliderPosition[i] = -1.0;
-						sliderSize[i] = 0.0;
-					}
-				}
-			} else {
-				rawSliderPositionH = 0x0FFF;
-
-				for (int i = 0; i < 3; i++) {
-					if (rawSliderPosition[i] != 0x0FFF) {// 0x0FFF means no touch
-						sliderPosition[i] = (float) rawSliderPosition[i]
-								/ blackMaxY_;
-						sliderSize[i] = (float) buffer[i + 5] / kSizeMaxValue;
-						touchCount++;
-					} else {
-						sliderPosition[i] = -1.0;
-						sliderSize[i] = 0.0;
-					}
-				}
-			}
-		}
-
-		if (rawSliderPositionH != 0x0FFF) {
-			sliderPositionH = (float) rawSliderPositionH / whiteMaxX_;
-		} else
-			sliderPositionH = -1.0;
+		touchCount = layout.decode(buffer, layout.scaleY, centroidScaleH_,
+				sliderPosition, sliderSize, &sliderPositionH);
 
 		if (verbose_ >= 4) {
 			cout << "Octave " << octave << " Key " << key << ": ";
-			hexDump(cout, buffer,
-					white ? expectedLengthWhite_ : expectedLengthBlack_);
+			hexDump(cout, buffer, bytesParsed);
 			cout << endl;
 		}
 	}
@@ -1840,24 +1801,77 @@ void TouchkeyDevice::processAnalogFrame(unsigned char * const buffer,
 	int board = octave / 2;
 	int frame;
 	int bufferIndex = 1;
-	int midiNote, value;
+
+	// Work out once for the whole packet which keys are present and how each is
+	// calibrated. Keys with a plain linear calibration are calibrated in bulk below;
+	// the rest go through PianoKeyCalibrator::evaluate() one sample at a time.
+	//
+	// Of the bulk calibrated keys, those the keyboard reports as quiescent only need
+	// their samples while they are at or above the quiescent threshold; below it, all a
+	// sample would do is go into the key's history. Those samples are left out, and the
+	// keys that do need processing in each frame are kept as a bitmask.
+	PianoKey *keys[kAnalogValuesPerFrame];
+	PianoKeyCalibrator *calibrators[kAnalogValuesPerFrame];
+	float offset[kAnalogValuesPerFrame], scale[kAnalogValuesPerFrame];
+	float quiescentThreshold[kAnalogValuesPerFrame];
+	bool bulkCalibrated[kAnalogValuesPerFrame];
+	uint32_t presentKeys = 0, quiescentKeys = 0;
+	AnalogHistory& history = analogHistory_[board];
+
+	for (int key = 0; key < kAnalogValuesPerFrame; key++) {
+		int midiNote = octaveKeyToMidi(octave, key);
+
+		keys[key] = 0;
+		offset[key] = 0;
+		scale[key] = 0;
+		quiescentThreshold[key] = 0;
+		bulkCalibrated[key] = false;
+
+		// Every analog frame contains 25 values, however only the top board actually uses all 25
+		// sensors. There are several "high C" values in the lower boards (i.e. key == 24) which
+		// do not correspond to real sensors. These should be ignored.
+		if (key == 24 && octave != numberOfOctaves() - 2)
+			continue;
+
+		// Check that this note is in range to the available calibrators and keys.
+		if (keyboard_.key(midiNote) == 0
+				|| (octave * 12 + key) >= keyCalibratorsLength_
+				|| midiNote < 21)
+			continue;
+
+		keys[key] = keyboard_.key(midiNote);
+		calibrators[key] = keyCalibrators_[octave * 12 + key];
+		bulkCalibrated[key] = calibrators[key]->calibrationParameters(
+				offset[key], scale[key]);
+		presentKeys |= 1u << key;
+
+		if (bulkCalibrated[key] && keyboard_.keyIsQuiescent(midiNote)) {
+			quiescentKeys |= 1u << key;
+			quiescentThreshold[key] = keys[key]->quiescentThreshold();
+		}
+	}
+
+	// Raw values of the most recent frame; the last frame's values are passed on for drift tracking
+	int values[kAnalogValuesPerFrame];
+	bool haveValues = false;
 
 	// Parse the buffer one frame at a time
 	while (bufferIndex < bufferLength) {
-		if (bufferLength - bufferIndex < 54) {
+		if (bufferLength - bufferIndex < kAnalogFrameLength) {
 			// This condition indicates a malformed analog frame (not enough data)
 			if (verbose_ >= 1)
 				cout << "Warning: ignoring extra analog data of "
 						<< bufferLength - bufferIndex
-						<< " bytes, less than full frame 54 (total "
-						<< bufferLength << ")\n";
+						<< " bytes, less than full frame " << kAnalogFrameLength
+						<< " (total " << bufferLength << ")\n";
 			break;
 		}
 
+		const unsigned char *frameData = &buffer[bufferIndex];
+
 		// Find the timestamp (i.e. frame ID generated by the device). 32-bit little-endian.
-		frame = buffer[bufferIndex] + ((int) buffer[bufferIndex + 1] << 8)
-				+ ((int) buffer[bufferIndex + 2] << 16)
-				+ ((int) buffer[bufferIndex + 3] << 24);
+		frame = frameData[0] + ((int) frameData[1] << 8)
+				+ ((int) frameData[2] << 16) + ((int) frameData[3] << 24);
 
 		// Check the timestamp against the last frame from this board to see if any frames have been dropped
 		if (frame > (int) analogLastFrame_[board] + 1) {
@@ -1872,82 +1886,110 @@ void TouchkeyDevice::processAnalogFrame(unsigned char * const buffer,
 						<< ")" << endl;
 		}
 		analogLastFrame_[board] = frame;
+#ifdef DEBUG_SERIAL_LATENCY
+		if (board < kLatencySources - 1)
+			latencyHistogramRecord(1 + board, (unsigned int) frame);
+#endif
 
-		// TESTING
-//		if (verbose_ >= 3 || (frame % 500 == 0))
-//			cout << "Analog frame octave " << octave << " timestamp " << frame
-//					<< endl;
-//		if (verbose_ >= 4 || (frame % 500 == 0)) {
-//			cout << "Values: ";
-//			for (int i = 0; i < 25; i++) {
-//				cout << std::setw(5)
-//						<< (((signed char) buffer[i * 2 + 6]) * 256
-//								+ buffer[i * 2 + 5]) << " ";
-//			}
-//			cout << endl;
-//		}
+		// All the values in a frame were sampled together and share one timestamp
+		timestamp_type timestamp = timestampSynchronizer_.synchronizedTimestamp(
+				frame, currentFrameArrivalTime_);
 
-		// Process key values individually and add them to the keyboard data structure
-		for (int key = 0; key < 25; key++) {
-			// Every analog frame contains 25 values, however only the top board actually uses all 25
-			// sensors. There are several "high C" values in the lower boards (i.e. key == 24) which
-			// do not correspond to real sensors. These should be ignored.
-			if (key == 24 && octave != numberOfOctaves() - 2)
-				continue;
+		// Unpack all the values (little endian signed 16 bit), then calibrate them
+		// in one pass. Both loops are free of branches so the compiler can vectorize them.
+		float positions[kAnalogValuesPerFrame];
 
-			midiNote = octaveKeyToMidi(octave, key);
+		for (int key = 0; key < kAnalogValuesPerFrame; key++)
+			values[key] = (int16_t) (frameData[key * 2 + 4]
+					| (frameData[key * 2 + 5] << 8));
+		haveValues = true;
 
-			// Check that this note is in range to the available calibrators and keys.
-			if (keyboard_.key(midiNote) == 0
-					|| (octave * 12 + key) >= keyCalibratorsLength_
-					|| midiNote < 21)
+		for (int key = 0; key < kAnalogValuesPerFrame; key++) {
+			float position = ((float) values[key] - offset[key]) * scale[key];
+			position = std::max(position, kPianoKeyCalibratedMinimum);
+			positions[key] = std::min(position, kPianoKeyCalibratedMaximum);
+		}
+
+		// Skip the quiescent keys still at rest; every other present key is active
+		uint32_t atRest = 0;
+		for (int key = 0; key < kAnalogValuesPerFrame; key++)
+			atRest |= (uint32_t) (positions[key] < quiescentThreshold[key]) << key;
+		uint32_t activeKeys = presentKeys & ~(quiescentKeys & atRest);
+
+		// Add the values to the keyboard data structure
+		for (int key = 0; key < kAnalogValuesPerFrame; key++) {
+			if (!(activeKeys & (1u << key)))
 				continue;
 
-			// Pull the value out from the packed buffer (little endian 16 bit)
-			value = (((signed char) buffer[key * 2 + 6]) * 256
-					+ buffer[key * 2 + 5]);
+			if (quiescentKeys & (1u << key)) {
+				// Quiescent key starting to move: give it the samples it missed,
+				// and keep it active for the rest of the packet
+				analogHistoryCatchUp(history, key, keys[key]);
+				quiescentKeys &= ~(1u << key);
+			}
+			history.inserted[key] = history.frames + 1;
+
+			if (bulkCalibrated[key]) {
+				keys[key]->insertSample((key_position) positions[key], timestamp);
+				continue;
+			}
 
 			// Calibrate the value, assuming the calibrator is ready and running
-			key_position calibratedPosition =
-					keyCalibrators_[octave * 12 + key]->evaluate(value);
+			key_position calibratedPosition = calibrators[key]->evaluate(
+					values[key]);
 			if (!missing_value<key_position>::isMissing(calibratedPosition)) {
-				timestamp_type timestamp =
-						timestampSynchronizer_.synchronizedTimestamp(frame);
-				keyboard_.key(midiNote)->insertSample(calibratedPosition,
-						timestamp);
+				keys[key]->insertSample(calibratedPosition, timestamp);
 			} else {
-				keyboard_.key(midiNote)->insertSample((float) value / 4096.0,
-						timestampSynchronizer_.synchronizedTimestamp(frame));
+				keys[key]->insertSample((float) values[key] / 4096.0,
+						timestamp);
 
-				if (keyCalibrators_[octave * 12 + key]->calibrationStatus()
+				if (calibrators[key]->calibrationStatus()
 						== kPianoKeyCalibrated) {
 					if (verbose_ >= 1)
-						cout << "key " << midiNote
+						cout << "key " << octaveKeyToMidi(octave, key)
 								<< " calibrated but missing (raw value "
-								<< value << ")\n";
+								<< values[key] << ")\n";
 				}
 			}
-//            else if(keyboard_.gui() != 0){
-//
-//                //keyboard_.key(midiNote)->insertSample((float)value / 4096.0, timestampSynchronizer_.synchronizedTimestamp(frame));
-//
-//                // Update the GUI but don't actually save the value since it's uncalibrated
-//                keyboard_.gui()->setAnalogValueForKey(midiNote, (float)value / kTouchkeyAnalogValueMax);
-//
-//                if(keyCalibrators_[octave*12 + key]->calibrationStatus() == kPianoKeyCalibrated) {
-//                    if(verbose_ >= 1)
-//                        cout << "key " << midiNote << " calibrated but missing (raw value " << value << ")\n";
-//                }
-//            }
 		}
 
+		// Keep the frame for keys that skipped it
+		int slot = history.frames & (kAnalogHistoryLength - 1);
+		std::copy(positions, positions + kAnalogValuesPerFrame, history.positions[slot]);
+		history.timestamps[slot] = timestamp;
+		history.frames++;
+
 		if (loggingActive_) {
 			analogLog_.write((char*) &buffer[0], 1); // Octave number
-			analogLog_.write((char*) &buffer[bufferIndex], 54);
+			analogLog_.write((char*) frameData, kAnalogFrameLength);
 		}
 
 		// Skip to next frame
-		bufferIndex += 54;
+		bufferIndex += kAnalogFrameLength;
+	}
+
+	// One sample per packet is plenty for following slow drift at rest
+	if (haveValues) {
+		for (int key = 0; key < kAnalogValuesPerFrame; key++) {
+			if (keys[key] != 0)
+				calibrators[key]->driftTrackerInsert(values[key]);
+		}
+	}
+}
+
+// Insert the samples a key skipped while quiescent, oldest first, from the board's recent
+// frames. Up to kAnalogHistoryLength - 1 of them are kept (see TouchkeyDevice.h).
+void TouchkeyDevice::analogHistoryCatchUp(AnalogHistory& history, int key,
+		PianoKey* pianoKey)
+{
+	unsigned int missed = history.frames - history.inserted[key];
+	if (missed > kAnalogHistoryLength - 1)
+		missed = kAnalogHistoryLength - 1;
+
+	for (unsigned int frame = history.frames - missed; frame != history.frames; frame++) {
+		int slot = frame & (kAnalogHistoryLength - 1);
+		pianoKey->insertSample((key_position) history.positions[slot][key],
+				history.timestamps[slot]);
 	}
 }
 
@@ -2248,6 +2290,60 @@ void TouchkeyDevice::hexDump(ostream& str, unsigned char * buffer, int length)
 	str << std::dec;
 }
 
+// Wait for data to arrive from the TouchKeys device. Returns 1 if data is ready
+// to read, 0 on timeout or wakeup signal, and -1 if the device failed.
+int TouchkeyDevice::deviceWaitForData(int timeoutMilliseconds)
+{
+	struct pollfd fds[2];
+	int nfds = 1;
+
+	fds[0].fd = device_;
+	fds[0].events = POLLIN;
+	fds[0].revents = 0;
+	if (wakeupPipe_[0] >= 0) {
+		fds[1].fd = wakeupPipe_[0];
+		fds[1].events = POLLIN;
+		fds[1].revents = 0;
+		nfds = 2;
+	}
+
+	int ret = poll(fds, nfds, timeoutMilliseconds);
+
+	if (ret < 0)
+		return (errno == EINTR) ? 0 : -1;
+	if (ret == 0)
+		return 0;
+	// Leave the wakeup byte in the pipe so every waiting thread sees it;
+	// it is cleared the next time gathering starts.
+	if (nfds == 2 && (fds[1].revents & POLLIN))
+		return 0;
+	if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+		errno = EIO;
+		return -1;
+	}
+	return (fds[0].revents & POLLIN) ? 1 : 0;
+}
+
+// Interrupt any thread blocked in deviceWaitForData()
+void TouchkeyDevice::deviceWakeupSignal()
+{
+	if (wakeupPipe_[1] < 0)
+		return;
+	char ch = 0;
+	if (write(wakeupPipe_[1], &ch, 1) < 0 && errno != EAGAIN && verbose_ >= 1)
+		cout << "Warning: unable to signal wakeup pipe (error " << errno << ")\n";
+}
+
+// Discard any pending wakeup signals
+void TouchkeyDevice::deviceWakeupClear()
+{
+	if (wakeupPipe_[0] < 0)
+		return;
+	char buffer[16];
+	while (read(wakeupPipe_[0], buffer, sizeof(buffer)) > 0)
+		;
+}
+
 // Read from the TouchKeys device
 long TouchkeyDevice::deviceRead(char *buffer, unsigned int count)
 {
@@ -2299,6 +2395,66 @@ void TouchkeyDevice::deviceDrainOutput()
 //#endif
 }
 
+#ifdef DEBUG_SERIAL_LATENCY
+// Record the time from the device timestamping a frame to its processing, which
+// covers the USB transfer, waking the reader, decoding and the frame queue. The
+// baseline is the lowest host minus device time seen so far, allowed to rise
+// slowly in case the device clock runs slow.
+void TouchkeyDevice::latencyHistogramRecord(int source, unsigned int deviceFrame)
+{
+	long long now = Time::getMicrosecondCounter();
+	long long offset = now - (long long) deviceFrame * kLatencyDeviceFrameMicroseconds;
+
+	if (!latencyBaselineValid_[source]) {
+		latencyBaselineValid_[source] = true;
+		latencyBaseline_[source] = offset;
+	} else {
+		long long drift = (long long) ((double) (now - latencyBaselineTime_[source])
+				* kLatencyClockDriftPpm * 1.0e-6);
+		latencyBaseline_[source] = std::min(latencyBaseline_[source] + drift, offset);
+	}
+	latencyBaselineTime_[source] = now;
+
+	long long latency = offset - latencyBaseline_[source];
+	int bin = (int) (latency / kLatencyHistogramBinWidthMicroseconds);
+
+	if (bin < 0)
+		bin = 0;
+	if (bin >= kLatencyHistogramBins)
+		bin = kLatencyHistogramBins - 1;
+	latencyHistogram_[bin]++;
+	if (latency > latencyMaxMicroseconds_)
+		latencyMaxMicroseconds_ = latency;
+}
+
+// Print and reset the ingest latency histogram
+void TouchkeyDevice::latencyHistogramPrint()
+{
+	unsigned int total = 0;
+
+	for (int i = 0; i < kLatencyHistogramBins; i++)
+		total += latencyHistogram_[i];
+	cout << "Ingest latency (device timestamp -> processFrame, over the quickest frame), " << total
+			<< " frames, max " << latencyMaxMicroseconds_ << "us:\n";
+	for (int i = 0; i < kLatencyHistogramBins; i++) {
+		if (latencyHistogram_[i] == 0)
+			continue;
+		cout << setw(6) << i * kLatencyHistogramBinWidthMicroseconds << "us";
+		if (i == kLatencyHistogramBins - 1)
+			cout << "+ ";
+		else
+			cout << "  ";
+		cout << setw(8) << latencyHistogram_[i] << endl;
+		latencyHistogram_[i] = 0;
+	}
+	latencyMaxMicroseconds_ = 0;
+
+	// The device may restart its frame count before gathering resumes
+	for (int i = 0; i < kLatencySources; i++)
+		latencyBaselineValid_[i] = false;
+}
+#endif
+
 PianoKeyCalibrator* TouchkeyDevice::getCalibrator(int key)
 {
 	return keyCalibrators_[key];
@@ -2313,4 +2469,10 @@ TouchkeyDevice::~TouchkeyDevice()
 
 	closeDevice();
 	calibrationDeinit();
+
+	sem_destroy(&frameQueueSemaphore_);
+	if (wakeupPipe_[0] >= 0)
+		close(wakeupPipe_[0]);
+	if (wakeupPipe_[1] >= 0)
+		close(wakeupPipe_[1]);
 }
@@ -30,9 +30,11 @@
 #include <boost/function.hpp>
 #include <boost/circular_buffer.hpp>
 #include "PianoKeyboard.h"
+#include "TouchkeyFrameDecoder.h"
+#include "TouchkeyCentroidDecoder.h"
+#include "../Utility/SpscQueue.h"
+#include <semaphore.h>
 
-#define TOUCHKEY_MAX_FRAME_LENGTH 256	// Maximum data length in a single frame
-#define ESCAPE_CHARACTER 0xFE			// Indicates control sequence
 
 //#define TRANSMISSION_LENGTH_WHITE 9
 //#define TRANSMISSION_LENGTH_BLACK 8
@@ -45,6 +47,17 @@ const int kTransmissionLengthBlackNewHardware = 9;
 const int kTransmissionLengthTotalOldHardware = (8 * kTransmissionLengthWhiteOldHardware + 5 * kTransmissionLengthBlackOldHardware);
 const int kTransmissionLengthTotalNewHardware = (8 * kTransmissionLengthWhiteNewHardware + 5 * kTransmissionLengthBlackNewHardware);
 
+// Analog frames: 4-byte frame number followed by 25 16-bit little-endian values
+const int kAnalogValuesPerFrame = 25;
+const int kAnalogFrameLength = 4 + 2 * kAnalogValuesPerFrame;
+
+// Analog frames kept from each board so a quiescent key can catch up on the samples it
+// skipped. This has to cover both the idle detector's statistics and the furthest the
+// position tracker looks back for the start of a press when the key goes active (about
+// 75 samples), so the key sees the same recent history as if nothing had been skipped.
+// Must be a power of two.
+const int kAnalogHistoryLength = 128;
+
 // Maximum integer values for different types of sliders
 
 //#define WHITE_MAX_VALUE 1280.0		// White keys, vertical	(64 * 20)
@@ -60,15 +73,29 @@ const float kWhiteMaxXValueNewHardware = 256.0;     // White keys, horizontal (1
 const float kBlackMaxYValueNewHardware = 1536.0;    // Black keys, vertical (128 * 12)
 const float kBlackMaxXValueNewHardware = 256.0;     // Black keys, horizontal (1 byte + 1 bit)
 
-const float kSizeMaxValue = 255.0;
-
-enum {
-	kControlCharacterFrameBegin = 0x00,
-	kControlCharacterAck = 0x01,
-	kControlCharacterNak = 0x02,
-	kControlCharacterFrameError = 0xFD,
-	kControlCharacterFrameEnd = 0xFF
-};
+// Number of decoded frames that can wait between the serial reader thread and the
+// frame processing thread before new frames are dropped
+const int kFrameQueueLength = 256;
+
+// Longest time the I/O threads block waiting for serial data before rechecking
+// whether they should stop. Normally they are woken immediately by stopAutoGathering().
+const int kDeviceWaitTimeoutMilliseconds = 100;
+
+// How often the background drift check looks at each key's resting value
+const int kCalibrationDriftCheckIntervalMilliseconds = 2000;
+
+#ifdef DEBUG_SERIAL_LATENCY
+// Histogram of time from the device timestamping a frame to its processing. The
+// device counts frames in 1ms USB intervals on its own clock, so latencies are
+// relative to the quickest frame seen from each source (centroid data, then each
+// analog board); that baseline may creep by kLatencyClockDriftPpm to follow any
+// difference in clock rates.
+const int kLatencyHistogramBins = 32;
+const int kLatencyHistogramBinWidthMicroseconds = 50;
+const int kLatencyDeviceFrameMicroseconds = 1000;
+const double kLatencyClockDriftPpm = 200.0;
+const int kLatencySources = 5;
+#endif
 
 // Frame types for data sent over USB.  The first byte following a frame start control sequence gives the type.
 
@@ -194,6 +221,23 @@ public:
 		float keyPosition[2];
 	};
 
+    // Frame handed from the serial reader thread to the processing thread
+    class ReceivedFrame {
+    public:
+        double arrivalTime;     // Clock time (ms) when the data was read
+        int length;
+        unsigned char data[TOUCHKEY_MAX_FRAME_LENGTH];
+    };
+
+    // How to decode the centroid data of a key, chosen from the hardware version
+    // and key colour when the device reports its status
+    class CentroidLayout {
+    public:
+        CentroidDecoder decode;     // Unpacking function specialized for this layout
+        float scaleY;               // Reciprocal of the maximum vertical value
+        int length;                 // Bytes of data per key
+    };
+
     // Structure to hold changes to RGB LEDs on relevant hardware
     class RGBLEDUpdate {
     public:
@@ -270,7 +314,13 @@ public:
 	void calibrationUpdateQuiescent();
 
 	bool calibrationSaveToFile(std::string const& filename);
+	bool calibrationSaveToBinaryFile(std::string const& filename);
 	bool calibrationLoadFromFile(std::string const& filename);
+
+	// Background drift check: while data is being gathered, periodically let each
+	// calibrated key's quiescent value follow slow drift at rest, key by key
+	void calibrationDriftCheckSetEnabled(bool enable);
+	bool calibrationDriftCheckEnabled() { return driftCheckEnabled_; }
 	PianoKeyCalibrator* getCalibrator(int key);
 
     // ***** Data Logging *****
@@ -412,14 +462,93 @@ public:
     	TouchkeyDevice* enclosing;
     };
 
+    class processLoop : public Thread {
+    public:
+    	processLoop() : Thread("processLoop")
+    	{
+    	}
+
+    	void startThread(TouchkeyDevice* enclosing)
+    	{
+    		this->enclosing = enclosing;
+
+    		int ret1 = pthread_create(getPthread(), NULL, run_static, (void*) this);
+    		if (ret1) {
+    			fprintf(stderr, "Error - pthread_create() return code: %d\n", ret1);
+    		} else {
+    			init();
+    		}
+    	}
+
+    	static void* run_static(void* args)
+    	{
+    		processLoop* l = (processLoop*) args;
+    		l->run();
+    		return NULL;
+    	}
+
+    	void* run()
+    	{
+    		enclosing->processLoopFunction(this);
+    		this->exit();
+    		return NULL;
+    	}
+
+    	TouchkeyDevice* enclosing;
+    };
+
+    class driftCheckLoop : public Thread {
+    public:
+    	driftCheckLoop() : Thread("driftCheckLoop")
+    	{
+    	}
+
+    	void startThread(TouchkeyDevice* enclosing)
+    	{
+    		this->enclosing = enclosing;
+
+    		int ret1 = pthread_create(getPthread(), NULL, run_static, (void*) this);
+    		if (ret1) {
+    			fprintf(stderr, "Error - pthread_create() return code: %d\n", ret1);
+    		} else {
+    			init();
+    		}
+    	}
+
+    	static void* run_static(void* args)
+    	{
+    		driftCheckLoop* l = (driftCheckLoop*) args;
+    		l->run();
+    		return NULL;
+    	}
+
+    	void* run()
+    	{
+    		enclosing->driftCheckLoopFunction(this);
+    		this->exit();
+    		return NULL;
+    	}
+
+    	TouchkeyDevice* enclosing;
+    };
+
     void* ledUpdateLoopFunction(Thread* caller);
 	void* runLoopFunction(Thread* caller);
     void* rawDataRunLoopFunction(Thread* caller);
+    void* processLoopFunction(Thread* caller);
+    void* driftCheckLoopFunction(Thread* caller);
+
+    // Number of frames dropped because the processing thread fell behind
+    unsigned long framesDropped() { return frameQueue_.overflows(); }
 
     // for debugging
     void testStopLeds() { ledShouldStop_ = true; }
 
 private:
+	// Frame handler for TouchkeyFrameDecoder; queues the frame for the processing thread
+	void decodedFrame(unsigned char * const frame, int length);
+	// Wait for the reader to queue a frame, up to the given timeout
+	void frameQueueWait(int timeoutMilliseconds);
 	// Read and parse new data from the device, splitting out by frame type
 	void processFrame(unsigned char * const frame, int length);
 
@@ -448,6 +577,12 @@ private:
 	// After writing a command, check whether it was acknolwedged by the controller
 	bool checkForAck(int timeoutMilliseconds);
 
+	// Choose the centroid decoders for the current hardware version
+	void centroidLayoutInit();
+
+	// Tell the keyboard which MIDI notes have sensors, from keysPresent_
+	void updateKeysPresent();
+
 	// Utility method for debugging
 	void hexDump(ostream& str, unsigned char * buffer, int length);
 
@@ -462,6 +597,9 @@ private:
     int  internalRGBLEDMIDIToLEDNumber(const int midiNote);     // Get LED number for MIDI note
 
     // Device low-level access methods
+    int deviceWaitForData(int timeoutMilliseconds);
+    void deviceWakeupSignal();
+    void deviceWakeupClear();
     long deviceRead(char *buffer, unsigned int count);
     int deviceWrite(char *buffer, unsigned int count);
     void deviceFlush(bool bothDirections);
@@ -471,6 +609,7 @@ private:
 	PianoKeyboard& keyboard_;	// Main keyboard controller
 
 	int device_;				// File descriptor
+	int wakeupPipe_[2];			// Self-pipe that interrupts deviceWaitForData() on shutdown
 
 	runLoop ioThread_;		// Thread that handles the communication from the device
     rawDataRunLoop rawDataThread_;// Thread that handles raw data collection
@@ -491,10 +630,24 @@ private:
     int expectedLengthBlack_;   // How long the black key data blocks are
     float whiteMaxX_, whiteMaxY_;   // Maximum sensor values for white keys
     float blackMaxX_, blackMaxY_;   // Maximum sensor values for black keys
+    CentroidLayout centroidLayout_[13]; // Centroid decoding for each key in the octave
+    float centroidScaleH_;          // Reciprocal of the maximum horizontal value
 
     // Frame counter for analog data, to detect dropped frames
     unsigned int analogLastFrame_[4];    // Max 4 boards
 
+    // Calibrated positions from the most recent analog frames of each board. Samples of
+    // quiescent keys are left out while they stay at rest; when one starts to move, it is
+    // given the ones it missed from here first (see processAnalogFrame()).
+    struct AnalogHistory {
+        float positions[kAnalogHistoryLength][kAnalogValuesPerFrame];
+        timestamp_type timestamps[kAnalogHistoryLength];
+        unsigned int frames;                            // Frames added so far
+        unsigned int inserted[kAnalogValuesPerFrame];   // Value of frames when each key last had a sample
+    };
+    AnalogHistory analogHistory_[4];
+    void analogHistoryCatchUp(AnalogHistory& history, int key, PianoKey* pianoKey);
+
 	// Synchronization between frame time and system timestamp, allowing interaction
 	// with other simultaneous streams using different clocks.  Also save the last timestamp
 	// we've processed to other functions can access it.
@@ -512,6 +665,16 @@ private:
     volatile bool ledShouldStop_;           // testing
     boost::circular_buffer<RGBLEDUpdate> ledUpdateQueue_;    // Queue that holds new LED messages to be sent to device
 
+    // ***** Frame queue *****
+    // The I/O threads only read and split the data into frames; the frames are
+    // parsed on a separate thread so that processing never holds up serial reads.
+    processLoop processThread_;             // Thread that parses frames queued by the I/O threads
+    SpscQueue<ReceivedFrame> frameQueue_;   // Frames waiting to be processed
+    sem_t frameQueueSemaphore_;             // Posted when a frame is queued or the threads should stop
+    double currentReadTime_;                // Clock time of the most recent read (reader thread)
+    double currentFrameArrivalTime_;        // Clock time the frame being processed arrived (processing thread)
+    unsigned long framesDroppedReported_;   // Dropped frame count already warned about
+
     // ***** Calibration *****
     bool isCalibrated_;
 	bool calibrationInProgress_;
@@ -519,6 +682,21 @@ private:
     PianoKeyCalibrator** keyCalibrators_;	// Calibration information for each key
     int keyCalibratorsLength_;              // How many calibrators
 
+    driftCheckLoop driftCheckThread_;       // Thread that follows slow drift in the quiescent values
+    volatile bool driftCheckEnabled_;       // Whether the drift check should run while gathering
+
+#ifdef DEBUG_SERIAL_LATENCY
+    // ***** Ingest latency measurement *****
+    void latencyHistogramRecord(int source, unsigned int deviceFrame);
+    void latencyHistogramPrint();
+
+    unsigned int latencyHistogram_[kLatencyHistogramBins];
+    long long latencyMaxMicroseconds_;
+    bool latencyBaselineValid_[kLatencySources];
+    long long latencyBaseline_[kLatencySources];        // Lowest host minus device time seen (us)
+    long long latencyBaselineTime_[kLatencySources];    // Host time of the last baseline update (us)
+#endif
+
     // ***** Logging *****
     ofstream keyTouchLog_;
     ofstream analogLog_;
@@ -0,0 +1,138 @@
+/*
+  TouchKeys: multi-touch musical keyboard control software
+  Copyright (c) 2013 Andrew McPherson
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  =====================================================================
+
+  TouchkeyFrameDecoder.cpp: splits the escaped byte stream from the TouchKeys
+  hardware into complete frames.
+*/
+
+#include "TouchkeyFrameDecoder.h"
+#include <iostream>
+#include <string.h>
+
+using namespace std;
+
+// Constructor
+
+TouchkeyFrameDecoder::TouchkeyFrameDecoder(FrameHandler handler, int verbose) :
+		handler_(handler), frameLength_(0), inFrame_(false), controlSeq_(false),
+		verbose_(verbose), framesDecoded_(0), framesOversized_(0)
+{
+}
+
+// Process a chunk of received data. Outside a frame, everything up to the next
+// escape character is skipped; inside a frame, everything up to the next escape
+// character is literal data and is copied in one go.
+
+void TouchkeyFrameDecoder::decode(const unsigned char * data, int length)
+{
+	const unsigned char *end = data + length;
+
+	while (data < end) {
+		if (controlSeq_) {
+			controlSeq_ = false;
+			processControlCharacter(*data++);
+			continue;
+		}
+
+		const unsigned char *escape = (const unsigned char *) memchr(data,
+				ESCAPE_CHARACTER, end - data);
+
+		if (inFrame_) {
+			int runLength = (escape != 0 ? escape : end) - data;
+			int consumed = appendToFrame(data, runLength);
+
+			data += consumed;
+			if (consumed < runLength)	// Frame overflowed; skip to the next escape
+				continue;
+		} else if (escape == 0) {
+			return;
+		} else {
+			data = escape;
+		}
+
+		if (data < end) {
+			// data now points at an escape character
+			controlSeq_ = true;
+			data++;
+		}
+	}
+}
+
+// Discard any partially received frame
+
+void TouchkeyFrameDecoder::reset()
+{
+	inFrame_ = false;
+	controlSeq_ = false;
+	frameLength_ = 0;
+}
+
+// Handle the character following an escape
+
+void TouchkeyFrameDecoder::processControlCharacter(unsigned char ch)
+{
+	if (inFrame_) {
+		// Receiving a frame
+
+		if (ch == kControlCharacterFrameEnd) {	// frame finished?
+			inFrame_ = false;
+			framesDecoded_++;
+			handler_(frame_, frameLength_);
+		} else if (ch == kControlCharacterFrameError) { // device telling us about an internal comm error
+			if (verbose_ >= 1)
+				cout << "Warning: received frame error, continuing anyway.\n";
+		} else if (ch == ESCAPE_CHARACTER) { // double-escape means a literal escape character
+			appendToFrame(&ch, 1);
+		} else if (ch == kControlCharacterNak && verbose_ >= 1) {
+			// TODO: pass this on to a checkForAck() call
+			cout << "Warning: received NAK (while receiving frame)\n";
+		}
+	} else {
+		// Waiting for a frame beginning control sequence
+
+		if (ch == kControlCharacterFrameBegin) {
+			inFrame_ = true;
+			frameLength_ = 0;
+		} else if (ch == kControlCharacterNak && verbose_ >= 1) {
+			// TODO: pass this on to a checkForAck() call
+			cout << "Warning: received NAK (while waiting for frame)\n";
+		}
+	}
+}
+
+// Append literal data to the current frame. A frame reaching the length limit is
+// dropped, and any data after that point is not consumed.
+
+int TouchkeyFrameDecoder::appendToFrame(const unsigned char * data, int length)
+{
+	int space = TOUCHKEY_MAX_FRAME_LENGTH - frameLength_;
+
+	if (length < space) {
+		memcpy(&frame_[frameLength_], data, length);
+		frameLength_ += length;
+		return length;
+	}
+
+	inFrame_ = false;
+	framesOversized_++;
+	if (verbose_ >= 1)
+		cout << "Warning: ignoring frame exceeding length limit "
+				<< (int) TOUCHKEY_MAX_FRAME_LENGTH << endl;
+	return space;
+}
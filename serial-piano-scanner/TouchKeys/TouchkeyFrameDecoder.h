@@ -0,0 +1,87 @@
+/*
+  TouchKeys: multi-touch musical keyboard control software
+  Copyright (c) 2013 Andrew McPherson
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  =====================================================================
+
+  TouchkeyFrameDecoder.h: splits the escaped byte stream from the TouchKeys
+  hardware into complete frames.
+*/
+
+#ifndef TOUCHKEY_FRAME_DECODER_H
+#define TOUCHKEY_FRAME_DECODER_H
+
+#include <boost/function.hpp>
+
+#define TOUCHKEY_MAX_FRAME_LENGTH 256	// Maximum data length in a single frame
+#define ESCAPE_CHARACTER 0xFE			// Indicates control sequence
+
+// Control characters which follow ESCAPE_CHARACTER in the byte stream
+
+enum {
+	kControlCharacterFrameBegin = 0x00,
+	kControlCharacterAck = 0x01,
+	kControlCharacterNak = 0x02,
+	kControlCharacterFrameError = 0xFD,
+	kControlCharacterFrameEnd = 0xFF
+};
+
+// Incremental decoder for the device byte stream. Data is passed in whatever
+// chunks it arrives in, and each complete frame is handed to the frame handler.
+// Literal data between escape characters is located with memchr() and copied
+// in runs rather than examined one byte at a time.
+
+class TouchkeyFrameDecoder {
+public:
+	typedef boost::function<void (unsigned char * const, int)> FrameHandler;
+
+	// ***** Constructor *****
+	TouchkeyFrameDecoder(FrameHandler handler, int verbose = 1);
+
+	// ***** Decoding *****
+	// Process a chunk of received data
+	void decode(const unsigned char * data, int length);
+
+	// Discard any partially received frame
+	void reset();
+
+	// ***** Status *****
+	void setVerboseLevel(int verbose) { verbose_ = verbose; }
+	bool isInFrame() { return inFrame_; }
+
+	// Counters since construction
+	unsigned long framesDecoded() { return framesDecoded_; }
+	unsigned long framesOversized() { return framesOversized_; }
+
+private:
+	// Handle the character following an escape
+	void processControlCharacter(unsigned char ch);
+	// Append literal data to the current frame, dropping the frame on overflow.
+	// Returns the number of bytes consumed.
+	int appendToFrame(const unsigned char * data, int length);
+
+	FrameHandler handler_;				// Called for every complete frame
+	unsigned char frame_[TOUCHKEY_MAX_FRAME_LENGTH];	// Accumulated frame of data
+	int frameLength_;
+	bool inFrame_;						// Whether we have seen a frame beginning
+	bool controlSeq_;					// Whether the last byte was an escape
+	int verbose_;						// Logging level
+
+	unsigned long framesDecoded_;
+	unsigned long framesOversized_;
+};
+
+#endif /* TOUCHKEY_FRAME_DECODER_H */
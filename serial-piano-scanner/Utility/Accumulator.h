@@ -26,6 +26,7 @@
 
 #include <iostream>
 #include <exception>
+#include <vector>
 
 #include "Node.h"
 
@@ -46,11 +47,11 @@ class Accumulator : public Node<std::pair<int, DataType> > {
 public:
 	typedef typename std::pair<int, DataType> return_type;
 	typedef typename Node<return_type>::capacity_type capacity_type;
-	//typedef typename Node<return_type>::size_type size_type;
+	typedef typename Node<return_type>::size_type size_type;
 	
 	// ***** Constructors *****
 		
-	Accumulator(capacity_type capacity, Node<DataType>& input) : Node<return_type>(capacity), input_(input), samples_(N+1) {
+	Accumulator(capacity_type capacity, Node<DataType>& input) : Node<return_type>(capacity), input_(input), samples_(N+1), triggeredByInput_(true) {
 		if(capacity <= N)			// Need to have at least N points in history to accumulate
 			throw new std::bad_alloc();
 		//std::cout << "Registering Accumulator\n";
@@ -59,8 +60,25 @@ public:
 	}
 				
 	// Copy constructor
-	Accumulator(Accumulator<DataType,N> const& obj) : Node<return_type>(obj), input_(obj.input_), samples_(obj.samples_) {
-		this->registerForTrigger(&input_);
+	Accumulator(Accumulator<DataType,N> const& obj) : Node<return_type>(obj), input_(obj.input_), samples_(obj.samples_),
+	  triggeredByInput_(obj.triggeredByInput_) {
+		if(triggeredByInput_)
+			this->registerForTrigger(&input_);
+	}
+	
+	// ***** Connection *****
+	//
+	// By default each new input sample is picked up through a trigger. When this is turned off,
+	// the owner calls process() directly after each sample is inserted into the input.
+	
+	void setTriggeredByInput(bool triggered) {
+		if(triggered == triggeredByInput_)
+			return;
+		if(triggered)
+			this->registerForTrigger(&input_);
+		else
+			this->unregisterForTrigger(&input_);
+		triggeredByInput_ = triggered;
 	}
 	
 	// ***** Modifiers *****
@@ -85,6 +103,11 @@ public:
 		
 		//std::cout << "Accumulator::triggerReceived2\n";		
 		
+		process(timestamp);
+	}
+	
+	// Accumulate the latest input sample
+	void process(timestamp_type timestamp) {
 		DataType newSample = input_.latest();
 		samples_.push_back(newSample);		
 		
@@ -110,6 +133,29 @@ public:
 		}
 	}
 	
+	// Accumulate count new input samples at once, given as arrays, and insert the results
+	// as a block. Equivalent to calling process() once per sample.
+	void processBlock(const DataType* samples, const timestamp_type* timestamps, size_type count) {
+		int numPoints = 0;
+		DataType accumulatedValue = DataType();
+		
+		if(!this->empty()) {
+			numPoints = this->latest().first;
+			accumulatedValue = this->latest().second;
+		}
+		block_.resize(count);
+		for(size_type i = 0; i < count; i++) {
+			samples_.push_back(samples[i]);
+			accumulatedValue += samples[i];
+			if(samples_.full())
+				accumulatedValue -= samples_.front();
+			else
+				numPoints++;
+			block_[i] = return_type(numPoints, accumulatedValue);
+		}
+		this->insertBlock(block_.data(), timestamps, count);
+	}
+	
 	// Reset the integral to a given value at a given sample.  All samples
 	// after this one are marked "missing" to force a recalculation of the integral next time
 	// the value is requested.
@@ -130,6 +176,8 @@ private:
 	// accumulated buffer, and including our own sample buffer means we don't need to rely on the
 	// length of the input to store old samples.
 	boost::circular_buffer<DataType> samples_;
+	std::vector<return_type> block_;	// Results of processBlock() before they are inserted
+	bool triggeredByInput_;		// Whether we're registered for triggers from input_
 };
 
 
@@ -28,9 +28,194 @@
 #include <iostream>
 #include <exception>
 #include <vector>
+#include <algorithm>
 
 #include "Node.h"
 
+/*
+ * IIRFilterKernel
+ *
+ * The arithmetic of an IIR filter, separate from where its samples come from. The Order
+ * parameter fixes the order of the filter at compile time: kernels of order 1 and 2 run in
+ * direct form II transposed, keeping their coefficients and the two state variables in
+ * plain members that the compiler can hold in registers across a block. Order 0 (the
+ * default) takes any number of coefficients and keeps its history in circular buffers.
+ *
+ * Coefficients are given as in the filter design functions below: B0...BN feedforward,
+ * then A1...AN feedback, with A0 taken to be 1.
+ */
+
+template<typename DataType, int Order>
+class IIRFilterKernel;
+
+// Any order, set at run time
+template<typename DataType>
+class IIRFilterKernel<DataType, 0> {
+public:
+    // Set the coefficients, resizing the history if needed. Returns false (leaving
+    // things as they were) if the coefficients can't be used.
+    bool setCoefficients(std::vector<DataType> const& bCoeffs, std::vector<DataType> const& aCoeffs,
+                         bool clearHistory) {
+        if(bCoeffs.empty()) // Can't have an empty feedforward coefficient set
+            return false;
+        if(bCoeffs.size() != inputHistory_.capacity()) {
+            inputHistory_.set_capacity(bCoeffs.size());
+            clearHistory = true;
+        }
+        if(aCoeffs.size() != outputHistory_.capacity()) {
+            outputHistory_.set_capacity(aCoeffs.size());
+            clearHistory = true;
+        }
+        aCoefficients_ = aCoeffs;
+        bCoefficients_ = bCoeffs;
+        if(clearHistory)
+            reset();
+        return true;
+    }
+    
+    // Whether any coefficients have been set; without them the filter passes samples through
+    bool ready() const { return !bCoefficients_.empty(); }
+    
+    // Clear the recent history of input/output data and fill it with zeros
+    void reset() {
+        inputHistory_.clear();
+        while(!inputHistory_.full())
+            inputHistory_.push_back(DataType());
+        outputHistory_.clear();
+        while(!outputHistory_.full())
+            outputHistory_.push_back(DataType());
+    }
+    
+    // Run the filter once with a new sample and return the result
+    DataType filter(DataType const& sample) {
+        // Always need at least one feedforward coefficient
+        DataType result = bCoefficients_[0] * sample;
+        typename boost::circular_buffer<DataType>::reverse_iterator rit = inputHistory_.rbegin();
+        
+        // Feedforward part
+        for(unsigned int i = 1; i < bCoefficients_.size() && rit != inputHistory_.rend(); i++) {
+            result += *rit * bCoefficients_[i];
+            rit++;
+        }
+        // Feedback part
+        rit = outputHistory_.rbegin();
+        for(unsigned int i = 0; i < aCoefficients_.size() && rit != outputHistory_.rend(); i++) {
+            result -= *rit * aCoefficients_[i];
+            rit++;
+        }
+        
+        // Update input and output history
+        inputHistory_.push_back(sample);
+        outputHistory_.push_back(result);
+        return result;
+    }
+    
+    void filter(const DataType* input, DataType* output, size_t count) {
+        for(size_t i = 0; i < count; i++)
+            output[i] = filter(input[i]);
+    }
+    
+private:
+    // Past input and output samples, most recent last
+    boost::circular_buffer<DataType> inputHistory_, outputHistory_;
+    std::vector<DataType> aCoefficients_, bCoefficients_;
+};
+
+// First order: y[n] = b0 x[n] + z1; z1 = b1 x[n] - a1 y[n]
+template<typename DataType>
+class IIRFilterKernel<DataType, 1> {
+public:
+    IIRFilterKernel() : b0_(), b1_(), a1_(), z1_(), ready_(false) {}
+    
+    bool setCoefficients(std::vector<DataType> const& bCoeffs, std::vector<DataType> const& aCoeffs,
+                         bool clearHistory) {
+        if(bCoeffs.size() != 2 || aCoeffs.size() != 1)
+            return false;
+        b0_ = bCoeffs[0]; b1_ = bCoeffs[1];
+        a1_ = aCoeffs[0];
+        if(clearHistory || !ready_)
+            reset();
+        ready_ = true;
+        return true;
+    }
+    
+    bool ready() const { return ready_; }
+    void reset() { z1_ = DataType(); }
+    
+    DataType filter(DataType const& sample) {
+        DataType result = b0_ * sample + z1_;
+        z1_ = b1_ * sample - a1_ * result;
+        return result;
+    }
+    
+    void filter(const DataType* input, DataType* output, size_t count) {
+        const DataType b0 = b0_, b1 = b1_, a1 = a1_;
+        DataType z1 = z1_;
+        
+        for(size_t i = 0; i < count; i++) {
+            DataType x = input[i];
+            DataType y = b0 * x + z1;
+            z1 = b1 * x - a1 * y;
+            output[i] = y;
+        }
+        z1_ = z1;
+    }
+    
+private:
+    DataType b0_, b1_, a1_;     // Coefficients
+    DataType z1_;               // State
+    bool ready_;                // Whether coefficients have been set
+};
+
+// Second order (biquad): y[n] = b0 x[n] + z1; z1 = b1 x[n] - a1 y[n] + z2; z2 = b2 x[n] - a2 y[n]
+template<typename DataType>
+class IIRFilterKernel<DataType, 2> {
+public:
+    IIRFilterKernel() : b0_(), b1_(), b2_(), a1_(), a2_(), z1_(), z2_(), ready_(false) {}
+    
+    bool setCoefficients(std::vector<DataType> const& bCoeffs, std::vector<DataType> const& aCoeffs,
+                         bool clearHistory) {
+        if(bCoeffs.size() != 3 || aCoeffs.size() != 2)
+            return false;
+        b0_ = bCoeffs[0]; b1_ = bCoeffs[1]; b2_ = bCoeffs[2];
+        a1_ = aCoeffs[0]; a2_ = aCoeffs[1];
+        if(clearHistory || !ready_)
+            reset();
+        ready_ = true;
+        return true;
+    }
+    
+    bool ready() const { return ready_; }
+    void reset() { z1_ = z2_ = DataType(); }
+    
+    DataType filter(DataType const& sample) {
+        DataType result = b0_ * sample + z1_;
+        z1_ = b1_ * sample - a1_ * result + z2_;
+        z2_ = b2_ * sample - a2_ * result;
+        return result;
+    }
+    
+    void filter(const DataType* input, DataType* output, size_t count) {
+        const DataType b0 = b0_, b1 = b1_, b2 = b2_, a1 = a1_, a2 = a2_;
+        DataType z1 = z1_, z2 = z2_;
+        
+        for(size_t i = 0; i < count; i++) {
+            DataType x = input[i];
+            DataType y = b0 * x + z1;
+            z1 = b1 * x - a1 * y + z2;
+            z2 = b2 * x - a2 * y;
+            output[i] = y;
+        }
+        z1_ = z1;
+        z2_ = z2;
+    }
+    
+private:
+    DataType b0_, b1_, b2_, a1_, a2_;   // Coefficients
+    DataType z1_, z2_;                  // State
+    bool ready_;                        // Whether coefficients have been set
+};
+
 /*
  * IIRFilterNode
  *
@@ -40,45 +225,32 @@
  * filtering on each new sample or only filtering on request. In the latter case, it will go back
  * and filter from the most recent available sample, assuming the signal starts from 0 if there is
  * any break in data between what was already calculated and what input data is now available.
+ *
+ * Order can be given as 1 or 2 to use a fixed-order kernel (see IIRFilterKernel above), in which
+ * case setCoefficients() only accepts coefficients of that order.
  */
 
-template<typename DataType>
+template<typename DataType, int Order = 0>
 class IIRFilterNode : public Node<DataType> {
 public:
 	typedef typename Node<DataType>::capacity_type capacity_type;
-	//typedef typename Node<return_type>::size_type size_type;
+	typedef typename Node<DataType>::size_type size_type;
 	
 	// ***** Constructors *****
     
 	IIRFilterNode(capacity_type capacity, Node<DataType>& input) : Node<DataType>(capacity), input_(input),
-      autoCalculate_(false), inputHistory_(0), outputHistory_(0), lastInputIndex_(0) {
+      autoCalculate_(false), lastInputIndex_(0) {
 	}
     
 	// Copy constructor
-	IIRFilterNode(IIRFilterNode<DataType> const& obj) : Node<DataType>(obj), input_(obj.input_), autoCalculate_(obj.autoCalculate_),
-     aCoefficients_(obj.aCoefficients_), bCoefficients_(obj.bCoefficients_), lastInputIndex_(obj.lastInputIndex_) {
-         if(obj.inputHistory_ != 0)
-             inputHistory_ = new boost::circular_buffer<DataType>(*obj.inputHistory_);
-         else
-             inputHistory_ = 0;
-         if(obj.outputHistory_ != 0)
-             outputHistory_ = new boost::circular_buffer<DataType>(*obj.outputHistory_);
-         else
-             outputHistory_ = 0;
+	IIRFilterNode(IIRFilterNode<DataType, Order> const& obj) : Node<DataType>(obj), input_(obj.input_),
+      autoCalculate_(obj.autoCalculate_), kernel_(obj.kernel_), lastInputIndex_(obj.lastInputIndex_) {
          if(autoCalculate_) {
              // Bring up to date and register for further updates
              calculate();
              this->registerForTrigger(&input_);
          }
 	}
-    
-    // ***** Destructor *****
-    ~IIRFilterNode() {
-        if(inputHistory_ != 0)
-            delete inputHistory_;
-        if(outputHistory_ != 0)
-            delete outputHistory_;
-    }
 	
 	// ***** Modifiers *****
 	//
@@ -86,7 +258,7 @@ public:
 	
 	void clear() {
 		Node<DataType>::clear();
-        clearInputOutputHistory();
+        kernel_.reset();
 	}
     
     // Switch whether calculations happen automatically or only upon request
@@ -107,35 +279,12 @@ public:
     // to hold past inputs. Optional last argument specifies whether to
     // clear the past sample history or not (defaults to clearing it).
     // If filter lengths are different, the buffer is always cleared.
+    // Coefficients that don't match a fixed Order are ignored.
     void setCoefficients(std::vector<DataType> const& bCoeffs,
                          std::vector<DataType> const& aCoeffs,
                          bool clearBuffer = true) {
-        if(bCoeffs.empty()) // Can't have an empty feedforward coefficient set
-            return;
-        bool shouldClear = clearBuffer;
-        aCoefficients_ = aCoeffs;
-        bCoefficients_ = bCoeffs;
-        
-        if(inputHistory_ == 0) {
-            inputHistory_ = new boost::circular_buffer<DataType>(bCoeffs.size());
-            shouldClear = true;
-        }
-        else if(bCoeffs.size() != inputHistory_->capacity()) {
-            inputHistory_->resize(bCoeffs.size());
-            shouldClear = true;
-        }
-        
-        if(outputHistory_ == 0) {
-            outputHistory_ = new boost::circular_buffer<DataType>(aCoeffs.size());
-            shouldClear = true;
-        }
-        else if(aCoeffs.size() != outputHistory_->capacity()) {
-            outputHistory_->resize(aCoeffs.size());
-            shouldClear = true;
-        }
-        
-        if(shouldClear)
-            clearInputOutputHistory();
+        if(!kernel_.setCoefficients(bCoeffs, aCoeffs, clearBuffer))
+            std::cerr << "IIRFilterNode: ignoring invalid coefficients\n";
     }
     
     // If not automatically calculating, bring the samples up to date by
@@ -149,7 +298,7 @@ public:
         if(maximumLookback >= 0 && index < input_.endIndex() - 1 - maximumLookback) {
             //std::cout << "IIRFilterNode: clearing history at index " << index << std::endl;
             // More samples gone by than we want to calculate... clear input
-            clearInputOutputHistory();
+            kernel_.reset();
             index = input_.endIndex() - 1 - maximumLookback;
             if(index < input_.beginIndex())
                 index = input_.beginIndex();
@@ -157,12 +306,17 @@ public:
         else if(index < input_.beginIndex()) {
             // More samples gone by than are now available... clear input
             //std::cout << "IIRFilterNode: clearing history at index " << index << std::endl;
-            clearInputOutputHistory();
+            kernel_.reset();
             index = input_.beginIndex();
         }
-        while(index < input_.endIndex()) {
-            processOneSample(input_[index], input_.timestampAt(index));
-            index++;
+        // Filter whatever is available in contiguous blocks
+        size_type endIndex = input_.endIndex();
+        while(index < endIndex) {
+            const DataType* samples;
+            const timestamp_type* timestamps;
+            size_type count = input_.span(index, endIndex - index, samples, timestamps);
+            processBlock(samples, timestamps, count);
+            index += count;
         }
         
         lastInputIndex_ = index;
@@ -183,33 +337,28 @@ public:
         
         processOneSample(input_.latest(), timestamp);
 	}
+    
+    // Filter count samples at once, given as arrays, and insert the results as a block.
+    // Equivalent to running the filter once per sample. This does not update the position
+    // in the input used by calculate(), so use one or the other.
+    void processBlock(const DataType* samples, const timestamp_type* timestamps, size_type count) {
+        if(!kernel_.ready()) {
+            // Pass through when no coefficients present
+            this->insertBlock(samples, timestamps, count);
+            return;
+        }
+        block_.resize(count);
+        kernel_.filter(samples, block_.data(), count);
+        this->insertBlock(block_.data(), timestamps, count);
+    }
 	
 private:
     // ***** Internal Methods *****
     // Run the filter once with a new sample. Put the result into the
     // end of the buffer.
     void processOneSample(DataType const& sample, timestamp_type timestamp) {
-        if(!bCoefficients_.empty()) {
-            // Always need at least one feedforward coefficient
-            DataType result = bCoefficients_[0] * sample;
-            typename boost::circular_buffer<DataType>::reverse_iterator rit = inputHistory_->rbegin();
-            
-            // Feedforward part
-            for(unsigned int i = 1; i < bCoefficients_.size() && rit != inputHistory_->rend(); i++) {
-                result += *rit * bCoefficients_[i];
-                rit++;
-            }
-            // Feedback part
-            rit = outputHistory_->rbegin();
-            for(unsigned int i = 0; i < aCoefficients_.size() && rit != outputHistory_->rend(); i++) {
-                result -= *rit * aCoefficients_[i];
-                rit++;
-            }
-            
-            // Update input history and put output in our buffer
-            inputHistory_->push_back(sample);
-            outputHistory_->push_back(result);
-            this->insert(result, timestamp);
+        if(kernel_.ready()) {
+            this->insert(kernel_.filter(sample), timestamp);
         }
         else {
             // Pass through when no coefficients present
@@ -217,38 +366,100 @@ private:
         }
     }
     
-    // Clear the recent history of input/output data and fill it with zeros
-    void clearInputOutputHistory() {
-        if(inputHistory_ != 0) {
-            inputHistory_->clear();
-            while(!inputHistory_->full())
-                inputHistory_->push_back(DataType());
-        }
-        if(outputHistory_ != 0) {
-            outputHistory_->clear();
-            while(!outputHistory_->full())
-                outputHistory_->push_back(DataType());
-        }
-    }
-    
-    
     // ***** Member Variables *****
     
 	Node<DataType>& input_;
 	bool autoCalculate_;        // Whether we're automatically calculating new output values
 	DataType missingValue_ = DataType();
 
-    // Variables below are for filter calculation. We need to hold the past input samples
-    // ourselves because we can't consistently count on enough samples in the source buffer.
-    // Likewise, we need to hold past output samples, even though we have our own buffer, because
-    // when we clear the buffer for new calculations we don't want to lose what we've previously
-    // calculated.
-    boost::circular_buffer<DataType>* inputHistory_;
-    boost::circular_buffer<DataType>* outputHistory_;
-    std::vector<DataType> aCoefficients_, bCoefficients_;
+    // The kernel holds its own past input and output samples, because we can't consistently
+    // count on enough samples in the source buffer. Likewise, it holds past output samples
+    // even though we have our own buffer, because when we clear the buffer for new calculations
+    // we don't want to lose what we've previously calculated.
+    IIRFilterKernel<DataType, Order> kernel_;
+    std::vector<DataType> block_;           // Results of processBlock() before they are inserted
     typename Node<DataType>::size_type lastInputIndex_;              // Where in the input buffer we had the last sample
 };
 
+/*
+ * MultiChannelIIRFilter
+ *
+ * The same fixed-order filter (order 1 or 2, direct form II transposed) run over many
+ * independent channels, e.g. one per key, which all receive a sample at the same time.
+ * The state is kept as one array per state variable with a slot for each channel, so
+ * processing a frame is a loop over channels with no dependency from one to the next,
+ * which the compiler can turn into SIMD instructions.
+ */
+
+template<typename DataType, int Order>
+class MultiChannelIIRFilter {
+public:
+    // ***** Constructor *****
+    
+    explicit MultiChannelIIRFilter(size_t numChannels) : z1_(numChannels), z2_(numChannels) {
+        for(int i = 0; i < 3; i++)
+            b_[i] = a_[i] = DataType();
+    }
+    
+    // ***** Modifiers *****
+    
+    // Set the coefficients shared by all channels; returns false if they are not of order Order
+    bool setCoefficients(std::vector<DataType> const& bCoeffs, std::vector<DataType> const& aCoeffs) {
+        if(bCoeffs.size() != Order + 1 || aCoeffs.size() != Order)
+            return false;
+        for(int i = 0; i <= Order; i++)
+            b_[i] = bCoeffs[i];
+        for(int i = 0; i < Order; i++)
+            a_[i + 1] = aCoeffs[i];
+        return true;
+    }
+    
+    // Clear the state of every channel, or of one channel
+    void reset() {
+        std::fill(z1_.begin(), z1_.end(), DataType());
+        std::fill(z2_.begin(), z2_.end(), DataType());
+    }
+    void reset(size_t channel) { z1_[channel] = z2_[channel] = DataType(); }
+    
+    size_t numChannels() const { return z1_.size(); }
+    
+    // ***** Evaluator *****
+    
+    // Filter one frame of numChannels() samples from input into output, which may be the same array
+    void process(const DataType* input, DataType* output) {
+        const size_t numChannels = z1_.size();
+        const DataType b0 = b_[0], b1 = b_[1], a1 = a_[1];
+        DataType* z1 = z1_.data();
+        
+        if(Order == 1) {
+            for(size_t ch = 0; ch < numChannels; ch++) {
+                DataType x = input[ch];
+                DataType y = b0 * x + z1[ch];
+                z1[ch] = b1 * x - a1 * y;
+                output[ch] = y;
+            }
+        }
+        else {
+            const DataType b2 = b_[2], a2 = a_[2];
+            DataType* z2 = z2_.data();
+            for(size_t ch = 0; ch < numChannels; ch++) {
+                DataType x = input[ch];
+                DataType y = b0 * x + z1[ch];
+                z1[ch] = b1 * x - a1 * y + z2[ch];
+                z2[ch] = b2 * x - a2 * y;
+                output[ch] = y;
+            }
+        }
+    }
+    
+private:
+    static_assert(Order == 1 || Order == 2, "MultiChannelIIRFilter only supports orders 1 and 2");
+    
+    DataType b_[3];                     // B0...BN; unused ones are 0
+    DataType a_[3];                     // A1...AN in a_[1] onwards; a_[0] unused
+    std::vector<DataType> z1_, z2_;     // State, one entry per channel
+};
+
 // ***** Static Filter Design Methods *****
 
 // These methods calculate specific coefficients and store them in the provided
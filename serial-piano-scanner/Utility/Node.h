@@ -33,17 +33,19 @@
 #include <iostream>
 #include <set>
 #include <cmath>
+#include <algorithm>
+#include <atomic>
 #include <stdint.h>
 #include <boost/circular_buffer.hpp>
 #include <boost/container/allocator_traits.hpp>
 #include <boost/circular_buffer/details.hpp>
-#include <boost/lambda/lambda.hpp>
 #include <boost/iterator.hpp>
 #include <boost/iterator/reverse_iterator.hpp>
 #include <boost/fusion/iterator/prior.hpp>
 #include <boost/fusion/include/prior.hpp>
 #include "Types.h"
 #include "Trigger.h"
+#include "NodeStorage.h"
 //#include "../JuceLibraryCode/JuceHeader.h"
 
 
@@ -54,7 +56,7 @@ template<typename OutputType> class Node;
  * NodeIterator
  *
  * Abstract class that implements common functionality for all types of Sources and Filters
- * Modeled on (and contains) boost::cb_details::iterator
+ * Modeled on boost::cb_details::iterator, but holds the absolute index of a sample
  * See boost/circular_buffer/details.hpp for more information
  *
  */
@@ -78,9 +80,6 @@ struct NodeIterator :
 
 	typedef NodeNonInterpolating<OutputType> Buff;
 
-	typedef NodeIterator<Buff, typename Traits::nonconst_self, NonConstTraits> nonconst_self;
-	typedef typename boost::cb_details::iterator<boost::circular_buffer<OutputType>, NonConstTraits> cb_iterator;
-
 	typedef typename base_iterator::value_type value_type;
 	typedef typename base_iterator::pointer pointer;
 	typedef typename base_iterator::reference reference;
@@ -92,19 +91,19 @@ struct NodeIterator :
     // Pointer to the Node object
 	Buff* m_buff;
 
-	// Base (non-const) iterator to the circular buffer
-	cb_iterator m_cb_it;
+	// Absolute index of the sample within the Node
+	size_type m_index;
 
 	// ***** Constructors *****
 
 	// Default constructor
-	NodeIterator() : m_buff(0), m_cb_it(cb_iterator()) {}
+	NodeIterator() : m_buff(0), m_index(0) {}
 
 	// Copy constructor
-	NodeIterator(const nonconst_self& it) : m_cb_it(it.m_cb_it) {}
+	NodeIterator(const NodeIterator& it) : m_buff(it.m_buff), m_index(it.m_index) {}
 
-	// Constructor based on a circular_buffer iterator
-	NodeIterator(Buff* cb, const cb_iterator cb_it) : m_buff(cb), m_cb_it(cb_it) {}
+	// Constructor based on an absolute index
+	NodeIterator(Buff* cb, size_type index) : m_buff(cb), m_index(index) {}
 
 	// ***** Operators *****
 	//
@@ -114,15 +113,14 @@ struct NodeIterator :
         if (this == &it)
             return *this;
         m_buff = it.m_buff;
-        m_cb_it = it.m_cb_it;
+        m_index = it.m_index;
         return *this;
     }
 
-	// Dereferencing operator.  We change the behavior here to evaluate missing values as needed.
-	// Note that this requires m_cb_it to be a non_const type, even if we are a const iterator.
+	// Dereferencing operator.
 
     reference operator * () const {
-		return *m_cb_it;
+		return m_buff->storage_.value(m_index);
 		//reference val = *m_cb_it;
 		//if(!missing_value<OutputType>::isMissing(val))
 		//	return val;
@@ -132,32 +130,34 @@ struct NodeIterator :
 	pointer operator -> () const { return &(operator*()); }
 
     template <class Traits0, class Traits1>
-    difference_type operator - (const NodeIterator<OutputType, Traits0, Traits1>& it) const { return m_cb_it - it.m_cb_it; }
+    difference_type operator - (const NodeIterator<OutputType, Traits0, Traits1>& it) const {
+		return (difference_type)m_index - (difference_type)it.m_index;
+	}
 
     NodeIterator& operator ++ () {			// ++it
-		++m_cb_it;
+		++m_index;
 		return *this;
 	}
 	NodeIterator operator ++ (int) {		// it++
 		NodeIterator<OutputType, Traits, NonConstTraits> tmp = *this;
-		++m_cb_it;
+		++m_index;
 		return tmp;
 	}
 	NodeIterator& operator -- () {			// --it
-		--m_cb_it;
+		--m_index;
 		return *this;
 	}
 	NodeIterator operator -- (int) {		// it--
 		NodeIterator<OutputType, Traits, NonConstTraits> tmp = *this;
-		m_cb_it--;
+		m_index--;
 		return tmp;
 	}
     NodeIterator& operator += (difference_type n) {		// it += n
-		m_cb_it += n;
+		m_index += n;
         return *this;
     }
     NodeIterator& operator -= (difference_type n) {		// it -= n
-		m_cb_it -= n;
+		m_index -= n;
         return *this;
     }
 
@@ -203,7 +203,7 @@ struct NodeIterator :
 	// of two iterators, even if they don't refer to the same buffer
 
 	size_type index() const {
-		return (size_type)(*this - m_buff->begin() + m_buff->firstSampleIndex_);
+		return m_index;
 	}
 
 	// Return the timestamp associated with the sample this iterator points to
@@ -634,22 +634,21 @@ protected:
 template<typename OutputType>
 class NodeNonInterpolating : public NodeBase {
 public:
-	// Useful type shorthands.  See <boost/circular_buffer.hpp> for details.
+	// Useful type shorthands, following <boost/circular_buffer.hpp>.
     typedef typename boost::cb_details::allocator_traits<std::allocator<OutputType> > Alloc;
 
-	typedef typename boost::circular_buffer<OutputType,Alloc>::value_type value_type;
-	typedef typename boost::circular_buffer<OutputType,Alloc>::pointer pointer;
-	typedef typename boost::circular_buffer<OutputType,Alloc>::const_pointer const_pointer;
-	typedef typename boost::circular_buffer<OutputType,Alloc>::reference reference;
-	typedef typename boost::circular_buffer<OutputType,Alloc>::const_reference const_reference;
-	typedef typename boost::circular_buffer<OutputType,Alloc>::difference_type difference_type;
-	//typedef typename boost::circular_buffer<OutputType,Alloc>::size_type size_type;
-	typedef typename boost::circular_buffer<OutputType,Alloc>::capacity_type capacity_type;
-	typedef typename boost::circular_buffer<OutputType,Alloc>::array_range array_range;
-	typedef typename boost::circular_buffer<OutputType,Alloc>::const_array_range const_array_range;
-	typedef typename boost::circular_buffer<OutputType,Alloc>::param_value_type return_value_type;
+	typedef OutputType value_type;
+	typedef OutputType* pointer;
+	typedef const OutputType* const_pointer;
+	typedef OutputType& reference;
+	typedef const OutputType& const_reference;
+	typedef std::ptrdiff_t difference_type;
+	typedef size_type capacity_type;
+	typedef typename NodeStorage<OutputType>::const_reference return_value_type;	// A copy for packed types
+	typedef typename NodeStorage<OutputType>::stored_type stored_type;
 
 	// We only support const iterators.  (Modifying data in the buffer is restricted to only a few specialized instances.)
+	// Like span(), they are not available for types stored packed.
 
 	typedef NodeIterator<OutputType, boost::cb_details::const_traits<Alloc>,
 											 boost::cb_details::nonconst_traits<Alloc> > const_iterator;
@@ -663,30 +662,18 @@ public:
 
 	//Node() : buffer_(0), insertMissingLastTimestamp_(0), numSamples_(0), firstSampleIndex_(0) {}	
 
-	// Recommended constructor: specify the capacity in samples
-	explicit NodeNonInterpolating(capacity_type capacity) : insertMissingLastTimestamp_(0), buffer_(0), numSamples_(0), firstSampleIndex_(0) {
-		buffer_ = new boost::circular_buffer<OutputType>(capacity);
-		timestamps_ = new boost::circular_buffer<timestamp_type>(capacity);
-	}
+	// Recommended constructor: specify the capacity in samples. The capacity is rounded up to
+	// a power of two.
+	explicit NodeNonInterpolating(capacity_type capacity) : insertMissingLastTimestamp_(0), storage_(capacity), sortedFromIndex_(0),
+	  sequence_(0), singleWriter_(false) {}
 
 	// Copy constructor
-	NodeNonInterpolating(const NodeNonInterpolating<OutputType>& obj) : numSamples_(obj.numSamples_), firstSampleIndex_(obj.firstSampleIndex_) {
-		if(obj.buffer_ != 0)
-			this->buffer_ = new boost::circular_buffer<OutputType>(*obj.buffer_);
-		else
-			this->buffer_ = 0;
-		if(obj.timestamps_ != 0)
-			timestamps_ = new boost::circular_buffer<timestamp_type>(*obj.timestamps_);
-		else
-			this->timestamps_ = 0;
-	}
+	NodeNonInterpolating(const NodeNonInterpolating<OutputType>& obj) : insertMissingLastTimestamp_(0), storage_(obj.storage_), sortedFromIndex_(obj.sortedFromIndex_),
+	  sequence_(0), singleWriter_(obj.singleWriter_) {}
 
 	// ***** Destructor *****
 
-	virtual ~NodeNonInterpolating() {
-		delete buffer_;
-		delete timestamps_;
-	}
+	virtual ~NodeNonInterpolating() {}
 
 	// ***** Circular Buffer (STL) Methods *****
 	//
@@ -696,22 +683,26 @@ public:
 
 	// ***** Accessors *****
 
-	const_iterator begin() { return const_iterator(this, buffer_->begin()); }
-	const_iterator end() { return const_iterator(this, buffer_->end()); }
+	const_iterator begin() { return const_iterator(this, storage_.beginIndex()); }
+	const_iterator end() { return const_iterator(this, storage_.endIndex()); }
 	const_reverse_iterator rbegin() { return const_reverse_iterator(end()); }
 	const_reverse_iterator rend() { return const_reverse_iterator(begin()); }
 
-	const_iterator iteratorAtIndex(size_type index) { return const_iterator(this, buffer_->begin()) + (index - firstSampleIndex_); }
+	const_iterator iteratorAtIndex(size_type index) { return const_iterator(this, index); }
 	const_reverse_iterator riteratorAtIndex(size_type index) { return const_reverse_iterator(iteratorAtIndex(index+1)); }
 
-	return_value_type operator [] (size_type index) { return (*(this->buffer_))[index-this->firstSampleIndex_]; }
-	return_value_type at(size_type index) { return this->buffer_->at(index-this->firstSampleIndex_); }
-	return_value_type front() { return this->buffer_->front(); }
-	return_value_type back() { return this->buffer_->back(); }
+	return_value_type operator [] (size_type index) { return storage_.value(index); }
+	return_value_type at(size_type index) { return storage_.valueAt(index); }
+	return_value_type front() { return storage_.value(storage_.beginIndex()); }
+	return_value_type back() { return storage_.value(storage_.endIndex() - 1); }
 
 	// Two more convenience methods to avoid confusion about what front and back mean!
-	return_value_type earliest() { return this->buffer_->front(); }
-	return_value_type latest() { return this->buffer_->back(); }
+	return_value_type earliest() { return front(); }
+	return_value_type latest() { return back(); }
+
+	// The sample as it is kept in the buffer, which for packed types (see NodeValueTraits)
+	// lets single fields be read without expanding the whole value
+	const stored_type& stored(size_type index) { return storage_.stored(index); }
 
 	// In the following methods, check whether the value is missing and calculate it as necessary
 	// These methods return a value_type (i.e. not a reference, can't be used to modify the buffer.)
@@ -742,42 +733,109 @@ public:
 		return (buffer_->back() = evaluate(buffer_->size() - 1 + firstSampleIndex_));
 	}*/
 
-	size_type size() { return buffer_->size(); }					// Size: how many elements are currently in the buffer
-	bool empty() { return buffer_->empty(); }
-	bool full() { return buffer_->full(); }
-	size_type reserve() { return buffer_->reserve(); }				// Reserve: how many elements are left before the buffer is full
-	size_type capacity() const { return buffer_->capacity(); }		// Capacity: how many elements could be in the buffer
+	size_type size() { return storage_.size(); }					// Size: how many elements are currently in the buffer
+	bool empty() { return storage_.empty(); }
+	bool full() { return storage_.full(); }
+	size_type reserve() { return storage_.reserve(); }				// Reserve: how many elements are left before the buffer is full
+	size_type capacity() const { return storage_.capacity(); }		// Capacity: how many elements could be in the buffer
 
-	size_type beginIndex() { return firstSampleIndex_; }					// Index of the first sample we still have in the buffer
-	size_type endIndex() { return firstSampleIndex_ + buffer_->size(); }	// Index just past the end of the buffer
+	size_type beginIndex() { return storage_.beginIndex(); }		// Index of the first sample we still have in the buffer
+	size_type endIndex() { return storage_.endIndex(); }			// Index just past the end of the buffer
 
 	// ***** Modifiers *****
 
-	// Clear all stored samples and timestamps
+	// Clear all stored samples and timestamps. This always takes the mutex, even for a
+	// single-writer Node, but must still come from the writing thread in that case.
 	void clear() {
 		bufferAccessMutex_.enter();
-		timestamps_->clear();
-		buffer_->clear();
-		numSamples_ = firstSampleIndex_ = 0;
+		writeBegin();
+		storage_.clear();
+		sortedFromIndex_ = 0;
+		writeEnd();
 		bufferAccessMutex_.exit();
 
 		//notifyListenersOfClear();
 	}
 
+	// Change the capacity, which clears the buffer. The old storage is freed straight away,
+	// so this is for setting up: nothing else may be reading the buffer without the mutex.
+	void setCapacity(capacity_type capacity) {
+		bufferAccessMutex_.enter();
+		writeBegin();
+		storage_.setCapacity(capacity);
+		sortedFromIndex_ = 0;
+		writeEnd();
+		bufferAccessMutex_.exit();
+	}
+
+	// Memory allocated for samples and timestamps, and how much of it has been used so far
+	size_t allocatedBytes() const { return storage_.allocatedBytes(); }
+	size_t usedBytes() const { return storage_.usedBytes(); }
+
 	// Insert a new item into the buffer
 	void insert(const OutputType& item, timestamp_type timestamp) {
-		this->bufferAccessMutex_.enter();
-		if(this->buffer_->full())
-			this->firstSampleIndex_++;
-		this->timestamps_->push_back(timestamp);
-		this->buffer_->push_back(item);
-		this->numSamples_++;
-		this->bufferAccessMutex_.exit();
+		if(!singleWriter_)
+			this->bufferAccessMutex_.enter();
+		writeBegin();
+		if(!storage_.empty() && timestamp < storage_.timestamp(storage_.endIndex() - 1))
+			this->sortedFromIndex_ = storage_.endIndex();	// Out of order: timestamps are only sorted from here on
+		storage_.push_back(item, timestamp);
+		writeEnd();
+		if(!singleWriter_)
+			this->bufferAccessMutex_.exit();
 
 		// Notify anyone who's listening for a trigger
 		this->sendTrigger(timestamp);
 	}
 
+	// Insert count samples at once from arrays of values and timestamps, which must be in
+	// order. This takes the mutex once and sends a single trigger, with the last timestamp,
+	// so listeners that only look at latest() will not see the earlier samples; filters
+	// should be brought up to date with their block methods instead.
+	void insertBlock(const OutputType* items, const timestamp_type* timestamps, size_type count) {
+		if(count == 0)
+			return;
+		if(!singleWriter_)
+			this->bufferAccessMutex_.enter();
+		writeBegin();
+		if(!storage_.empty() && timestamps[0] < storage_.timestamp(storage_.endIndex() - 1))
+			this->sortedFromIndex_ = storage_.endIndex();
+		storage_.append(items, timestamps, count);
+		writeEnd();
+		if(!singleWriter_)
+			this->bufferAccessMutex_.exit();
+
+		this->sendTrigger(timestamps[count - 1]);
+	}
+
+	// Find the samples from index onwards (up to count of them) which are contiguous in memory.
+	// Sets values and timestamps to point to them and returns how many there are; call again
+	// from index plus that number for the rest. Not available for types stored packed.
+	size_type span(size_type index, size_type count, const OutputType*& values, const timestamp_type*& timestamps) {
+		values = &storage_.stored(index);
+		timestamps = &storage_.timestamp(index);
+		return storage_.contiguous(index, count);
+	}
+
+	// Copy out the latest sample and its timestamp, retrying if a write happens at the same
+	// time. Safe to call from any thread without the mutex. Returns false if the buffer is empty.
+	bool latestSample(OutputType& value, timestamp_type& timestamp) {
+		for(;;) {
+			uint32_t sequence = sequence_.load(std::memory_order_acquire);
+			if(sequence & 1)
+				continue;		// Write in progress
+			size_type end = storage_.endIndex();
+			bool found = (end != storage_.beginIndex());
+			if(found) {
+				value = storage_.value(end - 1);
+				timestamp = storage_.timestamp(end - 1);
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if(sequence_.load(std::memory_order_relaxed) == sequence)
+				return found;
+		}
+	}
+
 	// Insert a "missing" item into the buffer.  This is really for the Filter subclasses, but we should provide an implementation
 	/*void insertMissing(timestamp_type timestamp) {		
 		if(timestamp == insertMissingLastTimestamp_)
@@ -799,7 +857,7 @@ protected:
 	// name to avoid confusion with the behavior of [] and at(), which call evaluate() if the sample
 	// is missing.
 
-	reference rawValueAt(size_type index) { return (*buffer_)[index-firstSampleIndex_]; }
+	reference rawValueAt(size_type index) { return storage_.stored(index); }
 
 public:
 	// ***** Timestamp Methods *****
@@ -808,33 +866,35 @@ public:
 	// with the Source of any particular sample.  We also support methods to return an iterator to a piece of data most closely
 	// matching a given timestamp.
 
-	timestamp_type timestampAt(size_type index) { return timestamps_->at(index-this->firstSampleIndex_); }
-	timestamp_type latestTimestamp() { return timestamps_->back(); }
-	timestamp_type earliestTimestamp() { return timestamps_->front(); }
+	timestamp_type timestampAt(size_type index) { return storage_.timestampAt(index); }
+	timestamp_type latestTimestamp() { return storage_.timestamp(storage_.endIndex() - 1); }
+	timestamp_type earliestTimestamp() { return storage_.timestamp(storage_.beginIndex()); }
 
 	size_type indexNearestBefore(timestamp_type t) {
-		boost::circular_buffer<timestamp_type>::iterator it = std::find_if(timestamps_->begin(), timestamps_->end(), t < boost::lambda::_1);
-		if(it == timestamps_->end())
-			return timestamps_->size()-1+this->firstSampleIndex_;
-		if(it - timestamps_->begin() == 0)
-			return this->firstSampleIndex_;
-		return (size_type)((--it) - timestamps_->begin()) + this->firstSampleIndex_;
+		size_type after = timestampUpperBound(t);
+		if(after == storage_.endIndex())
+			return storage_.endIndex()-1;
+		if(after == storage_.beginIndex())
+			return storage_.beginIndex();
+		return after - 1;
 	}
 	size_type indexNearestAfter(timestamp_type t) {
-		boost::circular_buffer<timestamp_type>::iterator it = std::find_if(timestamps_->begin(), timestamps_->end(), t < boost::lambda::_1);
-		return std::min<size_type>((it - timestamps_->begin()), timestamps_->size()-1) + this->firstSampleIndex_;
+		size_type after = timestampUpperBound(t);
+		if(after == storage_.endIndex())
+			return storage_.endIndex()-1;
+		return after;
 	}
 	size_type indexNearestTo(timestamp_type t) {
-		boost::circular_buffer<timestamp_type>::iterator it = std::find_if(timestamps_->begin(), timestamps_->end(), t < boost::lambda::_1);
-		if(it == timestamps_->end())
-			return timestamps_->size()-1+this->firstSampleIndex_;
-		if(it - timestamps_->begin() == 0)
-			return this->firstSampleIndex_;
-		timestamp_diff_type after = *it - t;		// Calculate the distance between the desired timestamp and the before/after values,
-		timestamp_diff_type before = t - *(it-1);	// then return whichever index gets closer to the target.
-		if(after < before)
-			return (size_type)(it - timestamps_->begin()) + this->firstSampleIndex_;
-		return (size_type)((--it) - timestamps_->begin()) + this->firstSampleIndex_;
+		size_type after = timestampUpperBound(t);
+		if(after == storage_.endIndex())
+			return storage_.endIndex()-1;
+		if(after == storage_.beginIndex())
+			return storage_.beginIndex();
+		timestamp_diff_type afterDistance = storage_.timestamp(after) - t;		// Calculate the distance between the desired timestamp and the before/after values,
+		timestamp_diff_type beforeDistance = t - storage_.timestamp(after-1);	// then return whichever index gets closer to the target.
+		if(afterDistance < beforeDistance)
+			return after;
+		return after - 1;
 	}
 
 	const_iterator nearestTo(timestamp_type t) { return begin() + (difference_type)indexNearestTo(t); }
@@ -846,17 +906,42 @@ public:
 	const_reverse_iterator rnearestAfter(timestamp_type t) { return rend() - (difference_type)indexNearestAfter(t); }
 
 private:
+	// Index of the first sample with a timestamp later than t, or endIndex() if there is none.
+	// Timestamps are normally in order, so this is a binary search. If a timestamp was ever
+	// inserted out of order and is still in the buffer, the samples before it are scanned
+	// linearly first, which gives the same result as a linear search of the whole buffer.
+	size_type timestampUpperBound(timestamp_type t) {
+		size_type sorted = storage_.beginIndex();
+
+		if(sortedFromIndex_ - storage_.beginIndex() < storage_.size()) {
+			for(; sorted != sortedFromIndex_; sorted++) {
+				if(t < storage_.timestamp(sorted))
+					return sorted;
+			}
+		}
+		return storage_.timestampUpperBound(sorted, t);
+	}
+
 	// Calculate the actual value of one sample.  Behavior of this method will be different for Source and Filter types.
 	// virtual OutputType evaluate(size_type index) = 0;
 
 	timestamp_type insertMissingLastTimestamp_;	// The last timestamp that came from insertMissing(), so we can avoid duplication	
 
 protected:
-	boost::circular_buffer<OutputType> *buffer_;			// Internal buffer to store or cache values
-	boost::circular_buffer<timestamp_type> *timestamps_;	// Internal buffer to hold timestamps for each value
+	NodeStorage<OutputType> storage_;				// Values and their timestamps
+	size_type sortedFromIndex_;						// Timestamps are in order from this sample index onwards
+
+	// Sequence counter for lock-free readers: odd while a write is in progress
+	void writeBegin() {
+		sequence_.store(sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+	void writeEnd() {
+		sequence_.store(sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
 
-	size_type numSamples_;							// How many samples total we've stored in this buffer
-	size_type firstSampleIndex_;					// Index of the first sample that still remains in the buffer
+	std::atomic<uint32_t> sequence_;
+	bool singleWriter_;								// If true, insert() is only ever called from one thread and skips the mutex
 };
 
 /*
@@ -891,10 +976,10 @@ public:
 	return_value_type interpolate(double index) {
 		size_type before = floor(index);				// Find the sample before the interpolated location
 		double frac = index - (double)before;			// Find the fractional remainder component
-		OutputType val1 = this->buffer_->at(before-this->firstSampleIndex_);
+		OutputType val1 = this->storage_.valueAt(before);
 		if(before == this->endIndex()-1)
 			return val1;
-		OutputType val2 = this->buffer_->at(before+1-this->firstSampleIndex_);
+		OutputType val2 = this->storage_.valueAt(before+1);
 		//if(missing_value<OutputType>::isMissing(val1))	// Make sure both values have been calculated
 		//	val1 = (buffer_->at(before-firstSampleIndex_) = evaluate(before));
 		//if(missing_value<OutputType>::isMissing(val2))
@@ -925,7 +1010,7 @@ public:
 	// Timestamp --> fractional index
 	double interpolatedIndexForTimestamp(timestamp_type timestamp) {
 		size_type before = this->indexNearestBefore(timestamp);
-		if(before >= this->timestamps_->size() - 1 + this->firstSampleIndex_)		// If it's at the end of the buffer, return the last available timestamp
+		if(before >= this->endIndex() - 1)		// If it's at the end of the buffer, return the last available timestamp
 			return (double)before;
 		timestamp_type beforeTimestamp = this->timestampAt(before);			// Get the timestamp immediately before
 		if(beforeTimestamp >= timestamp)								// If it comes after the requested timestamp, we're at the beginning of the buffer
@@ -936,4 +1021,27 @@ public:
 	}
 };
 
+/*
+ * SingleWriterNode
+ *
+ * A Node which is only ever written from one thread, for high-rate sources such as raw sensor data.
+ * insert() does not take the buffer mutex; other threads read the most recent sample with
+ * latestSample(), which retries if it overlaps a write. lock_mutex() still excludes clear() but
+ * no longer excludes insert(), so readers holding it will see samples appear at the end of the
+ * buffer. Samples already present do not change until the buffer wraps around.
+ */
+
+template<typename OutputType>
+class SingleWriterNode : public Node<OutputType> {
+public:
+	typedef typename Node<OutputType>::capacity_type capacity_type;
+
+	// ***** Constructors *****
+
+	explicit SingleWriterNode(capacity_type capacity) : Node<OutputType>(capacity) {
+		this->singleWriter_ = true;
+	}
+	SingleWriterNode(SingleWriterNode<OutputType> const& obj) : Node<OutputType>(obj) {}
+};
+
 #endif /* KEYCONTROL_NODE_H */
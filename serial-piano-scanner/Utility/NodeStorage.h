@@ -0,0 +1,283 @@
+/*
+  TouchKeys: multi-touch musical keyboard control software
+  Copyright (c) 2013 Andrew McPherson
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  =====================================================================
+
+  NodeStorage.h: ring storage for the samples and timestamps held by a Node.
+*/
+
+#ifndef KEYCONTROL_NODE_STORAGE_H
+#define KEYCONTROL_NODE_STORAGE_H
+
+#include <new>
+#include <atomic>
+#include <stdexcept>
+#include <algorithm>
+#include <stdint.h>
+#include <stdlib.h>
+#include "Types.h"
+
+/*
+ * NodeStorage
+ *
+ * Fixed-capacity ring of samples and their timestamps. The values and the timestamps are
+ * two arrays side by side in a single cache-line-aligned allocation, so walking through
+ * either one touches memory in order. Capacity is rounded up to a power of two.
+ *
+ * Samples are addressed by absolute index: the number of samples inserted before them
+ * since the last clear(). The slot holding a sample is its index masked by the capacity,
+ * so no offset from the start of the ring needs to be tracked. Once more samples have
+ * been inserted than the capacity, the oldest are overwritten and beginIndex() advances.
+ *
+ * Values are constructed as their slots are first used and assigned after that, so a
+ * large buffer that never fills does not touch all of its memory. Slots are always
+ * constructed in order from 0, so those below constructed_ are the ones to destroy.
+ *
+ * A type can specialize NodeValueTraits to be kept in the ring in a more compact form. It
+ * is then packed on the way in and expanded again each time it is read, so value() returns
+ * a copy rather than a reference, and value types and the stored type differ.
+ *
+ * There is only ever one writer. The indices are published with release stores after
+ * the sample is written, so another thread that reads endIndex() sees complete samples
+ * below it. That thread can still see a slot being overwritten once the ring wraps;
+ * Node uses a sequence counter to detect that where it matters.
+ */
+
+// How NodeStorage keeps values of type T. By default they are stored as they are.
+template<typename T>
+struct NodeValueTraits {
+	typedef T stored_type;					// What goes in the ring
+	typedef const T& const_reference;		// What reading a value returns
+
+	static const stored_type& pack(const T& value) { return value; }
+	static const_reference expand(const stored_type& stored) { return stored; }
+};
+
+template<typename T>
+class NodeStorage {
+public:
+	typedef uint32_t size_type;
+	typedef NodeValueTraits<T> traits_type;
+	typedef typename traits_type::stored_type stored_type;
+	typedef typename traits_type::const_reference const_reference;
+
+	static const size_t kAlignment = 64;	// Cache line size
+
+	// ***** Constructors *****
+
+	explicit NodeStorage(size_type capacity) : block_(0), values_(0), timestamps_(0),
+	  mask_(0), constructed_(0), begin_(0), end_(0) {
+		size_type size = 1;
+		while(size < capacity)
+			size <<= 1;
+		allocate(size);
+	}
+
+	NodeStorage(const NodeStorage<T>& obj) : block_(0), values_(0), timestamps_(0),
+	  mask_(0), constructed_(0), begin_(obj.beginIndex()), end_(obj.endIndex()) {
+		allocate(obj.mask_ + 1);
+		for(; constructed_ < obj.constructed_; constructed_++)
+			new (&values_[constructed_]) stored_type(obj.values_[constructed_]);
+		std::copy(obj.timestamps_, obj.timestamps_ + obj.constructed_, timestamps_);
+	}
+
+	NodeStorage& operator = (const NodeStorage<T>& obj) {
+		if(this != &obj) {
+			NodeStorage<T> copy(obj);
+			swap(copy);
+		}
+		return *this;
+	}
+
+	// ***** Destructor *****
+
+	~NodeStorage() {
+		release();
+	}
+
+	// ***** Status *****
+
+	size_type capacity() const { return mask_ + 1; }
+	size_type size() const {
+		size_type end = endIndex();
+		return end - beginIndex();
+	}
+	bool empty() const { return size() == 0; }
+	bool full() const { return size() == capacity(); }
+	size_type reserve() const { return capacity() - size(); }
+
+	// Memory held by the ring, and how much of it has been written to so far
+	size_t allocatedBytes() const { return valuesBytes(capacity()) + capacity() * sizeof(timestamp_type); }
+	size_t usedBytes() const { return constructed_ * (sizeof(stored_type) + sizeof(timestamp_type)); }
+
+	// Index of the oldest sample
+	size_type beginIndex() const { return begin_.load(std::memory_order_acquire); }
+	// Index just past the newest sample
+	size_type endIndex() const { return end_.load(std::memory_order_acquire); }
+
+	// ***** Modifiers *****
+
+	// Forget all the samples and start the indices again from 0
+	void clear() {
+		begin_.store(0, std::memory_order_release);
+		end_.store(0, std::memory_order_release);
+	}
+
+	// Replace the ring with one of a different capacity (rounded up to a power of two).
+	// Like clear(), this forgets all the samples and starts the indices again from 0.
+	void setCapacity(size_type capacity) {
+		NodeStorage<T> resized(capacity);
+		swap(resized);
+	}
+
+	// Add a sample, overwriting the oldest one if full
+	void push_back(const T& value, timestamp_type timestamp) {
+		size_type begin = begin_.load(std::memory_order_relaxed);
+		size_type end = end_.load(std::memory_order_relaxed);
+
+		write(end & mask_, value, timestamp);
+		if(end - begin > mask_)
+			begin_.store(begin + 1, std::memory_order_release);
+		end_.store(end + 1, std::memory_order_release);
+	}
+
+	// Add count samples from arrays of values and timestamps
+	void append(const T* values, const timestamp_type* timestamps, size_type count) {
+		size_type begin = begin_.load(std::memory_order_relaxed);
+		size_type end = end_.load(std::memory_order_relaxed);
+
+		if(count > capacity()) {	// Only the last capacity() samples survive
+			values += count - capacity();
+			timestamps += count - capacity();
+			end += count - capacity();
+			count = capacity();
+		}
+		for(size_type i = 0; i < count; i++)
+			write((end + i) & mask_, values[i], timestamps[i]);
+		end += count;
+		if(end - begin > capacity())
+			begin_.store(end - capacity(), std::memory_order_release);
+		end_.store(end, std::memory_order_release);
+	}
+
+	// ***** Accessors *****
+	//
+	// These take absolute indices and do no range checking, except for the at() versions.
+	// stored() gives direct access to what is in the ring.
+
+	const_reference value(size_type index) const { return traits_type::expand(values_[index & mask_]); }
+	stored_type& stored(size_type index) { return values_[index & mask_]; }
+	timestamp_type& timestamp(size_type index) { return timestamps_[index & mask_]; }
+	timestamp_type timestamp(size_type index) const { return timestamps_[index & mask_]; }
+
+	// How many of the count samples starting at index are stored contiguously, i.e. before
+	// the ring wraps around; stored(index) and timestamp(index) then start arrays of that length
+	size_type contiguous(size_type index, size_type count) const {
+		size_type toWrap = capacity() - (index & mask_);
+		return count < toWrap ? count : toWrap;
+	}
+
+	const_reference valueAt(size_type index) const {
+		checkIndex(index);
+		return traits_type::expand(values_[index & mask_]);
+	}
+	timestamp_type timestampAt(size_type index) const {
+		checkIndex(index);
+		return timestamps_[index & mask_];
+	}
+
+	// Index of the first sample in [from, endIndex()) with a timestamp later than t, or
+	// endIndex() if there is none. Timestamps over that range must be in order.
+	size_type timestampUpperBound(size_type from, timestamp_type t) const {
+		size_type count = endIndex() - from;
+
+		while(count > 0) {
+			size_type half = count >> 1;
+			if(t < timestamps_[(from + half) & mask_])
+				count = half;
+			else {
+				from += half + 1;
+				count -= half + 1;
+			}
+		}
+		return from;
+	}
+
+private:
+	void checkIndex(size_type index) const {
+		size_type begin = beginIndex();
+		if(index - begin >= endIndex() - begin)
+			throw std::out_of_range("NodeStorage: index out of range");
+	}
+
+	// Store a sample in the given slot. A slot past constructed_ is reached directly only
+	// when append() skips ahead; the slots in between are constructed from the same value
+	// first, and the rest of that append() overwrites them.
+	void write(size_type slot, const T& value, timestamp_type timestamp) {
+		if(slot < constructed_)
+			values_[slot] = traits_type::pack(value);
+		else {
+			for(; constructed_ <= slot; constructed_++)
+				new (&values_[constructed_]) stored_type(traits_type::pack(value));
+		}
+		timestamps_[slot] = timestamp;
+	}
+
+	// Values first, then timestamps starting on the next cache line
+	static size_t valuesBytes(size_type capacity) {
+		return (capacity * sizeof(stored_type) + kAlignment - 1) & ~(kAlignment - 1);
+	}
+
+	void allocate(size_type capacity) {
+		if(posix_memalign(&block_, kAlignment, valuesBytes(capacity) + capacity * sizeof(timestamp_type)) != 0)
+			throw std::bad_alloc();
+		values_ = static_cast<stored_type*>(block_);
+		timestamps_ = reinterpret_cast<timestamp_type*>(static_cast<char*>(block_) + valuesBytes(capacity));
+		mask_ = capacity - 1;
+	}
+
+	void release() {
+		for(size_type i = 0; i < constructed_; i++)
+			values_[i].~stored_type();
+		free(block_);
+		block_ = 0;
+		constructed_ = 0;
+	}
+
+	void swap(NodeStorage<T>& obj) {
+		std::swap(block_, obj.block_);
+		std::swap(values_, obj.values_);
+		std::swap(timestamps_, obj.timestamps_);
+		std::swap(mask_, obj.mask_);
+		std::swap(constructed_, obj.constructed_);
+		size_type begin = beginIndex(), end = endIndex();
+		begin_.store(obj.beginIndex());
+		end_.store(obj.endIndex());
+		obj.begin_.store(begin);
+		obj.end_.store(end);
+	}
+
+	void *block_;					// The single allocation holding both arrays
+	stored_type *values_;
+	timestamp_type *timestamps_;
+	size_type mask_;				// Capacity - 1
+	size_type constructed_;			// Slots [0, constructed_) hold constructed values
+	std::atomic<size_type> begin_;	// Absolute index of the oldest sample
+	std::atomic<size_type> end_;	// Absolute index one past the newest
+};
+
+#endif /* KEYCONTROL_NODE_STORAGE_H */
@@ -0,0 +1,133 @@
+/*
+  TouchKeys: multi-touch musical keyboard control software
+  Copyright (c) 2013 Andrew McPherson
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  =====================================================================
+
+  SpscQueue.h: bounded single-producer, single-consumer queue for
+  passing data between threads without locking.
+*/
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+/* SpscQueue
+ *
+ * Fixed-capacity ring of preallocated elements. Exactly one thread may write
+ * and exactly one (other) thread may read. Elements are filled and consumed in
+ * place: the writer asks for writeSlot(), fills it and calls commitWrite(); the
+ * reader asks for readSlot(), uses it and calls commitRead(). When the queue is
+ * full, writeSlot() returns 0 and the overflow is counted rather than waiting
+ * for the reader.
+ *
+ * Capacity is rounded up to a power of two so indices can be masked.
+ */
+
+template<typename T>
+class SpscQueue {
+public:
+	// ***** Constructor *****
+	SpscQueue(size_t capacity) : writeIndex_(0), readIndex_(0), overflows_(0)
+	{
+		size_t size = 1;
+		while (size < capacity)
+			size <<= 1;
+		capacity_ = size;
+		mask_ = size - 1;
+		buffer_ = new T[size];
+	}
+
+	// ***** Destructor *****
+	~SpscQueue()
+	{
+		delete[] buffer_;
+	}
+
+	// ***** Writer side *****
+	// Return the next free element, or 0 if the queue is full
+	T* writeSlot()
+	{
+		size_t write = writeIndex_.load(std::memory_order_relaxed);
+		if (write - readIndex_.load(std::memory_order_acquire) >= capacity_) {
+			overflows_.fetch_add(1, std::memory_order_relaxed);
+			return 0;
+		}
+		return &buffer_[write & mask_];
+	}
+
+	// Make the element returned by writeSlot() visible to the reader
+	void commitWrite()
+	{
+		writeIndex_.store(writeIndex_.load(std::memory_order_relaxed) + 1,
+				std::memory_order_release);
+	}
+
+	// ***** Reader side *****
+	// Return the oldest element, or 0 if the queue is empty
+	T* readSlot()
+	{
+		size_t read = readIndex_.load(std::memory_order_relaxed);
+		if (read == writeIndex_.load(std::memory_order_acquire))
+			return 0;
+		return &buffer_[read & mask_];
+	}
+
+	// Release the element returned by readSlot() back to the writer
+	void commitRead()
+	{
+		readIndex_.store(readIndex_.load(std::memory_order_relaxed) + 1,
+				std::memory_order_release);
+	}
+
+	// Drop everything in the queue. Only safe from the reader thread.
+	void clear()
+	{
+		readIndex_.store(writeIndex_.load(std::memory_order_acquire),
+				std::memory_order_release);
+	}
+
+	// ***** Status *****
+	size_t capacity() const { return capacity_; }
+	size_t size() const
+	{
+		return writeIndex_.load(std::memory_order_acquire)
+				- readIndex_.load(std::memory_order_acquire);
+	}
+	bool empty() const { return size() == 0; }
+
+	// Number of writes rejected because the queue was full
+	unsigned long overflows() const { return overflows_.load(std::memory_order_relaxed); }
+	void resetOverflows() { overflows_.store(0, std::memory_order_relaxed); }
+
+private:
+	SpscQueue(const SpscQueue&);
+	SpscQueue& operator=(const SpscQueue&);
+
+	T* buffer_;
+	size_t capacity_;
+	size_t mask_;
+
+	// Each index is written by only one side; kept on separate cache lines
+	// so the two threads don't contend for the same line
+	alignas(64) std::atomic<size_t> writeIndex_;
+	alignas(64) std::atomic<size_t> readIndex_;
+	std::atomic<unsigned long> overflows_;
+};
+
+#endif /* SPSC_QUEUE_H */
@@ -15,6 +15,12 @@ namespace Time {
 	{
 		return (double)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now().time_since_epoch()).count();
 	}
+
+	// Monotonic microsecond counter, for measuring short intervals
+	inline long long getMicrosecondCounter()
+	{
+		return (long long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
 };
 
 
@@ -53,8 +53,13 @@ void TimestampSynchronizer::initialize(double clockTimeMilliseconds,
 
 // Given a frame number, calculate a current timestamp
 timestamp_type TimestampSynchronizer::synchronizedTimestamp(int rawFrameNumber) {
-	// Calculate the current system clock-related timestamp
-	timestamp_type clockTime = startingTimestamp_ + milliseconds_to_timestamp(Time::getMillisecondCounterHiRes() - startingClockTimeMilliseconds_);
+	return synchronizedTimestamp(rawFrameNumber, Time::getMillisecondCounterHiRes());
+}
+
+// Given a frame number and the clock time it arrived, calculate a timestamp
+timestamp_type TimestampSynchronizer::synchronizedTimestamp(int rawFrameNumber, double clockTimeMilliseconds) {
+	// Calculate the system clock-related timestamp
+	timestamp_type clockTime = startingTimestamp_ + milliseconds_to_timestamp(clockTimeMilliseconds - startingClockTimeMilliseconds_);
 	timestamp_type frameTime;
 
 	// Retrieve the timestamp of the previous frame
@@ -79,6 +79,10 @@ public:
 	// system clock
 	timestamp_type synchronizedTimestamp(int rawFrameNumber);
 
+	// As above, but using the given clock time as the time the frame was
+	// received rather than the current time, for frames processed after a delay
+	timestamp_type synchronizedTimestamp(int rawFrameNumber, double clockTimeMilliseconds);
+
 private:
 	// History buffer of clock time vs. frame time.  The Node has a data type
 	// (frame number and frame timestamp, respectively) and a timestamp (clock timestamp);
@@ -24,29 +24,72 @@
 */
 
 #include "Trigger.h"
+#include <functional>
+#include <unistd.h>
 
 #undef DEBUG_TRIGGERS
 
+thread_local TriggerSource::Dispatch* TriggerSource::currentDispatch_ = 0;
+
 void TriggerSource::sendTrigger(timestamp_type timestamp) {
 #ifdef DEBUG_TRIGGERS
     std::cerr << "sendTrigger (" << this << ")\n";
 #endif
     
+    // Bring the list up to date if destinations have been added. If someone else holds the
+    // mutex, don't wait for them: the changes will be picked up on a later trigger.
     if(triggerDestinationsModified_) {
-        ScopedLock sl(triggerSourceMutex_);
-        processAddRemoveQueue();
+        if(triggerSourceMutex_.tryEnter()) {
+            processAddQueue();
+            triggerSourceMutex_.exit();
+        }
     }
     
-    std::set<TriggerDestination*>::iterator it = triggerDestinations_.begin();
-	TriggerDestination* target;
-	while(it != triggerDestinations_.end()) {	// Advance the iterator before sending the trigger
-		target = *it;							// in case the triggerReceived routine causes the object to unregister
+    // Most sources have nobody listening most of the time
+    if(lists_[activeList_].count.load(std::memory_order_relaxed) == 0)
+        return;
+    
+    Dispatch dispatch;
+    dispatch.source = this;
+    dispatch.list = acquireList();
+    dispatch.version = listVersions_[dispatch.list];
+    dispatch.outer = currentDispatch_;
+    currentDispatch_ = &dispatch;
+    
+    int i = 0;
+    for(;;) {
+        const DestinationList& list = lists_[dispatch.list];
+        if(i >= list.count)
+            break;
+        TriggerDestination *destination = (i < kTriggerInlineDestinations) ? list.destinations[i]
+                                                                              : list.overflow[i - kTriggerInlineDestinations];
 #ifdef DEBUG_TRIGGERS
-        std::cerr << " --> " << target << std::endl;
+        std::cerr << " --> " << destination << std::endl;
 #endif
-		target->triggerReceived(this, timestamp);
-        it++;
-	}
+        destination->triggerReceived(this, timestamp);
+        i++;
+        
+        // If the destinations changed while that call was made, carry on from the new list
+        // so that removed destinations aren't called. Lists are in set order, so skip past
+        // the destination just called.
+        if(activeList_ != dispatch.list || listVersions_[dispatch.list] != dispatch.version) {
+            listReaders_[dispatch.list]--;
+            dispatch.list = acquireList();
+            dispatch.version = listVersions_[dispatch.list];
+            
+            const DestinationList& newList = lists_[dispatch.list];
+            std::less<TriggerDestination*> before;
+            for(i = 0; i < newList.count; i++) {
+                TriggerDestination *next = (i < kTriggerInlineDestinations) ? newList.destinations[i]
+                                                                               : newList.overflow[i - kTriggerInlineDestinations];
+                if(before(destination, next))
+                    break;
+            }
+        }
+    }
+    
+    listReaders_[dispatch.list]--;
+    currentDispatch_ = dispatch.outer;
 }
 
 void TriggerSource::addTriggerDestination(TriggerDestination* dest) { 
@@ -61,58 +104,125 @@ void TriggerSource::addTriggerDestination(TriggerDestination* dest) {
         triggersToAdd_.insert(dest);
         triggerDestinationsModified_ = true;
     }
-    // If the trigger is also slated to be removed, cancel that request
-    if(triggersToRemove_.count(dest) != 0)
-        triggersToRemove_.erase(dest);
 }
 
 void TriggerSource::removeTriggerDestination(TriggerDestination* dest) {
 #ifdef DEBUG_TRIGGERS
     std::cerr << "removeTriggerDestination (" << this << "): " << dest << "\n";
 #endif
-    ScopedLock sl(triggerSourceMutex_);
-    // Check whether this trigger is actually present
-    if(triggerDestinations_.count(dest) != 0) {
-        triggersToRemove_.insert(dest);
-        triggerDestinationsModified_ = true;
-    }
-    // If the trigger is also slated to be added, cancel that request
-    if(triggersToAdd_.count(dest) != 0)
+    {
+        ScopedLock sl(triggerSourceMutex_);
+        // If the trigger is only slated to be added, cancelling that is enough
         triggersToAdd_.erase(dest);
+        if(triggerDestinations_.erase(dest) == 0)
+            return;
+    }
+    publishDestinationsAndWait();
 }	
 
 void TriggerSource::clearTriggerDestinations() {
 #ifdef DEBUG_TRIGGERS
     std::cerr << "clearTriggerDestinations (" << this << ")\n";
 #endif
-    ScopedLock sl(triggerSourceMutex_);
-    processAddRemoveQueue();
-	std::set<TriggerDestination*>::iterator it;
-	for(it = triggerDestinations_.begin(); it != triggerDestinations_.end(); ++it)
-		(*it)->triggerSourceDeleted(this);		
-	triggerDestinations_.clear();
+    {
+        ScopedLock sl(triggerSourceMutex_);
+        std::set<TriggerDestination*>::iterator it;
+        triggerDestinations_.insert(triggersToAdd_.begin(), triggersToAdd_.end());
+        triggersToAdd_.clear();
+        if(triggerDestinations_.empty() && lists_[activeList_].count == 0)
+            return;
+        for(it = triggerDestinations_.begin(); it != triggerDestinations_.end(); ++it)
+            (*it)->triggerSourceDeleted(this);
+        triggerDestinations_.clear();
+    }
+    publishDestinationsAndWait();
 }
 
-// Process everything in the add and remove groups and transfer them
-// into the main set of trigger destinations. Do this with mutex locked.
-void TriggerSource::processAddRemoveQueue() {
+// Move everything in the add group into the main set of trigger destinations.
+// Do this with mutex locked.
+void TriggerSource::processAddQueue() {
 #ifdef DEBUG_TRIGGERS
-    std::cerr << "processAddRemoveQueue (" << this << ")\n";
+    std::cerr << "processAddQueue (" << this << ")\n";
 #endif
     std::set<TriggerDestination*>::iterator it;
     for(it = triggersToAdd_.begin(); it != triggersToAdd_.end(); ++it) {
         triggerDestinations_.insert(*it);
 #ifdef DEBUG_TRIGGERS
         std::cerr << " --> added " << *it << std::endl;
-#endif
-    }
-    for(it = triggersToRemove_.begin(); it != triggersToRemove_.end(); ++it) {
-        triggerDestinations_.erase(*it);
-#ifdef DEBUG_TRIGGERS
-        std::cerr << " --> removed " << *it << std::endl;
 #endif
     }
     triggersToAdd_.clear();
-    triggersToRemove_.clear();
-    triggerDestinationsModified_ = false;
+    
+    // Leave the modified flag set if the new list couldn't be published yet
+    triggerDestinationsModified_ = !publishDestinations();
+}
+
+// Rebuild the list not in use from the set of destinations and swap it in.
+// Do this with mutex locked.
+bool TriggerSource::publishDestinations() {
+    int spare = 1 - activeList_;
+    
+    if(listReaders_[spare] != readersOnThisThread(spare))
+        return false;
+    
+    DestinationList& list = lists_[spare];
+    std::set<TriggerDestination*>::iterator it;
+    int i = 0;
+    
+    list.overflow.clear();
+    for(it = triggerDestinations_.begin(); it != triggerDestinations_.end(); ++it, ++i) {
+        if(i < kTriggerInlineDestinations)
+            list.destinations[i] = *it;
+        else
+            list.overflow.push_back(*it);
+    }
+    list.count = i;
+    listVersions_[spare]++;
+    activeList_ = spare;
+    return true;
+}
+
+// Publish the destinations, retrying while the spare list is still being read, then wait
+// for other threads to finish with the list that was replaced. Once its readers are gone
+// (or it has been rewritten since), none of them can call a removed destination.
+void TriggerSource::publishDestinationsAndWait() {
+    int retired;
+    unsigned int version;
+    
+    for(;;) {
+        triggerSourceMutex_.enter();
+        retired = activeList_;
+        processAddQueue();
+        version = listVersions_[retired];
+        bool published = (activeList_ != retired);
+        triggerSourceMutex_.exit();
+        if(published)
+            break;
+        usleep(1);
+    }
+    
+    while(listReaders_[retired] != readersOnThisThread(retired) && listVersions_[retired] == version)
+        usleep(1);
+}
+
+// Register as a reader of the active list. If it was swapped out in the meantime, try again
+// so the list we read can't be rewritten underneath us.
+int TriggerSource::acquireList() {
+    int active;
+    for(;;) {
+        active = activeList_;
+        listReaders_[active]++;
+        if(activeList_ == active)
+            return active;
+        listReaders_[active]--;
+    }
+}
+
+int TriggerSource::readersOnThisThread(int list) {
+    int readers = 0;
+    for(Dispatch *dispatch = currentDispatch_; dispatch != 0; dispatch = dispatch->outer) {
+        if(dispatch->source == this && dispatch->list == list)
+            readers++;
+    }
+    return readers;
 }
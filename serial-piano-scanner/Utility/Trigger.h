@@ -28,16 +28,31 @@
 
 #include <iostream>
 #include <set>
+#include <vector>
+#include <atomic>
 #include "CriticalSection.h"
 #include "Types.h"
 
 class TriggerDestination;
 
+// Number of destinations a source can send to before it needs the overflow list
+const int kTriggerInlineDestinations = 8;
+
 /*
  * TriggerSource
  *
  * Provides a set of routines for an object that sends triggers with an associated timestamp.  All Node
  * objects inherit from Trigger, but other objects may use these routines as well.
+ *
+ * sendTrigger() takes no locks. It calls the destinations in a fixed list, which is rebuilt from the set
+ * of destinations only when they change. Two lists are kept: changes are written into the one not
+ * in use and then swapped in, and a list is only rewritten once every sendTrigger() reading it has
+ * finished.
+ *
+ * New destinations are picked up by a later sendTrigger(). Removing a destination takes effect
+ * before removeTriggerDestination() returns: it waits until no other thread is still calling
+ * destinations from the old list. A sendTrigger() on the calling thread (i.e. a destination
+ * unregistering from within triggerReceived()) is not waited for; it moves on to the new list.
  */
 
 class TriggerSource {
@@ -50,7 +65,11 @@ protected:
 public:
 	// ***** Constructor *****
 	
-	TriggerSource() {}	// No instantiating this class directly!
+	TriggerSource() : triggerDestinationsModified_(false), activeList_(0) {	// No instantiating this class directly!
+		lists_[0].count = lists_[1].count = 0;
+		listReaders_[0] = listReaders_[1] = 0;
+		listVersions_[0] = listVersions_[1] = 0;
+	}
 	
 	// ***** Destructor *****
 	
@@ -58,7 +77,7 @@ public:
 	
 	// ***** Connection Management *****
 	
-	bool hasTriggerDestinations() { return triggerDestinations_.size() > 0; }
+	bool hasTriggerDestinations() { return lists_[activeList_].count > 0; }
 
 private:
 	// For internal use or use by friend class NodeBase only
@@ -71,17 +90,52 @@ private:
 	void removeTriggerDestination(TriggerDestination* dest);
 	void clearTriggerDestinations();
     
-    // When sources are added or removed, they are first stored in separate locations to be updated
-    // prior to each new call of sendTrigger(). This way, destinations which are updated from functions
-    // called from sendTrigger() do not render the set inconsistent in the middle.
-    void processAddRemoveQueue();
+    // When destinations are added, they are first stored separately and moved into the set
+    // by a later call of sendTrigger(), which publishes the new list if it can do so without waiting.
+    void processAddQueue();
+    
+    // Copy triggerDestinations_ into the list not in use and make it the active one. Does nothing
+    // and returns false if a sendTrigger() on another thread is still reading that list. Call with
+    // the mutex held.
+    bool publishDestinations();
+    
+    // Publish the set of destinations and wait until no other thread can still be calling a
+    // destination from the list it replaced. Call without the mutex held.
+    void publishDestinationsAndWait();
+    
+    // Start reading the active list, for sendTrigger()
+    int acquireList();
+    
+    // How many sendTrigger() calls on this thread are reading the given list of this source
+    int readersOnThisThread(int list);
 	
 private:
+	// Fixed list of destinations that sendTrigger() walks
+	struct DestinationList {
+		std::atomic<int> count;
+		TriggerDestination* destinations[kTriggerInlineDestinations];
+		std::vector<TriggerDestination*> overflow;	// Destinations beyond the inline array
+	};
+	
+	// A sendTrigger() in progress on this thread; they form a stack through outer
+	struct Dispatch {
+		TriggerSource* source;
+		int list;						// Which of source's lists it is reading
+		unsigned int version;			// listVersions_[list] when it started reading
+		Dispatch* outer;
+	};
+	
 	std::set<TriggerDestination*> triggerDestinations_;
     std::set<TriggerDestination*> triggersToAdd_;
-    std::set<TriggerDestination*> triggersToRemove_;
-    bool triggerDestinationsModified_;
-	CriticalSection triggerSourceMutex_;
+    std::atomic<bool> triggerDestinationsModified_;	// Set until the changes reach the active list
+	CriticalSection triggerSourceMutex_;			// Protects the sets above, and publishing the lists
+	
+	DestinationList lists_[2];
+	std::atomic<int> activeList_;					// Which of lists_ sendTrigger() uses
+	std::atomic<int> listReaders_[2];				// Number of sendTrigger() calls reading each list
+	std::atomic<unsigned int> listVersions_[2];		// Incremented each time a list is rewritten
+	
+	static thread_local Dispatch* currentDispatch_;	// Innermost sendTrigger() on this thread
 };
 
 /*
@@ -114,20 +168,29 @@ public:
 		registeredTriggerSources_.insert(src);
 	}
 	
+	// Removing a source waits for other threads to finish sending it triggers,
+	// so triggerDestMutex_ is released first
+	
 	void unregisterForTrigger(TriggerSource* src) {
 		if(src == 0 || (void*)src == (void*)this)
 			return;
-        ScopedLock sl(triggerDestMutex_);
+		{
+			ScopedLock sl(triggerDestMutex_);
+			if(registeredTriggerSources_.erase(src) == 0)
+				return;
+		}
 		src->removeTriggerDestination(this);
-		registeredTriggerSources_.erase(src);
 	}
 	
 	void clearTriggers() {
-		ScopedLock sl(triggerDestMutex_);
+		std::set<TriggerSource*> sources;
+		{
+			ScopedLock sl(triggerDestMutex_);
+			sources.swap(registeredTriggerSources_);
+		}
 		std::set<TriggerSource*>::iterator it;
-		for(it = registeredTriggerSources_.begin(); it != registeredTriggerSources_.end(); it++)
+		for(it = sources.begin(); it != sources.end(); it++)
 			(*it)->removeTriggerDestination(this);
-		registeredTriggerSources_.clear();
 	}
 	
 protected: